@@ -99,6 +99,11 @@ module flash_arbiter(
         flash_read_size <= (reader_selected ? size_a : size_b);
     end
 
+`ifdef SIM_FLASH_TLM
+    // Keeps the path to flash_reader.flash_tlm accessible from the Verilator sim
+    /* verilator public_module */
+`endif
+
     // --- Flash memory (16Mbyte - 1Mbyte) ---
 
     wire flash_ready;
@@ -66,6 +66,41 @@ module flash_reader #(
         flash_in = nybble_state ? selected_byte[3:0] : selected_byte[7:4];
     end
 
+    wire halted = (reset || !valid || ready);
+
+    wire [4:0] state_final = 5'h0b + (size ? 4 : 0) + DUMMY_CYCLES;
+
+`ifdef SIM_FLASH_TLM
+    // Sim-only transaction level reads, enabled with FLASH_TLM=1 in the sim Makefile
+    // The read is served by the host in one call through flash_tlm_bb instead of the QSPI pins
+    // /CS stays deasserted but ready is asserted with the same latency as a pin level read
+
+    /* verilator public_module */
+
+    wire [31:0] tlm_data;
+
+    flash_tlm_bb flash_tlm(
+        .valid(!halted),
+        .address(address),
+        .size(size),
+        .data(tlm_data)
+    );
+
+    always @(posedge clk) begin
+        if (!halted && state == state_final) begin
+            data[15:0] <= tlm_data[15:0];
+
+            if (size) begin
+                data[31:16] <= tlm_data[31:16];
+            end
+        end
+    end
+
+    always @* begin
+        flash_in_en = 0;
+        flash_csn = 1;
+    end
+`else
     always @(posedge clk) begin
         if (!nybble_state) begin
             case (byte_state - (DUMMY_CYCLES / 2))
@@ -77,8 +112,6 @@ module flash_reader #(
         end
     end
 
-    wire halted = (reset || !valid || ready);
-
     always @* begin
         if (halted) begin
             flash_in_en = 0;
@@ -92,8 +125,7 @@ module flash_reader #(
             endcase
         end
     end
-
-    wire [4:0] state_final = 5'h0b + (size ? 4 : 0) + DUMMY_CYCLES;
+`endif
 
     always @(posedge clk) begin
         if (halted) begin
@@ -57,6 +57,44 @@ module ics32 #(
     output [15:0] audio_output_l,
     output [15:0] audio_output_r,
     output audio_output_valid
+`ifdef SIMULATOR
+    ,
+    // Host writes to the VDP and copper RAM, used by the sim to drive a VDP model in lockstep
+
+    output sim_vdp_write_en,
+    output [6:0] sim_vdp_write_address,
+    output sim_cop_ram_write_en,
+    output [10:0] sim_cop_ram_write_address,
+    output [15:0] sim_write_data,
+
+    // Address of the most recent instruction fetch, used by the sim to sample the CPU program counter
+
+    output [31:0] sim_cpu_pc,
+
+    // Memory writes made by the CPU, used by the sim for trace triggers and stop conditions
+
+    output sim_cpu_write_valid,
+    output [31:0] sim_cpu_write_address,
+    output [31:0] sim_cpu_write_data,
+    output [3:0] sim_cpu_write_wstrb,
+
+    // Copper ops and data words as they're executed, used by the sim to trace the copper
+
+    output sim_cop_op_valid,
+    output sim_cop_data_valid,
+    output [10:0] sim_cop_pc,
+    output [15:0] sim_cop_word,
+    output [10:0] sim_cop_raster_x,
+    output [9:0] sim_cop_raster_y,
+
+    // VRAM bus slot owners and sprite activity, used by the sim to measure the VDP budgets used per line
+
+    output [1:0] sim_vdp_vram_slot,
+    output sim_vdp_vram_host_write,
+    output sim_vdp_sprite_hit,
+    output sim_vdp_sprite_hit_wide,
+    output sim_vdp_sprite_row_fetched
+`endif
 );
     // --- Bootloader ---
 
@@ -407,8 +445,26 @@ module ics32 #(
         .cop_ram_read_data(cop_ram_read_data),
 
         .frame_ended()
+`ifdef SIMULATOR
+        ,
+        .sim_cop_op_valid(sim_cop_op_valid),
+        .sim_cop_data_valid(sim_cop_data_valid),
+        .sim_raster_x(sim_cop_raster_x),
+        .sim_raster_y(sim_cop_raster_y),
+
+        .sim_vram_slot(sim_vdp_vram_slot),
+        .sim_vram_host_write(sim_vdp_vram_host_write),
+        .sim_sprite_hit(sim_vdp_sprite_hit),
+        .sim_sprite_hit_wide(sim_vdp_sprite_hit_wide),
+        .sim_sprite_row_fetched(sim_vdp_sprite_row_fetched)
+`endif
     );
 
+`ifdef SIMULATOR
+    assign sim_cop_pc = cop_ram_read_address;
+    assign sim_cop_word = cop_ram_read_data;
+`endif
+
     vram vram(
         .clk(vdp_clk),
 
@@ -501,6 +557,49 @@ module ics32 #(
         .read_data(cpu_ram_read_data)
     );
 
+    // --- Sim VDP write monitor ---
+
+`ifdef SIMULATOR
+    assign sim_vdp_write_en = vdp_write_en;
+    assign sim_vdp_write_address = vdp_write_address;
+    assign sim_cop_ram_write_en = cop_ram_write_en;
+    assign sim_cop_ram_write_address = cop_ram_write_address;
+    assign sim_write_data = cpu_write_data[15:0];
+`endif
+
+    // --- Sim CPU program counter monitor ---
+
+`ifdef SIMULATOR
+    reg [31:0] sim_cpu_pc_r;
+
+    assign sim_cpu_pc = sim_cpu_pc_r;
+
+    always @(posedge cpu_clk) begin
+        if (cpu_mem_valid_1x && cpu_mem_instr_1x) begin
+            sim_cpu_pc_r <= cpu_address_1x;
+        end
+    end
+
+    // Valid for the cpu_clk cycle following each completed write
+
+    reg sim_cpu_write_valid_r;
+    reg [31:0] sim_cpu_write_address_r;
+    reg [31:0] sim_cpu_write_data_r;
+    reg [3:0] sim_cpu_write_wstrb_r;
+
+    assign sim_cpu_write_valid = sim_cpu_write_valid_r;
+    assign sim_cpu_write_address = sim_cpu_write_address_r;
+    assign sim_cpu_write_data = sim_cpu_write_data_r;
+    assign sim_cpu_write_wstrb = sim_cpu_write_wstrb_r;
+
+    always @(posedge cpu_clk) begin
+        sim_cpu_write_valid_r <= cpu_mem_valid_1x && cpu_mem_ready_1x && |cpu_wstrb_1x;
+        sim_cpu_write_address_r <= cpu_address_1x;
+        sim_cpu_write_data_r <= cpu_write_data_1x;
+        sim_cpu_write_wstrb_r <= cpu_wstrb_1x;
+    end
+`endif
+
     // --- Gamepad IO ---
 
     reg [1:0] pad_ctrl;
@@ -570,6 +669,7 @@ module ics32 #(
     wire [31:0] cpu_address_1x;
     wire [3:0] cpu_wstrb_1x;
     wire cpu_mem_valid_1x;
+    wire cpu_mem_instr_1x;
     wire [31:0] cpu_write_data_1x;
 
     wire [31:0] cpu_read_data_1x;
@@ -588,6 +688,7 @@ module ics32 #(
 
                 .mem_ready(cpu_mem_ready_1x),
                 .mem_valid(cpu_mem_valid_1x),
+                .mem_instr(cpu_mem_instr_1x),
                 .mem_addr(cpu_address_1x),
                 .mem_rdata(cpu_read_data_1x),
                 .mem_wdata(cpu_write_data_1x),
@@ -634,6 +735,7 @@ module ics32 #(
 
                 .mem_ready(cpu_mem_ready_1x),
                 .mem_valid(cpu_mem_valid_1x),
+                .mem_instr(cpu_mem_instr_1x),
                 .mem_addr(cpu_address_1x),
                 .mem_rdata(cpu_read_data_1x),
                 .mem_wdata(cpu_write_data_1x),
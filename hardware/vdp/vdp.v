@@ -61,6 +61,23 @@ module vdp #(
     output cop_ram_read_en,
     output [10:0] cop_ram_read_address,
     input [15:0] cop_ram_read_data
+`ifdef SIMULATOR
+    ,
+    // Copper execution and the raster position it was executed at, used by the sim to trace the copper
+
+    output sim_cop_op_valid,
+    output sim_cop_data_valid,
+    output [10:0] sim_raster_x,
+    output [9:0] sim_raster_y,
+
+    // VRAM bus slot owners and sprite activity, used by the sim to measure how much of each budget is used
+
+    output [1:0] sim_vram_slot,
+    output sim_vram_host_write,
+    output sim_sprite_hit,
+    output sim_sprite_hit_wide,
+    output sim_sprite_row_fetched
+`endif
 );
     // --- Video timing ---
 
@@ -186,8 +203,18 @@ module vdp #(
         .reg_write_address(cop_write_address),
         .reg_write_data(cop_write_data),
         .reg_write_en(copper_write_en)
+`ifdef SIMULATOR
+        ,
+        .sim_op_valid(sim_cop_op_valid),
+        .sim_data_valid(sim_cop_data_valid)
+`endif
     );
 
+`ifdef SIMULATOR
+    assign sim_raster_x = raster_x;
+    assign sim_raster_y = raster_y;
+`endif
+
     // --- Register writes ---
 
     reg [5:0] layer_enable = 0;
@@ -640,8 +667,17 @@ module vdp #(
         .vram_address_even(vram_address_even), .vram_address_odd(vram_address_odd),
         .vram_write_data_even(vram_write_data_even), .vram_write_data_odd(vram_write_data_odd),
         .vram_we_even(vram_we_even), .vram_we_odd(vram_we_odd)
+`ifdef SIMULATOR
+        ,
+        .sim_slot(sim_vram_slot)
+`endif
     );
 
+`ifdef SIMULATOR
+    // Host writes are dropped if the affine layer has the bus, which the sim sees as an affine slot
+    assign sim_vram_host_write = vram_written && vram_port_write_en_mask != 0;
+`endif
+
     // --- Sprites ---
 
     wire [7:0] sprite_pixel;
@@ -673,6 +709,12 @@ module vdp #(
 
         .pixel(sprite_pixel),
         .pixel_priority(sprite_pixel_priority)
+`ifdef SIMULATOR
+        ,
+        .sim_sprite_hit(sim_sprite_hit),
+        .sim_sprite_hit_wide(sim_sprite_hit_wide),
+        .sim_row_fetched(sim_sprite_row_fetched)
+`endif
     );
 
     // --- Affine layer ---
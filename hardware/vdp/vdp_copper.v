@@ -30,6 +30,14 @@ module vdp_copper(
     output reg [4:0] reg_write_address,
     output reg [15:0] reg_write_data,
     output reg reg_write_en
+`ifdef SIMULATOR
+    ,
+    // Set while an op (sim_op_valid) or a WRITE_REG data word (sim_data_valid) is being executed
+    // The word itself is ram_read_data, used by the sim to trace the copper
+
+    output sim_op_valid,
+    output sim_data_valid
+`endif
 );
     localparam PC_RESET = 10'h000;
 
@@ -156,6 +164,11 @@ module vdp_copper(
 
     reg [1:0] state;
 
+`ifdef SIMULATOR
+    assign sim_op_valid = operating && state == STATE_OP_DECODE;
+    assign sim_data_valid = operating && state == STATE_DATA_FETCH;
+`endif
+
     always @(posedge clk) begin
         if (!operating) begin
             pc <= PC_RESET;
@@ -28,6 +28,14 @@ module vdp_sprite_core #(
 
     output [7:0] pixel,
     output [1:0] pixel_priority
+`ifdef SIMULATOR
+    ,
+    // Hit list writes and sprite row reads, used by the sim to measure the sprite budget used per line
+
+    output sim_sprite_hit,
+    output sim_sprite_hit_wide,
+    output sim_row_fetched
+`endif
 );
     reg start_new_line_r;
 
@@ -280,6 +288,12 @@ module vdp_sprite_core #(
         .hit_list_write_en(hit_list_write_en)
     );
 
+`ifdef SIMULATOR
+    // The final write of each line is the terminator rather than a sprite
+    assign sim_sprite_hit = hit_list_write_en && !hit_list_data_in[15];
+    assign sim_sprite_hit_wide = hit_list_data_in[12];
+`endif
+
     // --- Sprite render ---
 
     wire [7:0] hit_list_blitter_read_address;
@@ -317,6 +331,10 @@ module vdp_sprite_core #(
         .line_offset(hit_list_render_read_data[11:8]),
         .width_select(hit_list_render_read_data[12]),
         .hit_list_ended(hit_list_ended)
+`ifdef SIMULATOR
+        ,
+        .sim_row_fetched(sim_row_fetched)
+`endif
     );
 
 endmodule
@@ -42,6 +42,12 @@ module vdp_sprite_render(
     input [3:0] line_offset,
     input width_select,
     input hit_list_ended
+`ifdef SIMULATOR
+    ,
+    // Set when a sprite row is read from VRAM, used by the sim to measure the sprite budget used per line
+
+    output sim_row_fetched
+`endif
 );
     // --- Hit list reading ---
 
@@ -253,6 +259,10 @@ module vdp_sprite_render(
         end
     end
 
+`ifdef SIMULATOR
+    assign sim_row_fetched = vram_loading && vram_load_counter == VRAM_READ_LATENCY && vram_data_valid;
+`endif
+
     // --- Blitter ---
 
     wire blitter_input_valid = sprite_row_is_valid;
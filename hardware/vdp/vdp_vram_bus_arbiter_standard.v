@@ -8,6 +8,7 @@
 
 `include "debug.vh"
 `include "layer_encoding.vh"
+`include "vram_slot_encoding.vh"
 
 // 3 layer, non-interleaved bus arbiter
 // Unlike vdp_vram_bus_arbiter_interleaved, tilemaps are stored in VRAM contiguously
@@ -71,6 +72,12 @@ module vdp_vram_bus_arbiter_standard(
     output reg [13:0] vram_address_even,  vram_address_odd,
     output reg [15:0] vram_write_data_even, vram_write_data_odd,
     output reg vram_we_even, vram_we_odd
+`ifdef SIMULATOR
+    ,
+    // Owner of the VRAM bus on the next cycle, used by the sim to measure how each slot is used
+
+    output reg [1:0] sim_slot
+`endif
 );
     // --- Layer attribute selection ---
 
@@ -317,6 +324,20 @@ module vdp_vram_bus_arbiter_standard(
         vram_we_odd <= affine_needs_vram ? 0 : vram_render_write_en_mask_nx[1];
     end
 
+`ifdef SIMULATOR
+    always @* begin
+        if (affine_needs_vram) begin
+            sim_slot = `VRAM_SLOT_AFFINE;
+        end else begin
+            case (raster_x_offset[2:0])
+                0: sim_slot = `VRAM_SLOT_HOST;
+                1: sim_slot = `VRAM_SLOT_SPRITES;
+                default: sim_slot = `VRAM_SLOT_LAYERS;
+            endcase
+        end
+    end
+`endif
+
     // --- VRAM base address mapping functions ---
 
     function [13:0] full_scroll_tile_base;
@@ -21,6 +21,7 @@ module vexriscv_shared_bus(
 
     input mem_ready,
     output mem_valid,
+    output mem_instr,
 
     output [31:0] mem_addr,
     input [31:0] mem_rdata,
@@ -34,6 +35,7 @@ module vexriscv_shared_bus(
     assign mem_wstrb = vex_wstrb;
 
     assign mem_valid = vex_bus_active;
+    assign mem_instr = vex_i_bus_active;
 
     // VexRiscV simple ibus / dbus <-> PicoRV32 bus adapter
 
@@ -0,0 +1,11 @@
+`ifndef vram_slot_encoding_vh
+`define vram_slot_encoding_vh
+
+// Owner of a VRAM bus slot, as reported by the bus arbiters to the sim
+
+`define VRAM_SLOT_LAYERS 0
+`define VRAM_SLOT_SPRITES 1
+`define VRAM_SLOT_HOST 2
+`define VRAM_SLOT_AFFINE 3
+
+`endif
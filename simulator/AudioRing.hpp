@@ -0,0 +1,133 @@
+// AudioRing.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Fixed-capacity ring of interleaved stereo samples passed from the sim thread to the SDL audio thread
+// Lock-free with exactly one producer (push) and one consumer (pop), neither of which blocks or allocates
+
+// Samples that don't fit are dropped and counted as overruns
+// Samples requested but not yet available are output as silence and counted as underruns
+
+#ifndef AudioRing_hpp
+#define AudioRing_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+class AudioRing {
+
+public:
+    /// Capacity is given in stereo sample pairs and is rounded up to a power of 2.
+    AudioRing(size_t capacity) :
+        capacity(round_capacity(capacity)),
+        mask(this->capacity - 1),
+        sample_buffer(this->capacity * 2) {}
+
+    AudioRing(const AudioRing &) = delete;
+    AudioRing& operator=(const AudioRing &) = delete;
+
+    /// Producer side: appends up to pair_count stereo pairs from interleaved samples.
+    /// Returns the number of pairs written, with the rest counted as overruns.
+    size_t push(const int16_t *samples, size_t pair_count) {
+        size_t write = producer.index.load(std::memory_order_relaxed);
+
+        // The consumer's index is only reloaded if the cached copy suggests there isn't enough room
+        if (capacity - (write - producer.cached_index) < pair_count) {
+            producer.cached_index = consumer.index.load(std::memory_order_acquire);
+        }
+
+        size_t available = capacity - (write - producer.cached_index);
+        size_t count = std::min(pair_count, available);
+
+        copy_in(samples, write, count);
+        producer.index.store(write + count, std::memory_order_release);
+
+        if (count < pair_count) {
+            producer.error_count.store(producer.error_count.load(std::memory_order_relaxed) + pair_count - count, std::memory_order_relaxed);
+        }
+
+        return count;
+    }
+
+    /// Consumer side: fills pair_count stereo pairs of interleaved samples.
+    /// Any pairs that weren't available are zeroed and counted as underruns.
+    /// Returns the number of pairs actually read.
+    size_t pop(int16_t *samples, size_t pair_count) {
+        size_t read = consumer.index.load(std::memory_order_relaxed);
+
+        if (consumer.cached_index - read < pair_count) {
+            consumer.cached_index = producer.index.load(std::memory_order_acquire);
+        }
+
+        size_t available = consumer.cached_index - read;
+        size_t count = std::min(pair_count, available);
+
+        copy_out(samples, read, count);
+        consumer.index.store(read + count, std::memory_order_release);
+
+        if (count < pair_count) {
+            std::fill(samples + count * 2, samples + pair_count * 2, 0);
+            consumer.error_count.store(consumer.error_count.load(std::memory_order_relaxed) + pair_count - count, std::memory_order_relaxed);
+        }
+
+        return count;
+    }
+
+    /// Stereo pairs dropped because the ring was full.
+    uint64_t overrun_count() const { return producer.error_count.load(std::memory_order_relaxed); }
+
+    /// Stereo pairs of silence output because the ring was empty.
+    uint64_t underrun_count() const { return consumer.error_count.load(std::memory_order_relaxed); }
+
+private:
+    static const size_t cache_line_size = 64;
+
+    const size_t capacity;
+    const size_t mask;
+    std::vector<int16_t> sample_buffer;
+
+    // Each side's state is on its own cache line so that the threads don't contend for it
+    // Indexes increase monotonically and are masked only when accessing sample_buffer
+
+    struct alignas(cache_line_size) Side {
+        std::atomic<size_t> index{0};
+        // Last seen index of the other side, only accessed by the thread owning this side
+        size_t cached_index = 0;
+        std::atomic<uint64_t> error_count{0};
+    };
+
+    Side producer;
+    Side consumer;
+
+    void copy_in(const int16_t *samples, size_t index, size_t count) {
+        size_t start = index & mask;
+        size_t first_count = std::min(count, capacity - start);
+
+        std::copy(samples, samples + first_count * 2, &sample_buffer[start * 2]);
+        std::copy(samples + first_count * 2, samples + count * 2, sample_buffer.begin());
+    }
+
+    void copy_out(int16_t *samples, size_t index, size_t count) const {
+        size_t start = index & mask;
+        size_t first_count = std::min(count, capacity - start);
+
+        std::copy(&sample_buffer[start * 2], &sample_buffer[start * 2] + first_count * 2, samples);
+        std::copy(sample_buffer.begin(), sample_buffer.begin() + (count - first_count) * 2, samples + first_count * 2);
+    }
+
+    static size_t round_capacity(size_t capacity) {
+        size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+
+        return rounded;
+    }
+};
+
+#endif /* AudioRing_hpp */
@@ -0,0 +1,48 @@
+// AudioSink.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Caller-provided buffer of interleaved stereo samples filled by Simulation::run_cycles()
+// A sink with zero capacity is disabled and the sim won't fetch samples at all
+
+#ifndef AudioSink_hpp
+#define AudioSink_hpp
+
+#include <stdint.h>
+#include <vector>
+
+class AudioSink {
+
+public:
+    /// Capacity is given in stereo sample pairs.
+    AudioSink(size_t capacity = 0) : sample_buffer(capacity * 2) {}
+
+    bool enabled() const { return !sample_buffer.empty(); }
+
+    /// Appends a stereo sample pair.
+    /// Returns true if the sink is now full and must be drained before pushing more.
+    bool push(int16_t left, int16_t right) {
+        sample_buffer[count++] = left;
+        sample_buffer[count++] = right;
+
+        return full();
+    }
+
+    bool full() const { return count == sample_buffer.size(); }
+
+    /// Interleaved samples (left, right, left, right...).
+    const int16_t *samples() const { return sample_buffer.data(); }
+
+    /// Number of int16_t samples currently held (twice the number of stereo pairs).
+    size_t size() const { return count; }
+
+    void clear() { count = 0; }
+
+private:
+    std::vector<int16_t> sample_buffer;
+    size_t count = 0;
+};
+
+#endif /* AudioSink_hpp */
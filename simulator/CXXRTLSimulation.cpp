@@ -1,11 +1,20 @@
 #include "CXXRTLSimulation.hpp"
+#include "StopConditions.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+thread_local CXXRTLBlackBoxes *CXXRTLBlackBoxes::constructing = NULL;
 
 // Flash blackbox:
 
 class SPIFlashBlackBox : public cxxrtl_design::bb_p_flash__bb {
 
 public:
-    SPIFlashBlackBox(QSPIFlashSim flash) : flash(flash) {};
+    // The copy shares flash contents with the model the sim was created with
+    SPIFlashBlackBox(const QSPIFlashSim &flash) : flash(flash) {};
+
+    QSPIFlashSim &flash_sim() { return flash; }
 
     bool eval() override {
         uint8_t io = flash.update(p_csn.get<bool>(), p_clk.get<bool>(), p_in.get<uint8_t>());
@@ -24,8 +33,6 @@ private:
 class AudioDACSampleSink {
 
 public:
-    static AudioDACSampleSink default_sink;
-
     void set_samples(int16_t left, int16_t right) {
         samples_pending_fetch = true;
         this->left = left;
@@ -52,12 +59,46 @@ private:
     int16_t left = 0, right = 0;
 };
 
-AudioDACSampleSink AudioDACSampleSink::default_sink = AudioDACSampleSink();
+#if SIM_FLASH_TLM
+
+// Transaction level flash blackbox:
+
+class FlashTLMBlackBox : public cxxrtl_design::bb_p_flash__tlm__bb {
+
+public:
+    // The flash blackbox may not have been created yet, so it's looked up on each read
+    FlashTLMBlackBox(const CXXRTLBlackBoxes &black_boxes) : black_boxes(black_boxes) {}
+
+    bool eval() override {
+        bool valid = p_valid.get<bool>();
+        uint32_t address = p_address.get<uint32_t>();
+
+        // Each read is served once, while the flash_reader request stays active
+        if (valid && !(served && address == served_address)) {
+            auto &flash = black_boxes.flash->flash_sim();
+            p_data.set(flash.read_transaction(address, p_size.get<bool>() ? 4 : 2));
+
+            served_address = address;
+        }
+
+        served = valid;
+
+        return bb_p_flash__tlm__bb::eval();
+    }
+
+private:
+    const CXXRTLBlackBoxes &black_boxes;
+
+    bool served = false;
+    uint32_t served_address = 0;
+};
+
+#endif
 
 class AudioDACBlackBox : public cxxrtl_design::bb_p_audio__dac__bb {
 
 public:
-    AudioDACBlackBox(AudioDACSampleSink sample_sink) : sample_sink(sample_sink) {};
+    AudioDACSampleSink &sink() { return sample_sink; }
 
     bool eval() override {
         if (posedge_p_clk()) {
@@ -71,14 +112,88 @@ private:
     AudioDACSampleSink sample_sink;
 };
 
+// VDP write monitor blackbox:
+
+// Only the ports are needed, which are read directly after each step
+class VDPMonitorBlackBox : public cxxrtl_design::bb_p_vdp__monitor__bb {};
+
+// CPU monitor blackbox:
+
+class CPUMonitorBlackBox : public cxxrtl_design::bb_p_cpu__monitor__bb {};
+
+// Copper monitor blackbox:
+
+class CopperMonitorBlackBox : public cxxrtl_design::bb_p_copper__monitor__bb {};
+
+// VDP usage monitor blackbox:
+
+class VDPUsageMonitorBlackBox : public cxxrtl_design::bb_p_vdp__usage__monitor__bb {};
+
 namespace cxxrtl_design {
 
+// The design has exactly one instance of each of these
+
 std::unique_ptr<bb_p_flash__bb> bb_p_flash__bb::create(std::string name, metadata_map parameters, metadata_map attributes) {
-    return std::make_unique<SPIFlashBlackBox>(Simulation::default_flash);
+    auto black_boxes = CXXRTLBlackBoxes::constructing;
+    assert(black_boxes);
+
+    auto flash = std::make_unique<SPIFlashBlackBox>(black_boxes->initial_flash);
+    black_boxes->flash = flash.get();
+    return flash;
 }
 
 std::unique_ptr<bb_p_audio__dac__bb> bb_p_audio__dac__bb::create(std::string name, metadata_map parameters, metadata_map attributes) {
-    return std::make_unique<AudioDACBlackBox>(AudioDACSampleSink::default_sink);
+    auto black_boxes = CXXRTLBlackBoxes::constructing;
+    assert(black_boxes);
+
+    auto audio_dac = std::make_unique<AudioDACBlackBox>();
+    black_boxes->audio_dac = audio_dac.get();
+    return audio_dac;
+}
+
+#if SIM_FLASH_TLM
+std::unique_ptr<bb_p_flash__tlm__bb> bb_p_flash__tlm__bb::create(std::string name, metadata_map parameters, metadata_map attributes) {
+    auto black_boxes = CXXRTLBlackBoxes::constructing;
+    assert(black_boxes);
+
+    return std::make_unique<FlashTLMBlackBox>(*black_boxes);
+}
+#endif
+
+std::unique_ptr<bb_p_vdp__monitor__bb> bb_p_vdp__monitor__bb::create(std::string name, metadata_map parameters, metadata_map attributes) {
+    auto black_boxes = CXXRTLBlackBoxes::constructing;
+    assert(black_boxes);
+
+    auto vdp_monitor = std::make_unique<VDPMonitorBlackBox>();
+    black_boxes->vdp_monitor = vdp_monitor.get();
+    return vdp_monitor;
+}
+
+std::unique_ptr<bb_p_cpu__monitor__bb> bb_p_cpu__monitor__bb::create(std::string name, metadata_map parameters, metadata_map attributes) {
+    auto black_boxes = CXXRTLBlackBoxes::constructing;
+    assert(black_boxes);
+
+    auto cpu_monitor = std::make_unique<CPUMonitorBlackBox>();
+    black_boxes->cpu_monitor = cpu_monitor.get();
+    return cpu_monitor;
+}
+
+std::unique_ptr<bb_p_copper__monitor__bb> bb_p_copper__monitor__bb::create(std::string name, metadata_map parameters, metadata_map attributes) {
+    auto black_boxes = CXXRTLBlackBoxes::constructing;
+    assert(black_boxes);
+
+    auto copper_monitor = std::make_unique<CopperMonitorBlackBox>();
+    black_boxes->copper_monitor = copper_monitor.get();
+    return copper_monitor;
+}
+
+std::unique_ptr<bb_p_vdp__usage__monitor__bb> bb_p_vdp__usage__monitor__bb::create(std::string name, metadata_map parameters, metadata_map attributes) {
+    auto black_boxes = CXXRTLBlackBoxes::constructing;
+    assert(black_boxes);
+
+    auto vdp_usage_monitor = std::make_unique<VDPUsageMonitorBlackBox>();
+    black_boxes->vdp_usage_monitor = vdp_usage_monitor.get();
+    return vdp_usage_monitor;
 }
 
 }
@@ -118,9 +233,85 @@ bool CXXRTLSimulation::vsync() const {
     return top.p_vga__vsync.get<bool>();
 }
 
+bool CXXRTLSimulation::de() const {
+    return top.p_vga__de.get<bool>();
+}
+
+bool CXXRTLSimulation::vdp_write(VDPWrite *write) const {
+    auto monitor = black_boxes.vdp_monitor;
+    if (!monitor->p_valid.get<bool>()) {
+        return false;
+    }
+
+    assert(write);
+
+    write->copper_ram = monitor->p_copper.get<bool>();
+    write->address = monitor->p_address.get<uint16_t>();
+    write->data = monitor->p_data.get<uint16_t>();
+
+    return true;
+}
+
+bool CXXRTLSimulation::copper_step(CopperStep *step) const {
+    auto monitor = black_boxes.copper_monitor;
+    if (!monitor->p_valid.get<bool>()) {
+        return false;
+    }
+
+    assert(step);
+
+    step->raster_x = monitor->p_raster__x.get<uint16_t>();
+    step->raster_y = monitor->p_raster__y.get<uint16_t>();
+    step->pc = monitor->p_pc.get<uint16_t>();
+    step->word = monitor->p_word.get<uint16_t>();
+    step->data = monitor->p_data.get<bool>();
+
+    return true;
+}
+
+bool CXXRTLSimulation::vdp_line_usage(VDPLineUsage *usage) const {
+    auto monitor = black_boxes.vdp_usage_monitor;
+    if (!monitor->p_valid.get<bool>()) {
+        return false;
+    }
+
+    assert(usage);
+
+    usage->raster_y = monitor->p_raster__y.get<uint16_t>();
+    usage->sprites_hit = monitor->p_sprites__hit.get<uint16_t>();
+    usage->sprite_pixels_hit = monitor->p_sprite__pixels__hit.get<uint16_t>();
+    usage->sprite_pixels_rendered = monitor->p_sprite__rows.get<uint16_t>() * 8;
+    usage->layer_slots = monitor->p_layer__slots.get<uint16_t>();
+    usage->sprite_slots = monitor->p_sprite__slots.get<uint16_t>();
+    usage->host_slots = monitor->p_host__slots.get<uint16_t>();
+    usage->affine_slots = monitor->p_affine__slots.get<uint16_t>();
+    usage->host_writes = monitor->p_host__writes.get<uint16_t>();
+    usage->host_writes_dropped = monitor->p_host__writes__dropped.get<uint16_t>();
+
+    return true;
+}
+
+uint32_t CXXRTLSimulation::cpu_pc() const {
+    return black_boxes.cpu_monitor->p_pc.get<uint32_t>();
+}
+
+bool CXXRTLSimulation::cpu_write(CPUWrite *write) const {
+    auto monitor = black_boxes.cpu_monitor;
+    if (!monitor->p_write__valid.get<bool>()) {
+        return false;
+    }
+
+    assert(write);
+    write->address = monitor->p_write__address.get<uint32_t>();
+    write->data = monitor->p_write__data.get<uint32_t>();
+    write->wstrb = monitor->p_write__wstrb.get<uint8_t>();
+
+    return true;
+}
+
 void CXXRTLSimulation::final() {
 #if VCD_WRITE
-    vcd_stream.close();
+    end_trace();
 #endif
 }
 
@@ -128,6 +319,10 @@ bool CXXRTLSimulation::finished() const {
     return false;
 }
 
+Simulation::RunResult CXXRTLSimulation::run_cycles(uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) {
+    return run_cycles_loop(*this, cycles, frame_sink, audio_sink);
+}
+
 void CXXRTLSimulation::step(uint64_t time) {
     // using .set() has a severe performance impact (to profile and confirm)
     top.p_clk__1x = value<1>{clk_1x};
@@ -137,41 +332,188 @@ void CXXRTLSimulation::step(uint64_t time) {
     top.p_btn__1.set(button_1);
     top.p_btn__2.set(button_2);
     top.p_btn__3.set(button_3);
-    
+
+    top.p_btn__y.set(button_y);
+    top.p_btn__up.set(button_up);
+    top.p_btn__down.set(button_down);
+
+    top.p_btn__l.set(button_l);
+    top.p_btn__r.set(button_r);
+
+    top.p_btn__x.set(button_x);
+    top.p_btn__a.set(button_a);
+
+    top.p_btn__start.set(button_start);
+    top.p_btn__select.set(button_select);
+
     top.step();
 
 #if VCD_WRITE
-    update_trace(time);
+    if (trace_active) {
+        update_trace(time);
+    }
 #endif
 }
 
 bool CXXRTLSimulation::get_samples(int16_t *left, int16_t *right) {
-    return AudioDACSampleSink::default_sink.get_samples(left, right);
+    return black_boxes.audio_dac->sink().get_samples(left, right);
+}
+
+QSPIFlashSim &CXXRTLSimulation::flash_model() {
+    return black_boxes.flash->flash_sim();
+}
+
+// Save states:
+
+// All design state (wires, registers and memories) is reachable through the debug items
+// Black box state isn't included in this and is saved separately
+
+// debug_items::table maps to either a single item or a vector of parts depending on the yosys version
+template <class F>
+static void for_each_part(const debug_item &item, F &&f) {
+    f(item);
+}
+
+template <class F>
+static void for_each_part(const std::vector<debug_item> &items, F &&f) {
+    for (auto &item : items) {
+        f(item);
+    }
+}
+
+template <class F>
+static void for_each_state_item(cxxrtl::debug_items &debug, F &&f) {
+    for (auto &entry : debug.table) {
+        for_each_part(entry.second, [&] (const debug_item &item) {
+            // Aliases refer to storage that is already visited through another name
+            if (item.type == debug_item::ALIAS) {
+                return;
+            }
+
+            size_t chunks = (item.width + 31) / 32 * std::max((size_t)item.depth, (size_t)1);
+            f(entry.first, item, chunks);
+        });
+    }
+}
+
+bool CXXRTLSimulation::save_state(const std::string &path, const FrameSink &frame_sink) {
+    StateFileWriter writer(path);
+    if (!writer.good()) {
+        std::cerr << "Failed to open save state for writing: " << path << std::endl;
+        return false;
+    }
+
+    cxxrtl::debug_items debug;
+    top.debug_info(debug);
+
+    for_each_state_item(debug, [&] (const std::string &name, const debug_item &item, size_t chunks) {
+        writer.write_value<uint32_t>(chunks);
+        writer.write(item.curr, chunks * sizeof(uint32_t));
+    });
+
+    black_boxes.flash->flash_sim().save_state(writer);
+    save_host_state(writer, frame_sink);
+
+    if (!writer.good() || !writer.close()) {
+        std::cerr << "Failed to write save state: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool CXXRTLSimulation::load_state(const std::string &path, FrameSink &frame_sink) {
+    StateFileReader reader(path);
+    if (!reader.good()) {
+        std::cerr << "Failed to open save state for reading: " << path << std::endl;
+        return false;
+    }
+
+    cxxrtl::debug_items debug;
+    top.debug_info(debug);
+
+    bool loaded = true;
+
+    for_each_state_item(debug, [&] (const std::string &name, const debug_item &item, size_t chunks) {
+        uint32_t saved_chunks;
+        if (!loaded || !reader.read_value(saved_chunks)) {
+            loaded = false;
+            return;
+        }
+
+        if (saved_chunks != chunks) {
+            std::cerr << "Save state doesn't match design (" << name << ")" << std::endl;
+            loaded = false;
+            return;
+        }
+
+        loaded = reader.read(item.curr, chunks * sizeof(uint32_t));
+
+        // Wires have separate storage for the next value, which must match after a completed step
+        if (loaded && item.next) {
+            std::copy(item.curr, item.curr + chunks, item.next);
+        }
+    });
+
+    loaded = loaded &&
+        black_boxes.flash->flash_sim().load_state(reader) &&
+        load_host_state(reader, frame_sink);
+
+    if (!loaded) {
+        std::cerr << "Failed to load save state: " << path << std::endl;
+        return false;
+    }
+
+    return true;
 }
 
 #if VCD_WRITE
 
-void CXXRTLSimulation::trace(const std::string &filename) {
-    vcd_stream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-    vcd_stream.open(filename, std::ios::out);
+bool CXXRTLSimulation::open_trace(const TraceConfig &config) {
+    vcd_stream.open(config.path, std::ios::out);
+    if (!vcd_stream.good()) {
+        std::cerr << "Failed to open trace for writing: " << config.path << std::endl;
+        return false;
+    }
 
     cxxrtl::debug_items debug;
     top.debug_info(debug);
 
     vcd.timescale(1, "ns");
 
-    // for now, just filter to a few signals of interest
-    const std::vector<std::string> filter_names = {"pico", "clk", "reset", "valid", "ready"};
+    // CXXRTL separates the levels of hierarchical names with spaces rather than dots
+    std::vector<std::string> scope_prefixes;
+    for (auto scope : config.scopes) {
+        std::replace(scope.begin(), scope.end(), '.', ' ');
+        scope_prefixes.push_back(scope);
+    }
 
     vcd.add(debug, [&](const std::string &name, const debug_item &item) {
-        for (auto filter_name : filter_names) {
-            if (name.find(filter_name) != std::string::npos) {
+        if (scope_prefixes.empty()) {
+            return true;
+        }
+
+        for (auto &prefix : scope_prefixes) {
+            bool in_scope = name.compare(0, prefix.size(), prefix) == 0 &&
+                (name.size() == prefix.size() || name[prefix.size()] == ' ');
+
+            if (in_scope) {
                 return true;
             }
         }
 
         return false;
     });
+
+    return true;
+}
+
+bool CXXRTLSimulation::close_trace() {
+    vcd_stream << vcd.buffer;
+    vcd.buffer.clear();
+
+    vcd_stream.close();
+    return !vcd_stream.fail();
 }
 
 void CXXRTLSimulation::update_trace(uint64_t time) {
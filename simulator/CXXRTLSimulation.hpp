@@ -12,17 +12,49 @@
 #include <backends/cxxrtl/cxxrtl_vcd.h>
 #endif
 
-class CXXRTLSimulation: public Simulation {
+class SPIFlashBlackBox;
+class AudioDACBlackBox;
+class VDPMonitorBlackBox;
+class CPUMonitorBlackBox;
+class CopperMonitorBlackBox;
+class VDPUsageMonitorBlackBox;
+
+// Blackboxes are created by the design's constructor through static factories
+// Each one registers itself with the CXXRTLBlackBoxes of the sim being constructed on the same thread
+
+struct CXXRTLBlackBoxes {
+    CXXRTLBlackBoxes(const QSPIFlashSim &flash) : initial_flash(flash) {
+        constructing = this;
+    }
+
+    QSPIFlashSim initial_flash;
+
+    SPIFlashBlackBox *flash = NULL;
+    AudioDACBlackBox *audio_dac = NULL;
+    VDPMonitorBlackBox *vdp_monitor = NULL;
+    CPUMonitorBlackBox *cpu_monitor = NULL;
+    CopperMonitorBlackBox *copper_monitor = NULL;
+    VDPUsageMonitorBlackBox *vdp_usage_monitor = NULL;
+
+    static thread_local CXXRTLBlackBoxes *constructing;
+};
+
+class CXXRTLSimulation final: public Simulation {
 
 public:
+    /// The flash model is copied, which shares its contents with flash rather than copying them.
+    CXXRTLSimulation(const QSPIFlashSim &flash) : black_boxes(flash) {
+        CXXRTLBlackBoxes::constructing = NULL;
+    }
+
     void forward_cmd_args(int argc, const char * argv[]) override {};
 
     void preload_cpu_program(const std::vector<uint8_t> &program) override;
     void step(uint64_t time) override;
+    RunResult run_cycles(uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) override;
 
-#if VCD_WRITE
-    void trace(const std::string &filename) override;
-#endif
+    bool save_state(const std::string &path, const FrameSink &frame_sink) override;
+    bool load_state(const std::string &path, FrameSink &frame_sink) override;
 
     uint8_t r() const override;
     uint8_t g() const override;
@@ -30,22 +62,36 @@ public:
 
     bool hsync() const override;
     bool vsync() const override;
+    bool de() const override;
+
+    bool vdp_write(VDPWrite *write) const override;
+    bool copper_step(CopperStep *step) const override;
+    bool vdp_line_usage(VDPLineUsage *usage) const override;
+
+    uint32_t cpu_pc() const override;
+    bool cpu_write(CPUWrite *write) const override;
 
     bool get_samples(int16_t *left, int16_t *right) override;
+
+    QSPIFlashSim &flash_model() override;
     
     void final() override;
 
     bool finished() const override;
 
 private:
+    // This must be declared before top so that it's constructed before any blackboxes are
+    CXXRTLBlackBoxes black_boxes;
     cxxrtl_design::p_ics32__tb top;
-    std::unique_ptr<QSPIFlashSim> flash;
 
 #if VCD_WRITE
     cxxrtl::vcd_writer vcd;
     std::ofstream vcd_stream;
 
     void update_trace(uint64_t time);
+
+    bool open_trace(const TraceConfig &config) override;
+    bool close_trace() override;
 #endif
 };
 
@@ -0,0 +1,254 @@
+// CopperTrace.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "CopperTrace.hpp"
+
+#include <iostream>
+#include <cstring>
+
+static const char magic[8] = {'i', 'c', 's', '3', '2', 'c', 'o', 'p'};
+static const uint16_t version = 2;
+static const size_t header_size = sizeof(magic) + 5 * sizeof(uint16_t);
+
+static void write16(uint8_t *bytes, uint16_t value) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+}
+
+static void write32(uint8_t *bytes, uint32_t value) {
+    write16(bytes, value);
+    write16(bytes + 2, value >> 16);
+}
+
+static uint16_t read16(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8;
+}
+
+static uint32_t read32(const uint8_t *bytes) {
+    return read16(bytes) | (uint32_t)read16(bytes + 2) << 16;
+}
+
+// Tracer:
+
+bool CopperTracer::open(const std::string &path) {
+    stream.open(path, std::ios::binary | std::ios::trunc);
+    if (!stream.good()) {
+        std::cerr << "Failed to open copper trace for writing: " << path << std::endl;
+        return false;
+    }
+
+    uint8_t header[header_size];
+    memcpy(header, magic, sizeof(magic));
+    write16(&header[8], version);
+    write16(&header[10], timing.h_total());
+    write16(&header[12], timing.h_offscreen());
+    write16(&header[14], timing.v_total());
+    write16(&header[16], timing.v_active);
+
+    stream.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    return stream.good();
+}
+
+void CopperTracer::copper_stepped(const Simulation::CopperStep &step) {
+    // Each step is at least a cycle after the previous one, so anything at or before it is in a later frame
+    uint32_t position = (uint32_t)step.raster_y * timing.h_total() + step.raster_x;
+    if (steps_traced && position <= previous_position) {
+        frame++;
+    }
+
+    previous_position = position;
+    steps_traced = true;
+
+    CopperTraceRecord record;
+    record.frame = frame;
+    record.raster_x = step.raster_x;
+    record.raster_y = step.raster_y;
+    record.pc = step.pc;
+    record.word = step.word;
+    record.flags = (step.data ? CopperTraceRecord::DATA : 0);
+    record.reg = 0;
+
+    decode(step, record);
+
+    op_count += !step.data;
+    write_count += (record.flags & CopperTraceRecord::WRITE) != 0;
+    missed_target_count += (record.flags & CopperTraceRecord::MISSED_TARGET) != 0;
+    next_frame_wait_count += (record.flags & CopperTraceRecord::WAIT_NEXT_FRAME) != 0;
+
+    uint8_t bytes[CopperTraceRecord::size];
+    write32(&bytes[0], record.frame);
+    write16(&bytes[4], record.raster_x);
+    write16(&bytes[6], record.raster_y);
+    write16(&bytes[8], record.pc);
+    write16(&bytes[10], record.word);
+    bytes[12] = record.flags;
+    bytes[13] = record.reg;
+
+    stream.write(reinterpret_cast<const char *>(bytes), sizeof(bytes));
+}
+
+void CopperTracer::decode(const Simulation::CopperStep &step, CopperTraceRecord &record) {
+    const uint16_t word = step.word;
+
+    if (step.data) {
+        uint8_t reg_offset = 0;
+        bool batch_complete = true;
+
+        switch (write_increment_mode) {
+            case 1:
+                reg_offset = write_counter & 1;
+                batch_complete = write_counter & 1;
+                break;
+            case 2:
+                reg_offset = write_counter & 3;
+                batch_complete = (write_counter & 3) == 3;
+                break;
+        }
+
+        record.flags |= CopperTraceRecord::WRITE;
+        record.reg = (write_target_reg + reg_offset) & 0x1f;
+
+        write_counter = (write_counter + 1) & 3;
+
+        if (batch_complete && write_batch_count > 0) {
+            write_batch_count--;
+
+            if (write_auto_wait) {
+                target_y = (step.raster_y + 1) & 0x3ff;
+                record.flags |= CopperTraceRecord::WAIT;
+            }
+        }
+    } else {
+        switch (word >> 14) {
+            case 0: {
+                // SET_TARGET
+                uint16_t value = word & 0x7ff;
+
+                if (word & (1 << 11)) {
+                    target_y = value & 0x3ff;
+                } else {
+                    target_x = value;
+                }
+
+                if (word & (1 << 12)) {
+                    record.flags |= CopperTraceRecord::WAIT;
+                }
+            } break;
+            case 1:
+                // WRITE_COMPRESSED
+                record.flags |= CopperTraceRecord::WRITE;
+                record.reg = word & 0x1f;
+
+                if (word & (1 << 11)) {
+                    target_y = (step.raster_y + 1) & 0x3ff;
+                }
+                break;
+            case 2:
+                // WRITE_REG
+                write_target_reg = word & 0x1f;
+                write_batch_count = (word >> 6) & 0x1f;
+                write_auto_wait = word & (1 << 11);
+                write_increment_mode = (word >> 12) & 0x03;
+                write_counter = 0;
+                break;
+            case 3:
+                // JUMP
+                break;
+        }
+    }
+
+    if (record.flags & CopperTraceRecord::WAIT) {
+        record.flags |= wait_flags(step.raster_x, step.raster_y);
+    }
+}
+
+uint8_t CopperTracer::wait_flags(uint16_t raster_x, uint16_t raster_y) const {
+    // The copper only advances once the raster exactly matches its target, so these are never reached
+    if (target_x >= timing.h_total() || target_y >= timing.v_total()) {
+        return CopperTraceRecord::MISSED_TARGET;
+    }
+
+    // Waiting starts on the cycle after this one, which is the earliest the target can be hit
+    uint32_t current = (uint32_t)raster_y * timing.h_total() + raster_x;
+    uint32_t target = (uint32_t)target_y * timing.h_total() + target_x;
+
+    if (target > current) {
+        return 0;
+    }
+
+    // Targets further back are taken to be waits for the start of the next frame, such as for the first line of a
+    // copper list that loops
+    return (raster_y - target_y <= 1) ? CopperTraceRecord::MISSED_TARGET : CopperTraceRecord::WAIT_NEXT_FRAME;
+}
+
+bool CopperTracer::close() {
+    stream.close();
+
+    std::cout << "Copper trace: " << op_count << " ops, " << write_count << " register writes, "
+        << missed_target_count << " missed targets, " << next_frame_wait_count << " waits for the next frame over "
+        << (steps_traced ? frame + 1 : 0) << " frames" << std::endl;
+
+    if (stream.fail()) {
+        std::cerr << "Failed to write copper trace" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Reader:
+
+bool CopperTraceReader::open(const std::string &path) {
+    stream.open(path, std::ios::binary);
+    if (!stream.good()) {
+        std::cerr << "Failed to open copper trace: " << path << std::endl;
+        return false;
+    }
+
+    uint8_t header[header_size];
+    if (!stream.read(reinterpret_cast<char *>(header), sizeof(header)) || memcmp(header, magic, sizeof(magic)) != 0) {
+        std::cerr << "Not a copper trace: " << path << std::endl;
+        return false;
+    }
+
+    if (read16(&header[8]) != version) {
+        std::cerr << "Unsupported copper trace version: " << read16(&header[8]) << std::endl;
+        return false;
+    }
+
+    uint16_t h_total = read16(&header[10]);
+    uint16_t h_offscreen = read16(&header[12]);
+    uint16_t v_total = read16(&header[14]);
+    uint16_t v_active = read16(&header[16]);
+
+    if (h_offscreen >= h_total || v_active >= v_total) {
+        std::cerr << "Invalid video timing in copper trace: " << path << std::endl;
+        return false;
+    }
+
+    // Only the totals and active areas are stored, which is all that copper_view needs
+    timing = {(uint16_t)(h_total - h_offscreen), 0, 0, h_offscreen, v_active, 0, 0, (uint16_t)(v_total - v_active), 0};
+
+    return true;
+}
+
+bool CopperTraceReader::read(CopperTraceRecord *record) {
+    uint8_t bytes[CopperTraceRecord::size];
+    if (!stream.read(reinterpret_cast<char *>(bytes), sizeof(bytes))) {
+        return false;
+    }
+
+    record->frame = read32(&bytes[0]);
+    record->raster_x = read16(&bytes[4]);
+    record->raster_y = read16(&bytes[6]);
+    record->pc = read16(&bytes[8]);
+    record->word = read16(&bytes[10]);
+    record->flags = bytes[12];
+    record->reg = bytes[13];
+
+    return true;
+}
@@ -0,0 +1,109 @@
+// CopperTrace.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Binary trace of every op and data word executed by the copper, read back by copper_view
+// Ops are decoded as they're traced so that each record has the register written and whether a wait's target was
+// already passed
+
+// File format (little endian):
+// Header: "ics32cop", version (u16), h_total (u16), h_offscreen (u16), v_total (u16), v_active (u16)
+// Records: frame (u32), raster_x (u16), raster_y (u16), pc (u16), word (u16), flags (u8), register (u8)
+
+// Frames are counted by the copper's raster wrapping around rather than the frames output by the sim
+
+#ifndef CopperTrace_hpp
+#define CopperTrace_hpp
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+
+#include "Simulation.hpp"
+#include "VDPTiming.hpp"
+
+struct CopperTraceRecord {
+    enum Flags: uint8_t {
+        // Word is data for a WRITE_REG op rather than an op
+        DATA = 0x01,
+        // A register was written, with the register index in reg
+        WRITE = 0x02,
+        // The copper waits on its raster target after this
+        WAIT = 0x04,
+        // The raster target was passed on this line or the previous one, or is out of range
+        // The wait lasts until the next frame or longer, which is almost always a mistake such as a target set too late
+        MISSED_TARGET = 0x08,
+        // The raster target is earlier in the frame than the previous line, so the wait deliberately lasts until the
+        // target is reached in the next frame
+        WAIT_NEXT_FRAME = 0x10
+    };
+
+    uint32_t frame;
+    uint16_t raster_x;
+    uint16_t raster_y;
+    uint16_t pc;
+    uint16_t word;
+    uint8_t flags;
+    uint8_t reg;
+
+    static const size_t size = 14;
+};
+
+class CopperTracer : public Simulation::CopperStepSink {
+
+public:
+    CopperTracer(const VDPTiming &timing = VDPTiming::mode_configured()) : timing(timing) {}
+
+    bool open(const std::string &path);
+
+    void copper_stepped(const Simulation::CopperStep &step) override;
+
+    /// Prints a summary of what was traced and closes the trace.
+    bool close();
+
+private:
+    VDPTiming timing;
+    std::ofstream stream;
+
+    uint32_t frame = 0;
+    uint32_t previous_position = 0;
+    bool steps_traced = false;
+
+    // Decoder state, mirroring vdp_copper.v
+    uint16_t target_x = 0;
+    uint16_t target_y = 0;
+
+    uint8_t write_target_reg = 0;
+    uint8_t write_batch_count = 0;
+    bool write_auto_wait = false;
+    uint8_t write_increment_mode = 0;
+    uint8_t write_counter = 0;
+
+    uint64_t op_count = 0;
+    uint64_t write_count = 0;
+    uint64_t missed_target_count = 0;
+    uint64_t next_frame_wait_count = 0;
+
+    void decode(const Simulation::CopperStep &step, CopperTraceRecord &record);
+    // Returns MISSED_TARGET, WAIT_NEXT_FRAME or 0 if the target is still ahead in this frame
+    uint8_t wait_flags(uint16_t raster_x, uint16_t raster_y) const;
+};
+
+class CopperTraceReader {
+
+public:
+    bool open(const std::string &path);
+
+    /// Returns false once there are no more records.
+    bool read(CopperTraceRecord *record);
+
+    const VDPTiming &video_timing() const { return timing; }
+
+private:
+    std::ifstream stream;
+    VDPTiming timing = VDPTiming::mode_848x480();
+};
+
+#endif /* CopperTrace_hpp */
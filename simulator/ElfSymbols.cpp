@@ -0,0 +1,187 @@
+// ElfSymbols.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "ElfSymbols.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+
+// Only the parts of the ELF format that are used here
+
+static const size_t elf_header_size = 52;
+static const size_t section_header_size = 40;
+static const size_t symbol_size = 16;
+
+static const uint32_t sht_symtab = 2;
+static const uint32_t shf_execinstr = 0x4;
+
+static const uint8_t stt_notype = 0;
+static const uint8_t stt_func = 2;
+
+static const uint16_t shn_loreserve = 0xff00;
+
+static uint16_t read16(const std::vector<uint8_t> &bytes, size_t offset) {
+    return bytes[offset] | bytes[offset + 1] << 8;
+}
+
+static uint32_t read32(const std::vector<uint8_t> &bytes, size_t offset) {
+    return read16(bytes, offset) | (uint32_t)read16(bytes, offset + 2) << 16;
+}
+
+bool ElfSymbols::load(const std::string &path) {
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.good()) {
+        std::cerr << "Failed to open ELF: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> elf((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    const uint8_t magic[] = {0x7f, 'E', 'L', 'F'};
+    const uint8_t elfclass32 = 1, elfdata2lsb = 1;
+
+    if (elf.size() < elf_header_size || !std::equal(magic, magic + 4, elf.begin())) {
+        std::cerr << "Not an ELF file: " << path << std::endl;
+        return false;
+    }
+
+    if (elf[4] != elfclass32 || elf[5] != elfdata2lsb) {
+        std::cerr << "Expected a 32bit little endian ELF: " << path << std::endl;
+        return false;
+    }
+
+    uint32_t section_offset = read32(elf, 32);
+    uint16_t section_count = read16(elf, 48);
+
+    if (read16(elf, 46) != section_header_size ||
+        (uint64_t)section_offset + (uint64_t)section_count * section_header_size > elf.size()) {
+        std::cerr << "Invalid ELF section headers: " << path << std::endl;
+        return false;
+    }
+
+    auto section_header = [&] (uint32_t index) {
+        return section_offset + index * section_header_size;
+    };
+
+    auto in_bounds = [&] (uint32_t offset, uint32_t size) {
+        return (uint64_t)offset + size <= elf.size();
+    };
+
+    symbols.clear();
+    bool symtab_found = false;
+
+    for (uint32_t i = 0; i < section_count; i++) {
+        size_t header = section_header(i);
+        if (read32(elf, header + 4) != sht_symtab) {
+            continue;
+        }
+
+        uint32_t symtab_offset = read32(elf, header + 16);
+        uint32_t symtab_size = read32(elf, header + 20);
+        uint32_t strtab_index = read32(elf, header + 24);
+
+        if (strtab_index >= section_count) {
+            break;
+        }
+
+        uint32_t strtab_offset = read32(elf, section_header(strtab_index) + 16);
+        uint32_t strtab_size = read32(elf, section_header(strtab_index) + 20);
+
+        if (!in_bounds(symtab_offset, symtab_size) || !in_bounds(strtab_offset, strtab_size)) {
+            break;
+        }
+
+        symtab_found = true;
+
+        for (uint32_t offset = symtab_offset; offset + symbol_size <= symtab_offset + symtab_size; offset += symbol_size) {
+            uint32_t name_offset = read32(elf, offset);
+            uint8_t type = elf[offset + 12] & 0xf;
+            uint16_t section_index = read16(elf, offset + 14);
+
+            if (type != stt_func && type != stt_notype) {
+                continue;
+            }
+
+            // Only symbols in executable sections can be the target of a PC
+            if (section_index == 0 || section_index >= shn_loreserve || section_index >= section_count) {
+                continue;
+            }
+
+            if (!(read32(elf, section_header(section_index) + 8) & shf_execinstr)) {
+                continue;
+            }
+
+            if (name_offset >= strtab_size) {
+                continue;
+            }
+
+            const char *name_start = reinterpret_cast<const char *>(&elf[strtab_offset + name_offset]);
+            std::string name(name_start, strnlen(name_start, strtab_size - name_offset));
+
+            // Compiler generated local labels and RISC-V mapping symbols aren't useful to attribute samples to
+            if (name.empty() || name.compare(0, 2, ".L") == 0 || name[0] == '$') {
+                continue;
+            }
+
+            Symbol symbol;
+            symbol.address = read32(elf, offset + 4);
+            symbol.size = read32(elf, offset + 8);
+            symbol.name = name;
+            symbols.push_back(symbol);
+        }
+
+        break;
+    }
+
+    if (!symtab_found) {
+        std::cerr << "No symbol table found in ELF: " << path << std::endl;
+        return false;
+    }
+
+    // Where several symbols share an address, sized ones (i.e. C functions) are preferred over labels
+
+    std::sort(symbols.begin(), symbols.end(), [] (const Symbol &a, const Symbol &b) {
+        if (a.address != b.address) {
+            return a.address < b.address;
+        }
+
+        return (a.size != 0) > (b.size != 0);
+    });
+
+    symbols.erase(std::unique(symbols.begin(), symbols.end(), [] (const Symbol &a, const Symbol &b) {
+        return a.address == b.address;
+    }), symbols.end());
+
+    return true;
+}
+
+const ElfSymbols::Symbol *ElfSymbols::lookup(uint32_t address) const {
+    auto next = std::upper_bound(symbols.begin(), symbols.end(), address, [] (uint32_t address, const Symbol &symbol) {
+        return address < symbol.address;
+    });
+
+    if (next == symbols.begin()) {
+        return NULL;
+    }
+
+    const Symbol &symbol = *(next - 1);
+    if (symbol.size != 0 && address - symbol.address >= symbol.size) {
+        return NULL;
+    }
+
+    return &symbol;
+}
+
+const ElfSymbols::Symbol *ElfSymbols::find(const std::string &name) const {
+    auto symbol = std::find_if(symbols.begin(), symbols.end(), [&] (const Symbol &symbol) {
+        return symbol.name == name;
+    });
+
+    return symbol != symbols.end() ? &*symbol : NULL;
+}
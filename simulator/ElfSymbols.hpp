@@ -0,0 +1,42 @@
+// ElfSymbols.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Function symbols read from the symbol table of a 32bit little endian ELF, such as the prog.elf of a program
+// Only what's needed to map addresses to names is read, there is no debug info or DWARF support
+
+#ifndef ElfSymbols_hpp
+#define ElfSymbols_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class ElfSymbols {
+
+public:
+    struct Symbol {
+        uint32_t address;
+        // Symbols without a size (i.e. assembly labels) extend up to the next symbol
+        uint32_t size;
+        std::string name;
+    };
+
+    bool load(const std::string &path);
+
+    /// Returns the symbol containing address, or NULL if there is none.
+    const Symbol *lookup(uint32_t address) const;
+
+    /// Returns the first symbol with the given name, or NULL if there is none.
+    const Symbol *find(const std::string &name) const;
+
+    size_t size() const { return symbols.size(); }
+
+private:
+    // Sorted by address
+    std::vector<Symbol> symbols;
+};
+
+#endif /* ElfSymbols_hpp */
@@ -0,0 +1,201 @@
+// FlashImage.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "FlashImage.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <new>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+FlashImage::FlashImage(size_t size) : reserved_size(size) {
+    page_size = sysconf(_SC_PAGESIZE);
+
+    // Untouched pages of an anonymous mapping read as 0 and don't use any memory
+    void *mapping = mmap(NULL, reserved_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+
+    base = static_cast<uint8_t *>(mapping);
+    dirty_pages.resize((reserved_size + page_size - 1) / page_size, false);
+}
+
+FlashImage::~FlashImage() {
+    munmap(base, reserved_size);
+
+    for (auto &mapping : file_mappings) {
+        close(mapping.fd);
+    }
+}
+
+bool FlashImage::map_file(const std::string &path, size_t offset, size_t min_length) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open flash image: " << path << std::endl;
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        std::cerr << "Failed to read flash image size: " << path << std::endl;
+        close(fd);
+        return false;
+    }
+
+    size_t length = file_stat.st_size;
+    size_t defined_length = std::max(length, min_length);
+
+    if (offset + defined_length > reserved_size) {
+        std::cerr << "Flash image doesn't fit in flash memory: " << path << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // Bytes from the end of the file to the end of its last page are zeroed by the mapping
+    size_t end = offset + length;
+    size_t mapped_end = std::min((end + page_size - 1) / page_size * page_size, reserved_size);
+    std::vector<uint8_t> tail(base + end, base + mapped_end);
+
+    bool mapped = false;
+
+    if (length > 0 && offset % page_size == 0) {
+        int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+        mapped = mmap(base + offset, length, prot, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+    }
+
+    if (mapped) {
+        file_mappings.push_back({fd, offset, length});
+
+        std::fill(dirty_pages.begin() + offset / page_size, dirty_pages.begin() + mapped_end / page_size, false);
+
+        if (std::any_of(tail.begin(), tail.end(), [] (uint8_t byte) { return byte != 0; })) {
+            make_writable();
+            std::copy(tail.begin(), tail.end(), base + end);
+            mark_dirty(end, tail.size());
+        }
+    } else {
+        make_writable();
+
+        size_t read_length = 0;
+        while (read_length < length) {
+            ssize_t result = pread(fd, base + offset + read_length, length - read_length, read_length);
+            if (result <= 0) {
+                std::cerr << "Failed to read flash image: " << path << std::endl;
+                close(fd);
+                return false;
+            }
+
+            read_length += result;
+        }
+
+        close(fd);
+        mark_dirty(offset, length);
+    }
+
+    // Padding beyond the end of the file is still zero as it was never written
+    define(offset, defined_length);
+
+    return true;
+}
+
+void FlashImage::load(const std::vector<uint8_t> &source, size_t offset) {
+    assert(offset + source.size() <= reserved_size);
+
+    make_writable();
+    std::copy(source.begin(), source.end(), base + offset);
+
+    mark_dirty(offset, source.size());
+    define(offset, source.size());
+}
+
+void FlashImage::write(size_t index, uint8_t byte) {
+    assert(index < reserved_size);
+
+    make_writable();
+    base[index] = byte;
+
+    mark_dirty(index, 1);
+    define(index, 1);
+}
+
+std::unique_ptr<FlashImage> FlashImage::clone() const {
+    auto image = std::unique_ptr<FlashImage>(new FlashImage(reserved_size));
+
+    for (auto &mapping : file_mappings) {
+        int fd = dup(mapping.fd);
+        void *target = image->base + mapping.offset;
+
+        if (fd >= 0 && mmap(target, mapping.length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+            image->file_mappings.push_back({fd, mapping.offset, mapping.length});
+        } else {
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            image->make_writable();
+            std::memcpy(target, base + mapping.offset, mapping.length);
+            image->mark_dirty(mapping.offset, mapping.length);
+        }
+    }
+
+    for (size_t page = 0; page < dirty_pages.size(); page++) {
+        if (!dirty_pages[page]) {
+            continue;
+        }
+
+        size_t offset = page * page_size;
+        size_t length = std::min(page_size, reserved_size - offset);
+
+        image->make_writable();
+        std::memcpy(image->base + offset, base + offset, length);
+        image->dirty_pages[page] = true;
+    }
+
+    image->defined_bitmap = defined_bitmap;
+    image->defined_end_index = defined_end_index;
+
+    return image;
+}
+
+void FlashImage::define(size_t offset, size_t length) {
+    size_t end = offset + length;
+    defined_end_index = std::max(defined_end_index, end);
+    defined_bitmap.resize((defined_end_index + 63) / 64, 0);
+
+    for (size_t index = offset; index < end; index++) {
+        defined_bitmap[index / 64] |= (uint64_t)1 << (index % 64);
+    }
+}
+
+void FlashImage::mark_dirty(size_t offset, size_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    size_t first_page = offset / page_size;
+    size_t last_page = (offset + length - 1) / page_size;
+    std::fill(dirty_pages.begin() + first_page, dirty_pages.begin() + last_page + 1, true);
+}
+
+void FlashImage::make_writable() {
+    if (writable) {
+        return;
+    }
+
+    // Mapped files are private so any pages written are copied and the files are left as is
+    if (mprotect(base, reserved_size, PROT_READ | PROT_WRITE) != 0) {
+        throw std::bad_alloc();
+    }
+
+    writable = true;
+}
@@ -0,0 +1,84 @@
+// FlashImage.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Contents of flash memory, shared by every QSPIFlashSim copied from the same model
+// The full address range is reserved up front and files are mmap'd into it read-only, so they're never copied
+
+// Writes go to private pages of the mapping and never reach the files
+// QSPIFlashSim clones a shared image before writing to it, which only copies the pages that were written
+
+#ifndef FlashImage_hpp
+#define FlashImage_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+class FlashImage {
+
+public:
+    /// Reserves an image of the given size with all bytes undefined.
+    /// Memory is only committed for pages that are written to.
+    FlashImage(size_t size);
+    ~FlashImage();
+
+    FlashImage(const FlashImage &) = delete;
+    FlashImage& operator=(const FlashImage &) = delete;
+
+    /// Maps the file at path read-only into the image at offset.
+    /// If the file is shorter than min_length, the remaining bytes read as 0 and are also defined.
+    /// Offsets that aren't page aligned fall back to reading the file into the image.
+    bool map_file(const std::string &path, size_t offset, size_t min_length = 0);
+
+    /// Copies the entire contents of source into the image at offset.
+    void load(const std::vector<uint8_t> &source, size_t offset);
+
+    /// Writes a single byte, which becomes defined if it wasn't already.
+    void write(size_t index, uint8_t byte);
+
+    /// Returns a private copy of the image.
+    /// Mapped files are mapped again rather than copied, so only pages that were written are duplicated.
+    std::unique_ptr<FlashImage> clone() const;
+
+    const uint8_t *bytes() const { return base; }
+    size_t size() const { return reserved_size; }
+
+    /// End of the highest defined region, or 0 if nothing was loaded.
+    size_t defined_end() const { return defined_end_index; }
+
+    bool is_defined(size_t index) const {
+        return index < defined_end_index && (defined_bitmap[index / 64] >> (index % 64)) & 1;
+    }
+
+private:
+    struct FileMapping {
+        int fd;
+        size_t offset;
+        size_t length;
+    };
+
+    uint8_t *base = NULL;
+    size_t reserved_size = 0;
+    size_t page_size = 0;
+
+    std::vector<FileMapping> file_mappings;
+
+    // Pages whose contents aren't (only) from a mapped file and must be copied when cloning
+    std::vector<bool> dirty_pages;
+    bool writable = false;
+
+    // One bit per byte, set if the byte was loaded or written
+    std::vector<uint64_t> defined_bitmap;
+    size_t defined_end_index = 0;
+
+    void define(size_t offset, size_t length);
+    void mark_dirty(size_t offset, size_t length);
+    void make_writable();
+};
+
+#endif /* FlashImage_hpp */
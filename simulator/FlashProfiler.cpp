@@ -0,0 +1,239 @@
+// FlashProfiler.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "FlashProfiler.hpp"
+#include "JSONFormat.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+
+bool FlashProfiler::load_regions(const std::string &path) {
+    std::ifstream map_stream(path);
+    if (!map_stream.good()) {
+        std::cerr << "Failed to open flash region map: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t line_number = 0;
+
+    while (std::getline(map_stream, line)) {
+        line_number++;
+
+        std::istringstream line_stream(line);
+        std::string start, end, label;
+        if (!(line_stream >> start) || start[0] == '#') {
+            continue;
+        }
+
+        line_stream >> end >> std::ws;
+        std::getline(line_stream, label);
+
+        Region region;
+        char *start_end = NULL, *end_end = NULL;
+        region.start = strtoul(start.c_str(), &start_end, 0);
+        region.end = strtoul(end.c_str(), &end_end, 0);
+        region.label = label;
+
+        if (*start_end || end.empty() || *end_end || label.empty() || region.end <= region.start) {
+            std::cerr << "Invalid flash region on line " << line_number << ": " << line << std::endl;
+            return false;
+        }
+
+        regions.push_back(region);
+    }
+
+    std::sort(regions.begin(), regions.end(), [] (const Region &a, const Region &b) {
+        return a.start < b.start;
+    });
+
+    for (size_t i = 1; i < regions.size(); i++) {
+        if (regions[i].start < regions[i - 1].end) {
+            std::cerr << "Flash regions overlap: " << regions[i - 1].label << ", " << regions[i].label << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FlashProfiler::open(const std::string &path) {
+    stream.open(path, std::ios::trunc);
+    if (!stream.good()) {
+        std::cerr << "Failed to open flash profile for writing: " << path << std::endl;
+        return false;
+    }
+
+    frame_start_cycle = sim.cycle_count();
+
+    return true;
+}
+
+void FlashProfiler::transaction_started() {
+    started_cycle = sim.cycle_count();
+}
+
+void FlashProfiler::transaction_ended(const QSPIFlashSim::Transaction &transaction) {
+    uint64_t busy = sim.cycle_count() - started_cycle;
+    uint64_t idle = transaction_seen ? started_cycle - ended_cycle : 0;
+
+    stats_for_transaction(transaction).add(transaction, busy, idle);
+    frame_stats.add(transaction, busy, idle);
+
+    ended_cycle = sim.cycle_count();
+    transaction_seen = true;
+}
+
+FlashProfiler::Stats &FlashProfiler::stats_for_transaction(const QSPIFlashSim::Transaction &transaction) {
+    if (!transaction.address_cycles) {
+        return command_stats;
+    }
+
+    uint32_t address = transaction.address;
+
+    auto region = std::upper_bound(regions.begin(), regions.end(), address, [] (uint32_t address, const Region &region) {
+        return address < region.start;
+    });
+
+    if (region != regions.begin() && address < (region - 1)->end) {
+        return (region - 1)->stats;
+    }
+
+    return unmapped_blocks[address / unmapped_block_size * unmapped_block_size];
+}
+
+bool FlashProfiler::end_frame(uint64_t frame) {
+    uint64_t frame_cycles = sim.cycle_count() - frame_start_cycle;
+
+    stream << "{\"frame\":" << frame << ",\"cycles\":" << frame_cycles << ",";
+    write_stats(stream, frame_stats);
+    stream << "}\n";
+
+    total_stats.add(frame_stats);
+    frame_stats = Stats();
+    frame_count++;
+    frame_start_cycle = sim.cycle_count();
+
+    return stream.good();
+}
+
+bool FlashProfiler::close() {
+    // Transactions since the last completed frame have no per-frame record, since end_frame() is never called for
+    // a frame cut short by the end of the run. They're only included in the totals instead.
+    // The other profilers handle their last partial frame the same way.
+    total_stats.add(frame_stats);
+
+    for (auto &region : regions) {
+        stream << "{\"region\":" << json_string(region.label) << ",\"start\":" << region.start << ",\"end\":" << region.end << ",";
+        write_stats(stream, region.stats);
+        stream << "}\n";
+    }
+
+    for (auto &block : unmapped_blocks) {
+        stream << "{\"region\":null,\"start\":" << block.first << ",\"end\":" << block.first + unmapped_block_size << ",";
+        write_stats(stream, block.second);
+        stream << "}\n";
+    }
+
+    stream << "{\"region\":null,\"start\":null,\"end\":null,";
+    write_stats(stream, command_stats);
+    stream << "}\n";
+
+    stream << "{\"summary\":{\"frames\":" << frame_count << ",";
+    write_stats(stream, total_stats);
+    stream << "}}\n";
+
+    stream.close();
+
+    for (auto &region : regions) {
+        if (region.stats.transactions) {
+            print_stats(region.label, region.stats);
+        }
+    }
+
+    for (auto &block : unmapped_blocks) {
+        std::ostringstream label;
+        label << "0x" << std::hex << std::setfill('0') << std::setw(6) << block.first;
+        print_stats(label.str(), block.second);
+    }
+
+    if (command_stats.transactions) {
+        print_stats("commands", command_stats);
+    }
+
+    print_stats("total", total_stats);
+
+    if (stream.fail()) {
+        std::cerr << "Failed to write flash profile" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void FlashProfiler::Stats::add(const QSPIFlashSim::Transaction &transaction, uint64_t busy, uint64_t idle) {
+    transactions++;
+    bytes += transaction.byte_count;
+    busy_cycles += busy;
+    idle_cycles += idle;
+
+    cmd_cycles += transaction.cmd_cycles;
+    address_cycles += transaction.address_cycles;
+    dummy_cycles += transaction.dummy_cycles;
+    data_cycles += transaction.data_cycles;
+
+    continuous_reads += transaction.continuous_read;
+    qpi_commands += transaction.qpi && !transaction.continuous_read;
+    quad_transactions += (transaction.io_width == 4);
+    dual_transactions += (transaction.io_width == 2);
+}
+
+void FlashProfiler::Stats::add(const Stats &other) {
+    transactions += other.transactions;
+    bytes += other.bytes;
+    busy_cycles += other.busy_cycles;
+    idle_cycles += other.idle_cycles;
+
+    cmd_cycles += other.cmd_cycles;
+    address_cycles += other.address_cycles;
+    dummy_cycles += other.dummy_cycles;
+    data_cycles += other.data_cycles;
+
+    continuous_reads += other.continuous_reads;
+    qpi_commands += other.qpi_commands;
+    quad_transactions += other.quad_transactions;
+    dual_transactions += other.dual_transactions;
+}
+
+void FlashProfiler::write_stats(std::ostream &stream, const Stats &stats) {
+    stream << "\"transactions\":" << stats.transactions
+        << ",\"bytes\":" << stats.bytes
+        << ",\"busy_cycles\":" << stats.busy_cycles
+        << ",\"idle_cycles\":" << stats.idle_cycles
+        << ",\"cmd_cycles\":" << stats.cmd_cycles
+        << ",\"address_cycles\":" << stats.address_cycles
+        << ",\"dummy_cycles\":" << stats.dummy_cycles
+        << ",\"data_cycles\":" << stats.data_cycles
+        << ",\"continuous_reads\":" << stats.continuous_reads
+        << ",\"qpi_commands\":" << stats.qpi_commands
+        << ",\"quad_transactions\":" << stats.quad_transactions
+        << ",\"dual_transactions\":" << stats.dual_transactions;
+}
+
+void FlashProfiler::print_stats(const std::string &label, const Stats &stats) {
+    uint64_t flash_cycles = stats.cmd_cycles + stats.address_cycles + stats.dummy_cycles + stats.data_cycles;
+    double data_percent = flash_cycles ? stats.data_cycles * 100.0 / flash_cycles : 0;
+    double crm_percent = stats.transactions ? stats.continuous_reads * 100.0 / stats.transactions : 0;
+
+    std::cout << "Flash profile: " << label << ": "
+        << stats.transactions << " transactions, " << stats.bytes << " bytes, "
+        << std::fixed << std::setprecision(1)
+        << data_percent << "% of flash cycles in data phase, "
+        << crm_percent << "% continuous reads" << std::defaultfloat << std::endl;
+}
@@ -0,0 +1,102 @@
+// FlashProfiler.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Flash bus traffic report built from the transactions seen by QSPIFlashSim
+// Transactions are summarized per frame and per address region, written as JSON lines
+
+// Regions are labelled with an optional map file, one region per line: <start> <end> <label>
+// Addresses are physical flash addresses (the user program starts at 0x200000) and end is exclusive
+// Addresses outside of any labelled region are grouped into 64KB blocks
+
+#ifndef FlashProfiler_hpp
+#define FlashProfiler_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+#include "Simulation.hpp"
+
+class FlashProfiler : public QSPIFlashSim::TransactionSink {
+
+public:
+    /// Busy and idle times are measured in (clk_2x) cycles of sim.
+    FlashProfiler(const Simulation &sim) : sim(sim) {}
+
+    /// Loads region labels from a map file, with lines starting with # ignored.
+    bool load_regions(const std::string &path);
+
+    bool open(const std::string &path);
+
+    void transaction_started() override;
+    void transaction_ended(const QSPIFlashSim::Transaction &transaction) override;
+
+    /// Writes a record of the transactions made since the previous frame.
+    /// Returns false if it couldn't be written.
+    bool end_frame(uint64_t frame);
+
+    /// Writes the per-region and overall totals and prints a summary.
+    bool close();
+
+private:
+    struct Stats {
+        uint64_t transactions = 0;
+        uint64_t bytes = 0;
+
+        // Sim cycles with /CS asserted and sim cycles since the previous transaction ended
+        uint64_t busy_cycles = 0;
+        uint64_t idle_cycles = 0;
+
+        // Flash clock cycles spent in each phase
+        uint64_t cmd_cycles = 0;
+        uint64_t address_cycles = 0;
+        uint64_t dummy_cycles = 0;
+        uint64_t data_cycles = 0;
+
+        uint64_t continuous_reads = 0;
+        uint64_t qpi_commands = 0;
+        uint64_t quad_transactions = 0;
+        uint64_t dual_transactions = 0;
+
+        void add(const QSPIFlashSim::Transaction &transaction, uint64_t busy, uint64_t idle);
+        void add(const Stats &other);
+    };
+
+    struct Region {
+        uint32_t start;
+        uint32_t end;
+        std::string label;
+        Stats stats;
+    };
+
+    const Simulation &sim;
+    std::ofstream stream;
+
+    std::vector<Region> regions;
+    std::map<uint32_t, Stats> unmapped_blocks;
+    // Transactions without an address, such as status register and power commands
+    Stats command_stats;
+
+    Stats frame_stats;
+    Stats total_stats;
+    uint64_t frame_count = 0;
+    uint64_t frame_start_cycle = 0;
+
+    uint64_t started_cycle = 0;
+    uint64_t ended_cycle = 0;
+    bool transaction_seen = false;
+
+    static const uint32_t unmapped_block_size = 0x10000;
+
+    Stats &stats_for_transaction(const QSPIFlashSim::Transaction &transaction);
+
+    static void write_stats(std::ostream &stream, const Stats &stats);
+    static void print_stats(const std::string &label, const Stats &stats);
+};
+
+#endif /* FlashProfiler_hpp */
@@ -0,0 +1,150 @@
+// FrameDumper.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "FrameDumper.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <iomanip>
+
+#include "lodepng.h"
+
+FrameDumper::FrameDumper(const std::string &path) {
+    size_t extension_index = path.find_last_of('.');
+    size_t separator_index = path.find_last_of('/');
+    bool has_extension = extension_index != std::string::npos &&
+        (separator_index == std::string::npos || extension_index > separator_index);
+
+    path_prefix = has_extension ? path.substr(0, extension_index) : path;
+    path_extension = has_extension ? path.substr(extension_index) : ".ppm";
+
+    output_format = (path_extension == ".png" ? Format::PNG : Format::PPM);
+}
+
+bool FrameDumper::select_frames(const std::string &selection) {
+    std::vector<Range> ranges;
+
+    std::stringstream stream(selection);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) {
+            return false;
+        }
+
+        Range range;
+        char *end = NULL;
+
+        range.first = strtoull(item.c_str(), &end, 10);
+        if (end == item.c_str()) {
+            return false;
+        }
+
+        if (*end == '\0') {
+            range.last = range.first;
+        } else if (*end == '-') {
+            const char *last_start = end + 1;
+            if (*last_start == '\0') {
+                range.last = std::numeric_limits<uint64_t>::max();
+            } else {
+                range.last = strtoull(last_start, &end, 10);
+                if (*end != '\0' || range.last < range.first) {
+                    return false;
+                }
+            }
+        } else {
+            return false;
+        }
+
+        ranges.push_back(range);
+    }
+
+    if (ranges.empty()) {
+        return false;
+    }
+
+    selected_ranges = ranges;
+    return true;
+}
+
+bool FrameDumper::frame_selected(uint64_t frame) const {
+    if (selected_ranges.empty()) {
+        return true;
+    }
+
+    for (auto &range : selected_ranges) {
+        if (frame >= range.first && frame <= range.last) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FrameDumper::dump(uint64_t frame, const FrameSink &frame_sink) {
+    if (!frame_selected(frame)) {
+        return true;
+    }
+
+    auto path = path_for_frame(frame);
+
+    // Frames identical to the previously dumped one are written without being converted or encoded again
+    uint64_t frame_hash = frame_sink.frame_hash();
+    if (encoded_frame.empty() || frame_hash != encoded_frame_hash) {
+        encoded_frame.clear();
+
+        if (!encode(frame_sink)) {
+            std::cerr << "Failed to encode frame: " << path << std::endl;
+            return false;
+        }
+
+        encoded_frame_hash = frame_hash;
+    }
+
+    bool written = write_file(path, encoded_frame);
+    if (!written) {
+        std::cerr << "Failed to write frame: " << path << std::endl;
+    }
+
+    return written;
+}
+
+std::string FrameDumper::path_for_frame(uint64_t frame) const {
+    std::stringstream stream;
+    stream << path_prefix << "_" << std::setfill('0') << std::setw(6) << frame << path_extension;
+    return stream.str();
+}
+
+bool FrameDumper::encode(const FrameSink &frame_sink) {
+    size_t width = frame_sink.frame_width();
+    size_t height = frame_sink.frame_height();
+
+    rgb24_buffer.resize(width * height * 3);
+    FrameSink::rgb24_from_argb32(frame_sink.pixels(), width * height, rgb24_buffer.data());
+
+    if (output_format == Format::PNG) {
+        return lodepng::encode(encoded_frame, rgb24_buffer, (unsigned)width, (unsigned)height, LCT_RGB) == 0;
+    }
+
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    encoded_frame.assign(header.begin(), header.end());
+    encoded_frame.insert(encoded_frame.end(), rgb24_buffer.begin(), rgb24_buffer.end());
+
+    return true;
+}
+
+bool FrameDumper::write_file(const std::string &path, const std::vector<uint8_t> &bytes) const {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+
+    return (fclose(file) == 0) && written;
+}
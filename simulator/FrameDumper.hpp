@@ -0,0 +1,68 @@
+// FrameDumper.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Writes completed video frames to image files (PPM or PNG)
+// This lets the sim run without a display and still produce inspectable output
+
+#ifndef FrameDumper_hpp
+#define FrameDumper_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "FrameSink.hpp"
+
+class FrameDumper {
+
+public:
+    enum class Format {
+        PPM, PNG
+    };
+
+    /// The format is derived from the extension of path ("frame.png" or "frame.ppm").
+    /// Frames are written to the same path with the frame number appended (i.e. "frame_000042.png").
+    FrameDumper(const std::string &path);
+
+    /// Restricts dumping to the given frames, formatted as a comma separated list of frames and ranges.
+    /// Ranges can be open ended. Example: "0,10-20,100-".
+    /// Returns false if the selection couldn't be parsed.
+    bool select_frames(const std::string &selection);
+
+    bool frame_selected(uint64_t frame) const;
+
+    /// Writes the frame in frame_sink if it was selected.
+    /// Returns false if the frame was selected but couldn't be written.
+    bool dump(uint64_t frame, const FrameSink &frame_sink);
+
+    Format format() const { return output_format; }
+
+private:
+    struct Range {
+        uint64_t first, last;
+    };
+
+    std::string path_prefix;
+    std::string path_extension;
+    Format output_format = Format::PPM;
+
+    // All frames are selected if this is empty
+    std::vector<Range> selected_ranges;
+
+    // Frames are converted to RGB24 before encoding, reusing this buffer
+    std::vector<uint8_t> rgb24_buffer;
+
+    // File contents of the last encoded frame, reused as long as the frame hash doesn't change
+    std::vector<uint8_t> encoded_frame;
+    uint64_t encoded_frame_hash = 0;
+
+    std::string path_for_frame(uint64_t frame) const;
+
+    bool encode(const FrameSink &frame_sink);
+    bool write_file(const std::string &path, const std::vector<uint8_t> &bytes) const;
+};
+
+#endif /* FrameDumper_hpp */
@@ -0,0 +1,266 @@
+// FrameSink.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Caller-provided frame buffer that Simulation::run_cycles() plots pixels into
+// Pixels are either placed using vga_de, covering only the active display, or by counting hsync / vsync edges,
+// which also covers the blanking area around it
+
+// The size of the active display is measured from vga_de on every frame so the caller can detect the video mode
+// and resize the frame to match
+// This is deliberately non-virtual and header-only so it inlines into the per-cycle loop
+
+// Pixels are stored as 32-bit ARGB8888 which SDL can upload to a streaming texture as-is
+// Each pixel is a single store, with the 4-bit components widened to 8-bit all at once
+
+// Each row of the buffer is hashed as it's drawn so that consumers can tell which rows changed since an earlier frame
+// without comparing or rehashing the pixels themselves
+
+#ifndef FrameSink_hpp
+#define FrameSink_hpp
+
+#include <stdint.h>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "StateSerializer.hpp"
+
+class FrameSink {
+
+public:
+    static const size_t argb32_size = 4;
+
+    enum class Layout: uint8_t {
+        // Only pixels with vga_de set, with each run of them starting a new row
+        ACTIVE,
+        // Every pixel outside of the sync pulses, with rows and frames started by hsync / vsync
+        RASTER
+    };
+
+    FrameSink(size_t width, size_t height, Layout layout = Layout::RASTER) :
+        layout(layout),
+        width(width),
+        height(height),
+        pixel_buffer(width * height, 0xff000000),
+        row_hashes(height, 0) {}
+
+    /// Plots the current output pixel and updates the raster position.
+    /// Returns true if this pixel completed a frame (vsync rising edge).
+    bool push(uint8_t r, uint8_t g, uint8_t b, bool hsync, bool vsync, bool de) {
+        bool draw = (layout == Layout::ACTIVE ? de : vsync && hsync);
+        bool in_bounds = current_x < width && current_y < height;
+        if (draw && in_bounds) {
+            uint32_t pixel = argb32(r, g, b);
+            pixel_buffer[pixel_index++] = pixel;
+            row_hash = (row_hash ^ pixel) * hash_prime;
+        } else if (draw) {
+            std::cout << "Attempted to draw out of bounds pixel: (" << current_x << ", " << current_y << ")" << std::endl;
+        }
+
+        current_x++;
+
+        de_run_length += de;
+
+        bool de_ended = !de && de_previous;
+        if (de_ended) {
+            measured_width = std::max(measured_width, de_run_length);
+            measured_height++;
+            de_run_length = 0;
+        }
+
+        if (layout == Layout::ACTIVE) {
+            if (de_ended) {
+                end_row();
+                current_y++;
+            }
+
+            if (!de) {
+                current_x = 0;
+                update_pixel_index();
+            }
+        } else {
+            if (!hsync) {
+                current_x = 0;
+                update_pixel_index();
+            }
+
+            if (hsync && !hsync_previous) {
+                // Rows are only drawn while vsync is inactive
+                if (vsync) {
+                    end_row();
+                }
+
+                current_y++;
+                update_pixel_index();
+            }
+        }
+
+        hsync_previous = hsync;
+        de_previous = de;
+
+        if (!vsync) {
+            if (vsync_previous && layout == Layout::RASTER) {
+                end_row();
+            }
+
+            current_y = 0;
+            update_pixel_index();
+        }
+
+        bool frame_completed = vsync && !vsync_previous;
+        vsync_previous = vsync;
+
+        if (frame_completed) {
+            active_width = measured_width;
+            active_height = measured_height;
+            measured_width = 0;
+            measured_height = 0;
+        }
+
+        return frame_completed;
+    }
+
+    Layout frame_layout() const { return layout; }
+
+    /// Size of the active display in the most recently completed frame, as measured from vga_de.
+    /// Returns false if no active pixels were output in that frame.
+    bool active_size(size_t *width, size_t *height) const {
+        *width = active_width;
+        *height = active_height;
+        return active_width > 0 && active_height > 0;
+    }
+
+    /// Reallocates the frame for a new size, such as once the video mode has been detected.
+    /// Pixels drawn so far are discarded but the raster position is kept.
+    void resize(size_t width, size_t height) {
+        this->width = width;
+        this->height = height;
+
+        pixel_buffer.assign(width * height, 0xff000000);
+        row_hashes.assign(height, 0);
+        row_hash = hash_seed;
+
+        update_pixel_index();
+    }
+
+    /// ARGB8888 pixels in host byte order, as in SDL_PIXELFORMAT_ARGB8888.
+    const uint32_t *pixels() const { return pixel_buffer.data(); }
+
+    size_t frame_width() const { return width; }
+    size_t frame_height() const { return height; }
+    /// Row length in bytes.
+    size_t stride() const { return width * argb32_size; }
+
+    /// Hash of each row of pixels() as of its last completed draw, which is every row once a frame is complete.
+    /// Rows with equal hashes can be assumed to have equal pixels.
+    const uint64_t *line_hashes() const { return row_hashes.data(); }
+
+    /// Hash of the whole frame, derived from line_hashes().
+    uint64_t frame_hash() const {
+        uint64_t hash = hash_seed;
+        for (auto row : row_hashes) {
+            hash = (hash ^ row) * hash_prime;
+        }
+
+        return hash;
+    }
+
+    /// Converts ARGB8888 pixels to tightly packed RGB24, for image output and frame hashing.
+    static void rgb24_from_argb32(const uint32_t *argb32, size_t count, uint8_t *rgb24) {
+        for (size_t i = 0; i < count; i++) {
+            uint32_t pixel = argb32[i];
+            *rgb24++ = pixel >> 16;
+            *rgb24++ = pixel >> 8;
+            *rgb24++ = pixel;
+        }
+    }
+
+    /// Raster position only, the pixels themselves are redrawn on the next frame.
+    void save_state(StateWriter &writer) const {
+        writer.write_value(layout);
+        writer.write_value<uint64_t>(current_x);
+        writer.write_value<uint64_t>(current_y);
+        writer.write_value<uint64_t>(pixel_index);
+        writer.write_value(hsync_previous);
+        writer.write_value(vsync_previous);
+        writer.write_value(de_previous);
+    }
+
+    bool load_state(StateReader &reader) {
+        Layout saved_layout;
+        if (!reader.read_value(saved_layout)) {
+            return false;
+        }
+
+        if (saved_layout != layout) {
+            std::cerr << "Saved state was made with a different frame layout" << std::endl;
+            return false;
+        }
+
+        uint64_t x, y, index;
+        bool loaded = reader.read_value(x) && reader.read_value(y) && reader.read_value(index) &&
+            reader.read_value(hsync_previous) && reader.read_value(vsync_previous) && reader.read_value(de_previous);
+
+        if (!loaded || index > pixel_buffer.size()) {
+            return false;
+        }
+
+        current_x = x;
+        current_y = y;
+        pixel_index = index;
+        row_hash = hash_seed;
+
+        return true;
+    }
+
+private:
+    Layout layout;
+    size_t width, height;
+    std::vector<uint32_t> pixel_buffer;
+
+    // FNV-1a, applied to whole pixels rather than bytes
+    static const uint64_t hash_seed = 0xcbf29ce484222325;
+    static const uint64_t hash_prime = 0x100000001b3;
+
+    std::vector<uint64_t> row_hashes;
+    // Hash of the pixels drawn so far in the current row
+    uint64_t row_hash = hash_seed;
+
+    size_t current_x = 0;
+    size_t current_y = 0;
+    size_t pixel_index = 0;
+
+    bool hsync_previous = true;
+    bool vsync_previous = true;
+    bool de_previous = false;
+
+    // Active display size of the frame being drawn and of the last completed frame
+    size_t de_run_length = 0;
+    size_t measured_width = 0;
+    size_t measured_height = 0;
+    size_t active_width = 0;
+    size_t active_height = 0;
+
+    static uint32_t argb32(uint8_t r, uint8_t g, uint8_t b) {
+        // Multiplying by 0x11 repeats each 4-bit component into both nybbles of its byte
+        uint32_t rgb444 = (uint32_t)r << 16 | g << 8 | b;
+        return 0xff000000 | rgb444 * 0x11;
+    }
+
+    void end_row() {
+        if (current_y < height) {
+            row_hashes[current_y] = row_hash;
+        }
+
+        row_hash = hash_seed;
+    }
+
+    void update_pixel_index() {
+        pixel_index = current_y * width;
+    }
+};
+
+#endif /* FrameSink_hpp */
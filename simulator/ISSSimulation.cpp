@@ -0,0 +1,294 @@
+// ISSSimulation.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "ISSSimulation.hpp"
+#include "StopConditions.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+void ISSSimulation::preload_cpu_program(const std::vector<uint8_t> &program) {
+    size_t ipl_load_length = std::min(cpu_ram_size, program.size());
+    std::copy(program.begin(), program.begin() + ipl_load_length, cpu_ram);
+
+    // The bootloader isn't run so the CPU starts with the state it would've left behind
+    cpu.reset(0, cpu_reset_sp);
+}
+
+Simulation::RunResult ISSSimulation::run_cycles(uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) {
+    return run_cycles_loop(*this, cycles, frame_sink, audio_sink);
+}
+
+void ISSSimulation::step(uint64_t time) {
+    // All models are clocked by clk_2x
+    if (clk_2x) {
+        tick();
+    }
+}
+
+void ISSSimulation::tick() {
+    vdp_write_valid = false;
+    cpu_write_valid = false;
+
+    if (cpu_wait_cycles > 0) {
+        cpu_wait_cycles--;
+    } else if (!cpu.is_halted()) {
+        access_cycles = 0;
+
+        if (cpu.step()) {
+            cpu_wait_cycles = instruction_cycles + access_cycles - 1;
+        } else {
+            report_halt();
+        }
+    }
+
+    // Syncs are registered once after the raster and colors are registered once more
+
+    const VDPTiming &timing = vdp.video_timing();
+
+    output_hsync = !timing.hsync_active(delayed_raster[0].x);
+    output_vsync = !timing.vsync_active(delayed_raster[0].y);
+
+    RasterPosition color_raster = delayed_raster[1];
+    output_de = timing.active_display(color_raster.x, color_raster.y);
+
+    if (output_de) {
+        vdp.render_pending();
+        output_color = vdp.pixel(color_raster.x - timing.h_offscreen(), color_raster.y);
+    } else {
+        output_color = 0;
+    }
+
+    delayed_raster[1] = delayed_raster[0];
+    delayed_raster[0] = {vdp.raster_x(), vdp.raster_y()};
+
+    vdp.run(1);
+}
+
+void ISSSimulation::report_halt() const {
+    std::cerr << "CPU halted on unsupported instruction at: 0x" << std::hex << std::setfill('0')
+        << std::setw(8) << cpu.pc << std::dec << std::endl;
+}
+
+// Bus:
+
+uint32_t ISSSimulation::fetch(uint32_t address) {
+    if (address < cpu_ram_size) {
+        address &= ~3;
+        return cpu_ram[address] | cpu_ram[address + 1] << 8 | cpu_ram[address + 2] << 16 | cpu_ram[address + 3] << 24;
+    }
+
+    return load(address, 4);
+}
+
+uint32_t ISSSimulation::load(uint32_t address, uint8_t size) {
+    const uint32_t size_mask = (size == 4 ? 0xffffffff : (1 << (size * 8)) - 1);
+
+    // Only the low 25 bits are decoded, as in address_decoder.v
+    address &= 0x1ffffff;
+
+    if (address < cpu_ram_size) {
+        address &= ~(size - 1);
+
+        uint32_t data = 0;
+        for (uint8_t i = 0; i < size; i++) {
+            data |= cpu_ram[address + i] << (i * 8);
+        }
+
+        return data;
+    }
+
+    access_cycles += bus_access_cycles;
+
+    uint32_t word = read_peripheral(address & ~3);
+    return (word >> ((address & 3) * 8)) & size_mask;
+}
+
+void ISSSimulation::store(uint32_t address, uint32_t data, uint8_t size) {
+    address &= 0x1ffffff;
+
+    // The CPU replicates smaller writes across all byte lanes and selects them with wstrb
+    uint32_t write_data;
+    uint8_t wstrb;
+
+    switch (size) {
+        case 1:
+            write_data = (data & 0xff) * 0x01010101;
+            wstrb = 1 << (address & 3);
+            break;
+        case 2:
+            write_data = (data & 0xffff) * 0x00010001;
+            wstrb = 3 << (address & 2);
+            break;
+        default:
+            write_data = data;
+            wstrb = 0xf;
+            break;
+    }
+
+    cpu_write_valid = true;
+    last_cpu_write = {address & ~3, write_data, wstrb};
+
+    if (address < cpu_ram_size) {
+        address &= ~(size - 1);
+
+        for (uint8_t i = 0; i < size; i++) {
+            cpu_ram[address + i] = data >> (i * 8);
+        }
+
+        return;
+    }
+
+    access_cycles += bus_access_cycles;
+
+    write_peripheral(address & ~3, write_data, wstrb);
+}
+
+// Peripherals:
+
+uint32_t ISSSimulation::read_peripheral(uint32_t address) {
+    if (address & 0x1000000) {
+        // Flash reads are relative to the user program in flash
+        size_t index = flash_user_base + (address & 0xfffffc);
+        return flash.read_direct(index) | flash.read_direct(index + 1) << 8 |
+            flash.read_direct(index + 2) << 16 | flash.read_direct(index + 3) << 24;
+    }
+
+    switch ((address >> 16) & 0x0f) {
+        case 1:
+            // VDP reads never set wstrb[2] so only even registers are addressable
+            return vdp.read((address >> 1) & 0x1e);
+        case 3:
+            return (int32_t)dsp_mult_a * dsp_mult_b;
+        case 4:
+            return button_user << 2 | (pad_shift & 0x01);
+        default:
+            // Status, bootloader, flash control and audio all read as 0
+            return 0;
+    }
+}
+
+void ISSSimulation::write_peripheral(uint32_t address, uint32_t data, uint8_t wstrb) {
+    switch ((address >> 16) & 0x0f) {
+        case 1:
+            write_vdp(false, (address >> 1 | ((wstrb >> 2) & 1)) & 0x1f, data);
+            break;
+        case 2:
+            status_led = data;
+            break;
+        case 3:
+            if (address & 0x04) {
+                dsp_mult_b = data;
+            } else {
+                dsp_mult_a = data;
+            }
+            break;
+        case 4:
+            write_pad(data & 0x03);
+            break;
+        case 5:
+            write_vdp(true, ((address >> 1) | ((wstrb >> 2) & 1)) & 0x7ff, data);
+            break;
+        default:
+            // Bootloader, flash control and audio writes are ignored
+            break;
+    }
+}
+
+void ISSSimulation::write_vdp(bool copper_ram, uint16_t address, uint16_t data) {
+    if (copper_ram) {
+        vdp.write_copper_ram(address, data);
+    } else {
+        vdp.write(address, data);
+    }
+
+    vdp_write_valid = true;
+    last_vdp_write = {copper_ram, address, data};
+}
+
+bool ISSSimulation::vdp_write(VDPWrite *write) const {
+    if (vdp_write_valid) {
+        *write = last_vdp_write;
+    }
+
+    return vdp_write_valid;
+}
+
+bool ISSSimulation::cpu_write(CPUWrite *write) const {
+    if (cpu_write_valid) {
+        *write = last_cpu_write;
+    }
+
+    return cpu_write_valid;
+}
+
+bool ISSSimulation::copper_step(CopperStep *step) const {
+    VDPCopper::Execution execution;
+    if (!vdp.copper_execution(&execution)) {
+        return false;
+    }
+
+    step->raster_x = execution.raster_x;
+    step->raster_y = execution.raster_y;
+    step->pc = execution.pc;
+    step->word = execution.word;
+    step->data = execution.data;
+
+    return true;
+}
+
+bool ISSSimulation::vdp_line_usage(VDPLineUsage *usage) const {
+    VDPModel::LineUsage line_usage;
+    if (!vdp.line_usage(&line_usage)) {
+        return false;
+    }
+
+    usage->raster_y = line_usage.raster_y;
+    usage->sprites_hit = line_usage.sprites_hit;
+    usage->sprite_pixels_hit = line_usage.sprite_pixels_hit;
+    usage->sprite_pixels_rendered = line_usage.sprite_pixels_rendered;
+    usage->layer_slots = line_usage.layer_slots;
+    usage->sprite_slots = line_usage.sprite_slots;
+    usage->host_slots = line_usage.host_slots;
+    usage->affine_slots = line_usage.affine_slots;
+    usage->host_writes = line_usage.host_writes;
+    usage->host_writes_dropped = line_usage.host_writes_dropped;
+
+    return true;
+}
+
+uint16_t ISSSimulation::pad_buttons() const {
+    // Same mapping as ics32_tb.v
+    return button_r << 11 | button_l << 10 | button_x << 9 | button_a << 8 |
+        button_1 << 7 | button_3 << 6 | button_down << 5 | button_up << 4 |
+        button_start << 3 | button_select << 2 | button_y << 1 | button_2;
+}
+
+void ISSSimulation::write_pad(uint8_t ctrl) {
+    bool latch = ctrl & 0x01;
+    bool clk_rising = (ctrl & 0x02) && !(pad_ctrl & 0x02);
+
+    if (latch) {
+        pad_shift = pad_buttons();
+    } else if (clk_rising) {
+        pad_shift >>= 1;
+    }
+
+    pad_ctrl = ctrl;
+}
+
+// Save states:
+
+bool ISSSimulation::save_state(const std::string &path, const FrameSink &frame_sink) {
+    std::cerr << "Save states aren't supported by the ISS sim" << std::endl;
+    return false;
+}
+
+bool ISSSimulation::load_state(const std::string &path, FrameSink &frame_sink) {
+    std::cerr << "Save states aren't supported by the ISS sim" << std::endl;
+    return false;
+}
@@ -0,0 +1,127 @@
+// ISSSimulation.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Sim implementation that doesn't evaluate any HDL
+// The CPU is an RV32I instruction set simulator and peripherals are behavioral models:
+// the VDP (including copper), DSP multiplier, gamepad, status LEDs and direct flash reads.
+
+// Differences from the RTL sims:
+// - Execution starts at the preloaded program, skipping the bootloader
+// - Instruction timing is approximated with a fixed cost per instruction and per bus access
+// - Audio registers are accepted but no samples are produced
+// - Save states and waveform tracing aren't supported
+
+#ifndef ISSSimulation_hpp
+#define ISSSimulation_hpp
+
+#include <stdint.h>
+#include <vector>
+
+#include "Simulation.hpp"
+#include "RV32ICore.hpp"
+#include "VDPModel.hpp"
+
+class ISSSimulation final: public Simulation {
+
+public:
+    /// The flash model is copied, which shares its contents with flash rather than copying them.
+    ISSSimulation(const QSPIFlashSim &flash) : flash(flash), cpu(*this) {}
+
+    void forward_cmd_args(int argc, const char * argv[]) override {}
+
+    void preload_cpu_program(const std::vector<uint8_t> &program) override;
+    void step(uint64_t time) override;
+    RunResult run_cycles(uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) override;
+
+    bool save_state(const std::string &path, const FrameSink &frame_sink) override;
+    bool load_state(const std::string &path, FrameSink &frame_sink) override;
+
+    uint8_t r() const override { return output_color >> 8 & 0xf; }
+    uint8_t g() const override { return output_color >> 4 & 0xf; }
+    uint8_t b() const override { return output_color & 0xf; }
+
+    bool hsync() const override { return output_hsync; }
+    bool vsync() const override { return output_vsync; }
+    bool de() const override { return output_de; }
+
+    bool vdp_write(VDPWrite *write) const override;
+    bool copper_step(CopperStep *step) const override;
+    bool vdp_line_usage(VDPLineUsage *usage) const override;
+
+    uint32_t cpu_pc() const override { return cpu.pc; }
+    bool cpu_write(CPUWrite *write) const override;
+
+    bool get_samples(int16_t *left, int16_t *right) override { return false; }
+
+    // Flash is only read directly so there are no update() calls to time
+    QSPIFlashSim &flash_model() override { return flash; }
+
+    void final() override {}
+
+    bool finished() const override { return cpu.is_halted(); }
+
+    // Bus interface used by RV32ICore
+
+    uint32_t fetch(uint32_t address);
+    uint32_t load(uint32_t address, uint8_t size);
+    void store(uint32_t address, uint32_t data, uint8_t size);
+
+private:
+    static const size_t cpu_ram_size = 0x10000;
+    static const uint32_t cpu_reset_sp = 0x10000;
+    static const uint32_t flash_user_base = 0x200000;
+
+    // Approximate cost in (clk_2x) cycles of the VexRiscv on the shared bus at clk_1x
+    static const uint32_t instruction_cycles = 6;
+    static const uint32_t bus_access_cycles = 4;
+
+    QSPIFlashSim flash;
+    RV32ICore<ISSSimulation> cpu;
+    VDPModel vdp;
+
+    uint8_t cpu_ram[cpu_ram_size] = {0};
+
+    uint32_t cpu_wait_cycles = 0;
+    uint32_t access_cycles = 0;
+
+    int16_t dsp_mult_a = 0, dsp_mult_b = 0;
+
+    uint8_t status_led = 0;
+
+    uint8_t pad_ctrl = 0;
+    uint16_t pad_shift = 0;
+    uint16_t pad_buttons() const;
+    void write_pad(uint8_t ctrl);
+
+    void tick();
+    void report_halt() const;
+
+    uint32_t read_peripheral(uint32_t address);
+    void write_peripheral(uint32_t address, uint32_t data, uint8_t wstrb);
+
+    // Output registers, delayed relative to the raster as they are in the RTL
+    struct RasterPosition {
+        uint16_t x, y;
+    };
+
+    RasterPosition delayed_raster[2] = {{0, 0}, {0, 0}};
+
+    uint16_t output_color = 0;
+    bool output_hsync = true;
+    bool output_vsync = true;
+    bool output_de = false;
+
+    // Last writes made by the CPU during the current cycle
+    bool vdp_write_valid = false;
+    VDPWrite last_vdp_write = {false, 0, 0};
+
+    bool cpu_write_valid = false;
+    CPUWrite last_cpu_write = {0, 0, 0};
+
+    void write_vdp(bool copper_ram, uint16_t address, uint16_t data);
+};
+
+#endif /* ISSSimulation_hpp */
@@ -0,0 +1,114 @@
+// InputMovie.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "InputMovie.hpp"
+
+#include <iostream>
+#include <iterator>
+#include <cstring>
+
+const char InputMovie::magic[8] = {'i', 'c', 's', '3', '2', 'i', 'n', 'p'};
+
+bool InputMovie::load(const std::string &path) {
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.good()) {
+        std::cerr << "Failed to open input movie: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    const size_t header_length = sizeof(magic) + 4;
+    if (contents.size() < header_length || memcmp(contents.data(), magic, sizeof(magic)) != 0) {
+        std::cerr << "Not an input movie: " << path << std::endl;
+        return false;
+    }
+
+    const uint8_t *version_bytes = &contents[sizeof(magic)];
+    uint32_t file_version = version_bytes[0] | version_bytes[1] << 8 | version_bytes[2] << 16 | version_bytes[3] << 24;
+    if (file_version != version) {
+        std::cerr << "Unsupported input movie version: " << file_version << std::endl;
+        return false;
+    }
+
+    frames.clear();
+    for (size_t i = header_length; i + 1 < contents.size(); i += 2) {
+        frames.push_back(contents[i] | contents[i + 1] << 8);
+    }
+
+    return true;
+}
+
+bool InputMovie::create(const std::string &path) {
+    output.open(path, std::ios::binary | std::ios::trunc);
+    if (!output.good()) {
+        std::cerr << "Failed to open input movie for writing: " << path << std::endl;
+        return false;
+    }
+
+    const uint8_t version_bytes[] = {
+        version & 0xff, version >> 8 & 0xff, version >> 16 & 0xff, version >> 24
+    };
+
+    output.write(magic, sizeof(magic));
+    output.write((const char *)version_bytes, sizeof(version_bytes));
+
+    return output.good();
+}
+
+bool InputMovie::record(uint16_t buttons) {
+    const char bytes[] = {(char)(buttons & 0xff), (char)(buttons >> 8)};
+    output.write(bytes, sizeof(bytes));
+
+    return output.good();
+}
+
+bool InputMovie::close() {
+    if (!output.is_open()) {
+        return true;
+    }
+
+    output.close();
+    if (output.fail()) {
+        std::cerr << "Failed to write input movie" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+uint16_t InputMovie::frame_buttons(uint64_t frame) const {
+    return frame < frames.size() ? frames[frame] : 0;
+}
+
+uint16_t InputMovie::buttons(const Simulation &sim) {
+    return (sim.button_user ? USER : 0) |
+        (sim.button_1 ? B1 : 0) | (sim.button_2 ? B2 : 0) | (sim.button_3 ? B3 : 0) |
+        (sim.button_up ? UP : 0) | (sim.button_down ? DOWN : 0) |
+        (sim.button_l ? L : 0) | (sim.button_r ? R : 0) |
+        (sim.button_x ? X : 0) | (sim.button_a ? A : 0) | (sim.button_y ? Y : 0) |
+        (sim.button_start ? START : 0) | (sim.button_select ? SELECT : 0);
+}
+
+void InputMovie::apply(Simulation &sim, uint16_t buttons) {
+    sim.button_user = buttons & USER;
+    sim.button_1 = buttons & B1;
+    sim.button_2 = buttons & B2;
+    sim.button_3 = buttons & B3;
+
+    sim.button_up = buttons & UP;
+    sim.button_down = buttons & DOWN;
+
+    sim.button_l = buttons & L;
+    sim.button_r = buttons & R;
+
+    sim.button_x = buttons & X;
+    sim.button_a = buttons & A;
+    sim.button_y = buttons & Y;
+
+    sim.button_start = buttons & START;
+    sim.button_select = buttons & SELECT;
+}
@@ -0,0 +1,76 @@
+// InputMovie.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Per-frame gamepad input, recorded from a sim session and replayed to make later sessions deterministic
+
+// File format (little endian):
+// - 8 byte magic "ics32inp"
+// - uint32_t format version
+// - uint16_t button bitmask for each frame, as returned by InputMovie::buttons()
+
+// The entry for frame N holds the buttons applied once frame N has completed, which the CPU then sees in frame N + 1
+
+#ifndef InputMovie_hpp
+#define InputMovie_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "Simulation.hpp"
+
+class InputMovie {
+
+public:
+    enum Button: uint16_t {
+        USER = 1 << 0,
+        B1 = 1 << 1,
+        B2 = 1 << 2,
+        B3 = 1 << 3,
+        UP = 1 << 4,
+        DOWN = 1 << 5,
+        L = 1 << 6,
+        R = 1 << 7,
+        X = 1 << 8,
+        A = 1 << 9,
+        Y = 1 << 10,
+        START = 1 << 11,
+        SELECT = 1 << 12
+    };
+
+    /// Reads a previously recorded movie for replay.
+    bool load(const std::string &path);
+
+    /// Creates a new movie at path to append frames to with record().
+    bool create(const std::string &path);
+
+    /// Appends the buttons for the next frame. Returns false if they couldn't be written.
+    /// Recorded frames are only streamed to the file and aren't kept in memory.
+    bool record(uint16_t buttons);
+
+    /// Finishes writing a movie opened with create().
+    bool close();
+
+    /// Buttons of a loaded movie, with all buttons released past the end.
+    uint16_t frame_buttons(uint64_t frame) const;
+
+    /// Frames in a loaded movie.
+    uint64_t frame_count() const { return frames.size(); }
+
+    static uint16_t buttons(const Simulation &sim);
+    static void apply(Simulation &sim, uint16_t buttons);
+
+private:
+    static const char magic[8];
+    static const uint32_t version = 1;
+
+    // Only filled by load()
+    std::vector<uint16_t> frames;
+    std::ofstream output;
+};
+
+#endif /* InputMovie_hpp */
@@ -0,0 +1,28 @@
+// JSONFormat.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Formatting shared by the JSON lines writers
+
+#ifndef JSONFormat_hpp
+#define JSONFormat_hpp
+
+#include <string>
+
+/// Quotes string for use as a JSON string value or key, escaping quotes and backslashes.
+inline std::string json_string(const std::string &string) {
+    std::string escaped = "\"";
+    for (char c : string) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+
+        escaped += c;
+    }
+
+    return escaped + "\"";
+}
+
+#endif /* JSONFormat_hpp */
@@ -0,0 +1,138 @@
+// LockstepChecker.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "LockstepChecker.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+LockstepChecker::LockstepChecker(const VDPTiming &timing) :
+    model(timing),
+    sim_line_pixels(timing.h_active, 0) {}
+
+Simulation::RunResult LockstepChecker::run_cycles(Simulation &sim, uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) {
+    for (uint64_t cycle = 0; cycle < cycles; cycle++) {
+        if (mismatch) {
+            return Simulation::RunResult::FINISHED;
+        }
+
+        // The sim is run one cycle at a time so that every VDP write can be forwarded to the model
+        uint64_t cycle_count = sim.cycle_count();
+        auto result = sim.run_cycles(1, frame_sink, audio_sink);
+
+        if (sim.cycle_count() != cycle_count) {
+            step_model(sim);
+        }
+
+        if (mismatch) {
+            return Simulation::RunResult::FINISHED;
+        } else if (result != Simulation::RunResult::CYCLES_COMPLETE) {
+            return result;
+        }
+    }
+
+    return Simulation::RunResult::CYCLES_COMPLETE;
+}
+
+void LockstepChecker::step_model(const Simulation &sim) {
+    Simulation::VDPWrite write;
+    if (sim.vdp_write(&write)) {
+        if (write.copper_ram) {
+            model.write_copper_ram(write.address, write.data);
+        } else {
+            model.write(write.address, write.data);
+        }
+    }
+
+    model.run(1);
+
+    const VDPTiming &timing = model.video_timing();
+
+    bool vsync = sim.vsync();
+    bool de = sim.de();
+
+    if (vsync && !vsync_previous) {
+        if (!synced) {
+            // The sim vsync output lags the raster by a cycle and the model has already run this cycle
+            model.sync_raster(2, timing.v_active + timing.v_frontporch + timing.v_sync);
+            synced = true;
+        } else {
+            frame++;
+        }
+    }
+
+    if (de) {
+        if (sim_x < sim_line_pixels.size()) {
+            sim_line_pixels[sim_x] = sim.r() << 8 | sim.g() << 4 | sim.b();
+        }
+
+        sim_x++;
+    } else if (de_previous) {
+        if (synced && sim_line < timing.v_active) {
+            line_pending = true;
+            pending_line = sim_line;
+            pending_line_width = sim_x;
+        }
+
+        sim_line++;
+        sim_x = 0;
+    }
+
+    if (!vsync) {
+        sim_line = 0;
+    }
+
+    if (line_pending && model.raster_y() != pending_line) {
+        compare_line(pending_line, pending_line_width);
+        line_pending = false;
+    }
+
+    vsync_previous = vsync;
+    de_previous = de;
+}
+
+void LockstepChecker::compare_line(uint16_t line, uint16_t width) {
+    const uint16_t active_width = model.video_timing().h_active;
+
+    if (width != active_width) {
+        mismatch = true;
+        report_mismatch(line, std::min(width, active_width), "line width");
+        return;
+    }
+
+    compared_line_count++;
+
+    const uint16_t *sim_pixels = sim_line_pixels.data();
+    const uint16_t *model_pixels = model.line_pixels(line);
+
+    auto first_mismatch = std::mismatch(sim_pixels, sim_pixels + width, model_pixels);
+    if (first_mismatch.first != sim_pixels + width) {
+        mismatch = true;
+        report_mismatch(line, (uint16_t)(first_mismatch.first - sim_pixels), "pixel");
+    }
+}
+
+void LockstepChecker::report_mismatch(uint16_t line, uint16_t x, const char *reason) const {
+    static const char *const layer_names[] = {
+        "scroll0", "scroll1", "scroll2", "scroll3", "sprites", "background"
+    };
+
+    std::cerr << "Model mismatch (" << reason << ") in frame " << frame << ", line " << line << ", pixel " << x;
+
+    if (x < model.video_timing().h_active) {
+        uint8_t layer = model.line_layers(line)[x];
+        bool blended = layer & VDPModel::LAYER_BLENDED;
+        layer &= ~VDPModel::LAYER_BLENDED;
+
+        std::cerr << std::hex << std::setfill('0')
+            << ": sim 0x" << std::setw(3) << sim_line_pixels[x]
+            << ", model 0x" << std::setw(3) << model.line_pixels(line)[x]
+            << std::dec << ", model layer: " << layer_names[layer] << (blended ? " (blended)" : "");
+    }
+
+    std::cerr << std::endl;
+}
@@ -0,0 +1,62 @@
+// LockstepChecker.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Runs a sim alongside the behavioral VDP model and checks that both produce the same video output
+// The model is driven by the same VDP / copper RAM writes as the sim, as they're made by the CPU
+
+// Each active line output by the sim is compared directly against the model's line and the first mismatch is reported
+// Audio isn't checked since the model doesn't include the audio block
+
+#ifndef LockstepChecker_hpp
+#define LockstepChecker_hpp
+
+#include <stdint.h>
+#include <vector>
+
+#include "Simulation.hpp"
+#include "VDPModel.hpp"
+
+class LockstepChecker {
+
+public:
+    LockstepChecker(const VDPTiming &timing = VDPTiming::mode_configured());
+
+    /// Same as Simulation::run_cycles(), with the model stepped in lockstep.
+    /// Returns FINISHED early if a mismatch was found, which is reported to stderr.
+    Simulation::RunResult run_cycles(Simulation &sim, uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink);
+
+    bool mismatch_found() const { return mismatch; }
+
+    uint64_t lines_compared() const { return compared_line_count; }
+
+private:
+    VDPModel model;
+
+    // The model raster is aligned with the sim on the first vsync
+    bool synced = false;
+    bool mismatch = false;
+
+    bool vsync_previous = true;
+    bool de_previous = false;
+
+    uint64_t frame = 0;
+    uint16_t sim_line = 0;
+    uint16_t sim_x = 0;
+    std::vector<uint16_t> sim_line_pixels;
+
+    // Lines are compared once the model has finished drawing them
+    bool line_pending = false;
+    uint16_t pending_line = 0;
+    uint16_t pending_line_width = 0;
+
+    uint64_t compared_line_count = 0;
+
+    void step_model(const Simulation &sim);
+    void compare_line(uint16_t line, uint16_t width);
+    void report_mismatch(uint16_t line, uint16_t x, const char *reason) const;
+};
+
+#endif /* LockstepChecker_hpp */
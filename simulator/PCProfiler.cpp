@@ -0,0 +1,141 @@
+// PCProfiler.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "PCProfiler.hpp"
+#include "JSONFormat.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+
+// Samples outside of any symbol, such as the bootloader when the ELF is only for the user program
+static const std::string unknown_function = "[unknown]";
+
+bool PCProfiler::load_symbols(const std::string &elf_path) {
+    if (!symbols.load(elf_path)) {
+        return false;
+    }
+
+    if (symbols.size() == 0) {
+        std::cerr << "No function symbols found in ELF: " << elf_path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool PCProfiler::open(const std::string &path) {
+    const std::string jsonl_extension = ".jsonl";
+    bool is_jsonl = path.size() >= jsonl_extension.size() &&
+        path.compare(path.size() - jsonl_extension.size(), jsonl_extension.size(), jsonl_extension) == 0;
+
+    format = is_jsonl ? Format::JSONL : Format::FOLDED;
+
+    stream.open(path, std::ios::trunc);
+    if (!stream.good()) {
+        std::cerr << "Failed to open PC profile for writing: " << path << std::endl;
+        return false;
+    }
+
+    next_sample = sim.cycle_count() + interval;
+
+    return true;
+}
+
+uint64_t PCProfiler::cycles_until_sample() const {
+    uint64_t cycle = sim.cycle_count();
+    return next_sample > cycle ? next_sample - cycle : 1;
+}
+
+void PCProfiler::sample() {
+    uint64_t cycle = sim.cycle_count();
+    if (cycle < next_sample) {
+        return;
+    }
+
+    auto symbol = symbols.lookup(sim.cpu_pc());
+    const std::string &function = symbol ? symbol->name : unknown_function;
+
+    frame_samples[function]++;
+    frame_sample_count++;
+
+    next_sample = cycle + interval;
+}
+
+bool PCProfiler::end_frame(uint64_t frame) {
+    if (format == Format::JSONL) {
+        stream << "{\"frame\":" << frame << ",\"samples\":" << frame_sample_count << ",\"functions\":";
+        write_histogram(stream, frame_samples);
+        stream << "}\n";
+    }
+
+    for (auto &function : frame_samples) {
+        total_samples[function.first] += function.second;
+    }
+
+    total_sample_count += frame_sample_count;
+    frame_samples.clear();
+    frame_sample_count = 0;
+    frame_count++;
+
+    return stream.good();
+}
+
+bool PCProfiler::close() {
+    // Partial last frame, as in FlashProfiler::close()
+    for (auto &function : frame_samples) {
+        total_samples[function.first] += function.second;
+    }
+
+    total_sample_count += frame_sample_count;
+
+    if (format == Format::JSONL) {
+        stream << "{\"summary\":{\"frames\":" << frame_count << ",\"interval\":" << interval
+            << ",\"samples\":" << total_sample_count << ",\"functions\":";
+        write_histogram(stream, total_samples);
+        stream << "}}\n";
+    } else {
+        for (auto &function : total_samples) {
+            stream << function.first << " " << function.second << "\n";
+        }
+    }
+
+    stream.close();
+
+    std::vector<std::pair<std::string, uint64_t>> ranked(total_samples.begin(), total_samples.end());
+    std::sort(ranked.begin(), ranked.end(), [] (const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b) {
+        return a.second > b.second;
+    });
+
+    std::cout << "PC profile: " << total_sample_count << " samples, one every " << interval << " cycles" << std::endl;
+
+    for (size_t i = 0; i < std::min(ranked.size(), summary_function_count); i++) {
+        double percent = ranked[i].second * 100.0 / total_sample_count;
+        std::cout << "PC profile: " << std::fixed << std::setprecision(1) << std::setw(5) << percent << "% "
+            << ranked[i].first << std::defaultfloat << std::endl;
+    }
+
+    if (stream.fail()) {
+        std::cerr << "Failed to write PC profile" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void PCProfiler::write_histogram(std::ostream &stream, const Histogram &histogram) {
+    stream << "{";
+
+    bool first = true;
+    for (auto &function : histogram) {
+        stream << (first ? "" : ",") << json_string(function.first) << ":" << function.second;
+        first = false;
+    }
+
+    stream << "}";
+}
+
@@ -0,0 +1,77 @@
+// PCProfiler.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Sampling profiler for the CPU, which reads the PC of the sim every N cycles and attributes it to ELF symbols
+// Output is either folded stacks for flamegraph.pl (one "<function> <samples>" line per function for the whole run)
+// or JSON lines with a histogram of samples per function for each frame
+
+// Only the current function is known for each sample since there is no unwinding of the call stack
+
+#ifndef PCProfiler_hpp
+#define PCProfiler_hpp
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <fstream>
+
+#include "Simulation.hpp"
+#include "ElfSymbols.hpp"
+
+class PCProfiler {
+
+public:
+    enum class Format {
+        FOLDED, JSONL
+    };
+
+    /// Samples are taken every interval (clk_2x) cycles of sim.
+    PCProfiler(const Simulation &sim, uint64_t interval) : sim(sim), interval(interval) {}
+
+    bool load_symbols(const std::string &elf_path);
+
+    /// The format is derived from the extension of path, JSON lines for ".jsonl" and folded stacks otherwise.
+    bool open(const std::string &path);
+
+    /// Number of cycles until the next sample is due, which is at least 1.
+    /// The host limits each run_cycles() call to this so that it returns on the cycle to be sampled.
+    uint64_t cycles_until_sample() const;
+
+    /// Takes a sample if one is due.
+    void sample();
+
+    /// Writes the histogram of samples taken since the previous frame, if writing JSON lines.
+    /// Returns false if it couldn't be written.
+    bool end_frame(uint64_t frame);
+
+    /// Writes the totals for the whole run and prints the functions with the most samples.
+    bool close();
+
+private:
+    typedef std::map<std::string, uint64_t> Histogram;
+
+    const Simulation &sim;
+    const uint64_t interval;
+
+    Format format = Format::FOLDED;
+    std::ofstream stream;
+
+    ElfSymbols symbols;
+
+    uint64_t next_sample = 0;
+
+    Histogram frame_samples;
+    Histogram total_samples;
+    uint64_t frame_sample_count = 0;
+    uint64_t total_sample_count = 0;
+    uint64_t frame_count = 0;
+
+    static const size_t summary_function_count = 10;
+
+    static void write_histogram(std::ostream &stream, const Histogram &histogram);
+};
+
+#endif /* PCProfiler_hpp */
@@ -11,18 +11,143 @@
 #include <sstream>
 #include <iomanip>
 #include <map>
+#include <chrono>
+#include <algorithm>
 
 void QSPIFlashSim::load(const std::vector<uint8_t> &source, size_t offset) {
     size_t source_end_index = source.size() + offset;
     assert(source_end_index < max_size);
-    data.resize(std::max(source_end_index, data.size()));
 
-    defined_ranges.insert(Range(offset, source.size()));
+    writable_image().load(source, offset);
+}
+
+bool QSPIFlashSim::load_file(const std::string &path, size_t offset, size_t min_length) {
+    return writable_image().map_file(path, offset, min_length);
+}
+
+void QSPIFlashSim::write_direct(size_t index, uint8_t byte) {
+    writable_image().write(index, byte);
+}
+
+FlashImage &QSPIFlashSim::writable_image() {
+    if (image.use_count() > 1) {
+        image = std::shared_ptr<FlashImage>(image->clone());
+    }
+
+    return *image;
+}
+
+// Save states:
+
+void QSPIFlashSim::save_state(StateWriter &writer) const {
+    writer.write_value<uint64_t>(image->defined_end());
+    writer.write_value(data_hash());
+
+    writer.write_value(powered_down);
+    writer.write_value(csn);
+    writer.write_value(clk);
+    writer.write_value(state);
+    writer.write_value(io_mode);
+    writer.write_value(cmd_mode);
+    writer.write_value(io);
+    writer.write_value(cmd);
+    writer.write_value(crm_enabled);
+    writer.write_value(read_buffer);
+    writer.write_value(bit_count);
+    writer.write_value(byte_count);
+    writer.write_value(read_index);
+    writer.write_value(dummy_cycles);
+    writer.write_value(clk_on_deactivate);
+    writer.write_value(activated_previously);
+    writer.write_value(qpi_extra_dummy_cycles);
+    writer.write_value(status_volatile_write_enable);
+    writer.write_value(status_2);
+    writer.write_value(output_en);
+    writer.write_value(send_buffer);
+}
+
+bool QSPIFlashSim::load_state(StateReader &reader) {
+    uint64_t saved_size, saved_hash;
+    if (!reader.read_value(saved_size) || !reader.read_value(saved_hash)) {
+        return false;
+    }
+
+    if (saved_size != image->defined_end() || saved_hash != data_hash()) {
+        log_error("Saved state was created with different flash contents");
+        return false;
+    }
+
+    return reader.read_value(powered_down) &&
+        reader.read_value(csn) &&
+        reader.read_value(clk) &&
+        reader.read_value(state) &&
+        reader.read_value(io_mode) &&
+        reader.read_value(cmd_mode) &&
+        reader.read_value(io) &&
+        reader.read_value(cmd) &&
+        reader.read_value(crm_enabled) &&
+        reader.read_value(read_buffer) &&
+        reader.read_value(bit_count) &&
+        reader.read_value(byte_count) &&
+        reader.read_value(read_index) &&
+        reader.read_value(dummy_cycles) &&
+        reader.read_value(clk_on_deactivate) &&
+        reader.read_value(activated_previously) &&
+        reader.read_value(qpi_extra_dummy_cycles) &&
+        reader.read_value(status_volatile_write_enable) &&
+        reader.read_value(status_2) &&
+        reader.read_value(output_en) &&
+        reader.read_value(send_buffer);
+}
+
+uint64_t QSPIFlashSim::data_hash() const {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    const uint8_t *bytes = image->bytes();
+    for (size_t index = 0; index < image->defined_end(); index++) {
+        hash = (hash ^ bytes[index]) * 0x100000001b3;
+    }
 
-    std::copy(source.begin(), source.end(), data.begin() + offset);
+    return hash;
+}
+
+uint64_t QSPIFlashSim::clock_overhead_ns() {
+    // Measured once, as the shortest of a few back to back clock reads, even if several models get here at once
+    static const uint64_t overhead_ns = [] {
+        uint64_t shortest_ns = UINT64_MAX;
+        for (int i = 0; i < 100; i++) {
+            auto start = std::chrono::steady_clock::now();
+            auto end = std::chrono::steady_clock::now();
+            uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            shortest_ns = std::min(shortest_ns, elapsed_ns);
+        }
+
+        return shortest_ns;
+    }();
+
+    return overhead_ns;
 }
 
 uint8_t QSPIFlashSim::update(bool csn, bool clk, uint8_t new_io, uint8_t *new_output_en) {
+    if (!enable_update_timing || update_timing_countdown-- != 0) {
+        return update_state(csn, clk, new_io, new_output_en);
+    }
+
+    update_timing_countdown = update_timing_interval - 1;
+
+    auto start = std::chrono::steady_clock::now();
+    uint8_t io = update_state(csn, clk, new_io, new_output_en);
+    auto end = std::chrono::steady_clock::now();
+
+    // Most updates take less time than reading the clock, so its own cost is taken out of each sample
+    uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    uint64_t overhead_ns = clock_overhead_ns();
+    update_time_sampled_ns += elapsed_ns > overhead_ns ? elapsed_ns - overhead_ns : 0;
+
+    return io;
+}
+
+uint8_t QSPIFlashSim::update_state(bool csn, bool clk, uint8_t new_io, uint8_t *new_output_en) {
     bool csn_prev = this->csn;
     this->csn = csn;
 
@@ -44,6 +169,12 @@ uint8_t QSPIFlashSim::update(bool csn, bool clk, uint8_t new_io, uint8_t *new_ou
             log_if(enable_incomplete_byte_logging,
                    "/CS deasserted before transferring a complete byte");
         }
+
+        if (transaction_sink) {
+            transaction.cmd_op = static_cast<uint8_t>(cmd);
+            transaction.io_width = bit_count_for_mode();
+            transaction_sink->transaction_ended(transaction);
+        }
     } else if (should_activate) {
         state = (crm_enabled ? IOState::ADDRESS : IOState::CMD);
 
@@ -64,11 +195,22 @@ uint8_t QSPIFlashSim::update(bool csn, bool clk, uint8_t new_io, uint8_t *new_ou
         }
 
         activated_previously = true;
+
+        if (transaction_sink) {
+            transaction = Transaction();
+            transaction.continuous_read = crm_enabled;
+            transaction.qpi = (cmd_mode == CMDMode::QPI);
+            transaction_sink->transaction_started();
+        }
     }
 
     bool clk_rose = clk && !clk_prev;
     bool clk_fell = !clk && clk_prev;
     if (!csn && clk_rose) {
+        if (transaction_sink) {
+            count_transaction_cycle();
+        }
+
         posedge_tick(new_io);
     } else if (!csn && clk_fell) {
         negedge_tick(new_io);
@@ -82,10 +224,44 @@ uint8_t QSPIFlashSim::update(bool csn, bool clk, uint8_t new_io, uint8_t *new_ou
 }
 
 
+uint32_t QSPIFlashSim::read_transaction(size_t index, uint8_t length) const {
+    uint32_t word = 0;
+
+    for (uint8_t i = 0; i < length; i++) {
+        if (!index_is_defined(index + i)) {
+            log_error([&] { return "Read index undefined (index: " + format_hex((uint32_t)(index + i), 6) + ")"; });
+            continue;
+        }
+
+        word |= (uint32_t)image->bytes()[index + i] << (i * 8);
+    }
+
+    return word;
+}
+
+void QSPIFlashSim::count_transaction_cycle() {
+    switch (state) {
+        case IOState::CMD:
+            transaction.cmd_cycles++;
+            break;
+        case IOState::ADDRESS: case IOState::CRM_CMD:
+            transaction.address_cycles++;
+            break;
+        case IOState::DUMMY:
+            transaction.dummy_cycles++;
+            break;
+        case IOState::DATA: case IOState::REG_READ: case IOState::REG_WRITE:
+            transaction.data_cycles++;
+            break;
+        case IOState::IDLE:
+            break;
+    }
+}
+
 bool QSPIFlashSim::check_conflicts(uint8_t input_en) const {
     uint8_t conflict_mask = output_en & input_en;
     if (conflict_mask) {
-        log_error("IO conflict (" + format_hex(conflict_mask, 1) + ")");
+        log_error([&] { return "IO conflict (" + format_hex(conflict_mask, 1) + ")"; });
     }
 
     return conflict_mask;
@@ -98,11 +274,12 @@ void QSPIFlashSim::negedge_tick(uint8_t io) {
             if (bit_count == 0) {
                 if (!index_is_defined(read_index)) {
                     send_buffer = 0x00;
-                    log_error("Read index undefined (index: " + format_hex(read_index, 6) + ")");
+                    log_error([&] { return "Read index undefined (index: " + format_hex(read_index, 6) + ")"; });
                 } else {
-                    uint8_t byte_to_send = data[read_index++];
+                    uint8_t byte_to_send = image->bytes()[read_index++];
                     send_buffer = byte_to_send;
-                    log_info("...sending byte: " + format_hex(byte_to_send));
+                    transaction.byte_count++;
+                    log_info([&] { return "...sending byte: " + format_hex(byte_to_send); });
                 }
             }
             send_bits();
@@ -110,7 +287,7 @@ void QSPIFlashSim::negedge_tick(uint8_t io) {
         case IOState::REG_READ:
             if (bit_count == 0) {
                 send_buffer = status_for_cmd();
-                log_info("...sending register byte: " + format_hex(send_buffer));
+                log_info([&] { return "...sending register byte: " + format_hex(send_buffer); });
             }
             send_bits();
             break;
@@ -152,7 +329,7 @@ void QSPIFlashSim::handle_new_cmd() {
     uint8_t new_cmd_op = read_buffer;
 
     cmd = cmd_from_op(new_cmd_op);
-    log_info("CMD received: " + format_hex(new_cmd_op) + ": " + cmd_name(cmd));
+    log_info([&] { return "CMD received: " + format_hex(new_cmd_op) + ": " + cmd_name(cmd); });
 
     if (powered_down && cmd != CMD::RELEASE_POWER_DOWN) {
         log_error("Ignoring CMD as flash is in powered-down state");
@@ -231,7 +408,7 @@ void QSPIFlashSim::handle_new_cmd() {
             transition_io_state(IOState::REG_READ);
             break;
         default:
-            log_error("Unrecognized command (" + format_hex(new_cmd_op) + ")");
+            log_error([&] { return "Unrecognized command (" + format_hex(new_cmd_op) + ")"; });
             io_mode = IOMode::SINGLE;
             transition_io_state(IOState::IDLE);
             break;
@@ -299,7 +476,8 @@ void QSPIFlashSim::posedge_tick(uint8_t io) {
             }
 
             if (byte_count == 3) {
-                log_info("Address set to: " + format_hex(read_index));
+                transaction.address = read_index;
+                log_info([&] { return "Address set to: " + format_hex(read_index); });
 
                 transition_io_state(state_after_address());
             }
@@ -314,7 +492,7 @@ void QSPIFlashSim::posedge_tick(uint8_t io) {
                 if (crm_enabled && !new_crm_state) {
                     log_info("CRM disabled");
                 } else if (!crm_enabled && new_crm_state) {
-                    log_info("CRM enabled for command: " + format_hex(static_cast<uint8_t>(cmd)));
+                    log_info([&] { return "CRM enabled for command: " + format_hex(static_cast<uint8_t>(cmd)); });
                 } else if (new_crm_state) {
                     log_info("...CRM still enabled...");
                 }
@@ -367,7 +545,7 @@ void QSPIFlashSim::write_status_reg() {
 
     switch (cmd) {
         case CMD::WRITE_STATUS_REG_2:
-            log_info("SR2 updated to: " + format_hex(read_buffer));
+            log_info([&] { return "SR2 updated to: " + format_hex(read_buffer); });
             status_2 = read_buffer;
             break;
         default:
@@ -393,16 +571,6 @@ QSPIFlashSim::IOState QSPIFlashSim::state_after_address() {
     }
 }
 
-bool QSPIFlashSim::index_is_defined(size_t index) {
-    for (auto range : defined_ranges) {
-        if (range.contains(index)) {
-            return true;
-        }
-    }
-
-    return false;
-}
-
 uint8_t QSPIFlashSim::bit_count_for_mode() {
     switch (io_mode) {
         case IOMode::SINGLE:
@@ -464,30 +632,12 @@ void QSPIFlashSim::read_bits(uint8_t io, uint8_t count) {
     }
 }
 
-bool QSPIFlashSim::Range::contains(size_t index) const {
-    return index >= offset && index < (offset + length);
+void QSPIFlashSim::print_info(const std::string &message) const {
+    std::cout << "QSPIFlashSim: " << message << std::endl;
 }
 
-bool QSPIFlashSim::Range::operator < (const Range &other) const {
-    return offset < other.offset || length < other.length;
-}
-
-void QSPIFlashSim::log_if(bool condition, const std::string &message) const {
-    if (condition) {
-        log_info(message);
-    };
-}
-
-void QSPIFlashSim::log_info(const std::string &message) const {
-    if (enable_info_logging) {
-        std::cout << "QSPIFlashSim: " << message << std::endl;
-    }
-}
-
-void QSPIFlashSim::log_error(const std::string &message) const {
-    if (enable_error_logging) {
-        std::cerr << "QSPIFlashSim error: " << message << std::endl;
-    }
+void QSPIFlashSim::print_error(const std::string &message) const {
+    std::cerr << "QSPIFlashSim error: " << message << std::endl;
 }
 
 std::string QSPIFlashSim::format_hex(uint8_t integer) const {
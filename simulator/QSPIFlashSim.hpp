@@ -17,6 +17,10 @@
 #include <vector>
 #include <set>
 #include <string>
+#include <memory>
+
+#include "StateSerializer.hpp"
+#include "FlashImage.hpp"
 
 class QSPIFlashSim {
 
@@ -26,22 +30,87 @@ public:
         ISSI = 0x9d
     };
 
+    /// Summary of a single transaction, from /CS being asserted to being deasserted.
+    /// Cycle counts are of the flash clock, split by the phase the flash was in on each rising edge.
+    struct Transaction {
+        // Opcode of the command, which in continuous read mode was sent in an earlier transaction
+        uint8_t cmd_op = 0;
+        // Set if the command phase was skipped because continuous read mode was enabled
+        bool continuous_read = false;
+        // Set if the command was sent in QPI mode
+        bool qpi = false;
+        // IO lines used for the address and data (1, 2 or 4)
+        uint8_t io_width = 1;
+        // Only valid if address_cycles is non-zero
+        uint32_t address = 0;
+        // Data bytes sent by the flash
+        uint32_t byte_count = 0;
+
+        uint32_t cmd_cycles = 0;
+        uint32_t address_cycles = 0;
+        uint32_t dummy_cycles = 0;
+        uint32_t data_cycles = 0;
+    };
+
+    class TransactionSink {
+
+    public:
+        virtual ~TransactionSink() {}
+
+        /// Called when /CS is asserted.
+        virtual void transaction_started() = 0;
+
+        /// Called when /CS is deasserted, with the transaction that was just completed.
+        virtual void transaction_ended(const Transaction &transaction) = 0;
+    };
+
     /// Initializes the flash model with a given maximum size.
-    QSPIFlashSim(size_t max_size = 0x1000000, MFID mfid = MFID::WINBOND) : mfid(mfid), max_size(max_size) {};
+    /// Copies of the model share the same flash contents until either of them writes to it.
+    QSPIFlashSim(size_t max_size = 0x1000000, MFID mfid = MFID::WINBOND) :
+        mfid(mfid), max_size(max_size), image(std::make_shared<FlashImage>(max_size)) {};
 
     /// Loads the entire contents of source into the given offset in flash memory.
     /// By default, errors are logged on attempts to access flash memory outside of the loaded regions.
     void load(const std::vector<uint8_t> &source, size_t offset);
 
+    /// Maps the file at path into the given offset in flash memory without copying it.
+    /// If the file is shorter than min_length, the remaining bytes read as 0 and are also considered loaded.
+    bool load_file(const std::string &path, size_t offset, size_t min_length = 0);
+
+    /// Writes a byte of flash memory directly, bypassing the SPI interface.
+    /// Only this copy of the model sees the write. The shared contents and loaded files are left as is.
+    void write_direct(size_t index, uint8_t byte);
+
     /// Updates the state of the model with the given inputs.
     /// Returns the updated state of the IO pins after these updates.
     /// Optionally sets the state of the output enable for the corresponding output bits using new_output_en.
     uint8_t update(bool csn, bool clk, uint8_t io, uint8_t *new_output_en = NULL);
 
+    /// Host time spent in update() while enable_update_timing is set.
+    /// This is an estimate scaled up from the calls that were timed.
+    uint64_t update_time_ns() const { return update_time_sampled_ns * update_timing_interval; }
+
+    /// Reads a byte of flash memory directly, bypassing the SPI interface.
+    /// This is for sims that don't model the flash controller. Unloaded regions read as erased (0xff).
+    uint8_t read_direct(size_t index) const { return index < image->defined_end() ? image->bytes()[index] : 0xff; }
+
+    /// Reads length bytes (up to 4) starting at index as a little endian word, as a Fast Read would return them.
+    /// This is for sims that serve flash reads as a single transaction instead of through the SPI interface.
+    /// Undefined bytes read as 0 and are logged as errors.
+    uint32_t read_transaction(size_t index, uint8_t length) const;
+
     /// Logs an error if the there is a conflict between the current output and input enables.
     /// Returns true if there was a conflict.
     bool check_conflicts(uint8_t input_en) const;
 
+    /// Saves the state of the command / IO state machine.
+    /// The flash contents aren't included since they're read-only. A hash of them is saved instead.
+    void save_state(StateWriter &writer) const;
+
+    /// Restores state saved with save_state().
+    /// Returns false if the state couldn't be read or the loaded flash contents don't match.
+    bool load_state(StateReader &reader);
+
     /// If true, RELEASE_POWER_DOWN must be sent before using the flash
     bool powered_down = true;
 
@@ -52,15 +121,13 @@ public:
     bool enable_incomplete_byte_logging = true;
     bool enable_idle_clock_state_mismatch_logging = true;
 
-private:
-    struct Range {
-        Range(size_t offset, size_t length) : offset(offset), length(length) {}
-        size_t offset, length;
+    /// Opt-in timing of update(), which reads the host clock for a sample of the calls
+    bool enable_update_timing = false;
 
-        bool operator < (const Range &other) const;
-        bool contains(size_t index) const;
-    };
+    /// Optional sink notified of every transaction made through the SPI interface
+    TransactionSink *transaction_sink = NULL;
 
+private:
     enum class CMD: uint8_t {
         READ_DATA = 0x03, FAST_READ_DUAL_IO = 0xbb, FAST_READ_QUAD_IO = 0xeb,
         WRITE_ENABLE_VOLATILE = 0x50,
@@ -90,8 +157,11 @@ private:
     bool csn = true, clk = false;
 
     size_t max_size;
-    std::vector<uint8_t> data;
-    std::set<Range> defined_ranges;
+
+    // Shared with every copy of this model, so it must be cloned before any writes
+    std::shared_ptr<FlashImage> image;
+
+    FlashImage &writable_image();
 
     IOState state = IOState::CMD;
     IOMode io_mode = IOMode::SINGLE;
@@ -107,6 +177,16 @@ private:
     void handle_new_cmd();
     const std::string cmd_name(CMD cmd);
 
+    // Only one in this many calls to update() is timed since reading the clock costs more than most updates
+    // This is prime so the timed calls don't keep landing on the same phase of the flash clock or of a byte transfer
+    static const uint32_t update_timing_interval = 61;
+    uint32_t update_timing_countdown = 0;
+    uint64_t update_time_sampled_ns = 0;
+
+    static uint64_t clock_overhead_ns();
+
+    uint8_t update_state(bool csn, bool clk, uint8_t io, uint8_t *new_output_en);
+
     uint8_t read_buffer = 0;
     uint8_t bit_count = 0;
     uint8_t byte_count = 0;
@@ -115,6 +195,9 @@ private:
     bool clk_on_deactivate = false;
     bool activated_previously = false;
 
+    Transaction transaction;
+    void count_transaction_cycle();
+
     void posedge_tick(uint8_t io);
     void negedge_tick(uint8_t io);
     void read_bits(uint8_t io);
@@ -135,14 +218,52 @@ private:
     uint8_t send_bits();
     uint8_t send_bits(uint8_t count);
 
-    bool index_is_defined(size_t index);
+    bool index_is_defined(size_t index) const {
+        return image->is_defined(index);
+    }
+
+    uint64_t data_hash() const;
 
     IOState state_after_address();
     void transition_io_state(IOState new_state);
 
-    void log_error(const std::string &message) const;
-    void log_info(const std::string &message) const;
-    void log_if(bool condition, const std::string &message) const;
+    // Messages that need formatting are passed as a callable returning a std::string
+    // Nothing is formatted unless the corresponding logging is enabled
+
+    void log_error(const char *message) const {
+        if (enable_error_logging) {
+            print_error(message);
+        }
+    }
+
+    void log_info(const char *message) const {
+        if (enable_info_logging) {
+            print_info(message);
+        }
+    }
+
+    template <typename MessageF>
+    void log_error(MessageF format_message) const {
+        if (enable_error_logging) {
+            print_error(format_message());
+        }
+    }
+
+    template <typename MessageF>
+    void log_info(MessageF format_message) const {
+        if (enable_info_logging) {
+            print_info(format_message());
+        }
+    }
+
+    void log_if(bool condition, const char *message) const {
+        if (condition) {
+            log_info(message);
+        }
+    }
+
+    void print_error(const std::string &message) const;
+    void print_info(const std::string &message) const;
 
     std::string format_hex(uint8_t integer) const ;
     std::string format_hex(uint32_t integer, uint32_t chars) const ;
@@ -0,0 +1,322 @@
+// RegressionRunner.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "RegressionRunner.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "FrameSink.hpp"
+#include "AudioSink.hpp"
+#include "InputMovie.hpp"
+#include "VDPTiming.hpp"
+
+// Same layout as the flash used by main.cpp
+static const size_t flash_user_base = 0x200000;
+static const size_t flash_ipl_size = 0x10000;
+
+// Version 2: frame hashes are derived from the frame sink's line hashes
+static const uint32_t golden_version = 2;
+
+static std::string relative_to(const std::string &base_path, const std::string &path) {
+    size_t separator = base_path.find_last_of('/');
+    if (path.empty() || path[0] == '/' || separator == std::string::npos) {
+        return path;
+    }
+
+    return base_path.substr(0, separator + 1) + path;
+}
+
+bool RegressionRunner::load_manifest(const std::string &path) {
+    std::ifstream manifest(path);
+    if (!manifest.good()) {
+        std::cerr << "Failed to open regression manifest: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t line_number = 0;
+
+    while (std::getline(manifest, line)) {
+        line_number++;
+
+        std::istringstream line_stream(line);
+        Demo demo;
+        if (!(line_stream >> demo.name) || demo.name[0] == '#') {
+            continue;
+        }
+
+        if (!(line_stream >> demo.program_path >> demo.frames) || demo.frames == 0) {
+            std::cerr << "Invalid demo on line " << line_number << ": " << line << std::endl;
+            return false;
+        }
+
+        line_stream >> demo.movie_path;
+
+        demo.program_path = relative_to(path, demo.program_path);
+        demo.movie_path = relative_to(path, demo.movie_path);
+        demos.push_back(demo);
+    }
+
+    if (demos.empty()) {
+        std::cerr << "No demos found in regression manifest: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool RegressionRunner::select_demos(const std::vector<std::string> &names) {
+    std::vector<Demo> selected;
+
+    for (auto &name : names) {
+        auto demo = std::find_if(demos.begin(), demos.end(), [&] (const Demo &demo) {
+            return demo.name == name;
+        });
+
+        if (demo == demos.end()) {
+            std::cerr << "Demo not found in manifest: " << name << std::endl;
+            return false;
+        }
+
+        selected.push_back(*demo);
+    }
+
+    demos = selected;
+
+    return true;
+}
+
+bool RegressionRunner::run(const std::string &golden_dir, unsigned job_count, bool update) {
+    std::vector<Result> results(demos.size());
+    std::atomic<size_t> next_demo(0);
+
+    // Each worker takes the next demo that hasn't been started until there are none left
+    auto worker = [&] {
+        size_t index;
+        while ((index = next_demo++) < demos.size()) {
+            const Demo &demo = demos[index];
+            Result &result = results[index];
+            std::string golden_path = golden_dir + "/" + demo.name + ".golden";
+
+            result = run_demo(demo);
+
+            if (!result.message.empty()) {
+                result.passed = false;
+            } else if (update) {
+                result.passed = write_golden(golden_path, result);
+                if (!result.passed) {
+                    result.message = "failed to write golden: " + golden_path;
+                }
+            } else {
+                check_golden(golden_path, result);
+            }
+
+            report(demo, result, update);
+        }
+    };
+
+    if (!compare_audio) {
+        std::cout << "Note: this sim has no audio output, so only frames are " << (update ? "recorded" : "checked") << std::endl;
+    }
+
+    job_count = std::max(1u, std::min(job_count, (unsigned)demos.size()));
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < job_count; i++) {
+        workers.emplace_back(worker);
+    }
+
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    size_t passed_count = std::count_if(results.begin(), results.end(), [] (const Result &result) {
+        return result.passed;
+    });
+
+    std::cout << passed_count << " of " << results.size() << " demos " << (update ? "updated" : "passed")
+        << " (" << job_count << " jobs)" << std::endl;
+
+    return passed_count == results.size();
+}
+
+RegressionRunner::Result RegressionRunner::run_demo(const Demo &demo) {
+    Result result;
+
+    QSPIFlashSim flash;
+    flash.powered_down = true;
+    flash.enable_info_logging = false;
+
+    if (!flash.load_file(demo.program_path, flash_user_base, flash_ipl_size)) {
+        result.message = "failed to load program: " + demo.program_path;
+        return result;
+    }
+
+    InputMovie movie;
+    if (!demo.movie_path.empty() && !movie.load(demo.movie_path)) {
+        result.message = "failed to load input movie: " + demo.movie_path;
+        return result;
+    }
+
+    std::vector<uint8_t> ipl(flash_ipl_size);
+    for (size_t i = 0; i < ipl.size(); i++) {
+        ipl[i] = flash.read_direct(flash_user_base + i);
+    }
+
+    auto sim = factory(flash);
+    sim->preload_cpu_program(ipl);
+
+    // Frames include the blanking periods of the mode the sim was built for, as main.cpp does with --show-blanking
+    const VDPTiming timing = VDPTiming::mode_configured();
+    FrameSink frame_sink(timing.h_total(), timing.v_total());
+    AudioSink audio_sink(4096);
+
+    const uint64_t batch_cycles = 1000000;
+    uint64_t audio_hash = hash(NULL, 0);
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    while (result.frame_hashes.size() < demo.frames) {
+        auto run_result = sim->run_cycles(batch_cycles, frame_sink, audio_sink);
+
+        if (audio_sink.size() > 0) {
+            auto samples = reinterpret_cast<const uint8_t *>(audio_sink.samples());
+            audio_hash = hash(samples, audio_sink.size() * sizeof(int16_t), audio_hash);
+            audio_sink.clear();
+        }
+
+        if (run_result == Simulation::RunResult::FINISHED) {
+            result.message = "sim finished after " + std::to_string(result.frame_hashes.size()) + " frames";
+            break;
+        }
+
+        if (run_result == Simulation::RunResult::FRAME_COMPLETE) {
+            uint64_t frame = result.frame_hashes.size();
+            // The sink hashes rows as they're drawn so the frame doesn't need to be hashed again here
+            result.frame_hashes.push_back(frame_sink.frame_hash());
+
+            InputMovie::apply(*sim, movie.frame_buttons(frame));
+        }
+    }
+
+    auto end_time = std::chrono::steady_clock::now();
+
+    sim->final();
+
+    result.audio_hash = audio_hash;
+    result.cycles = sim->cycle_count();
+    result.host_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count();
+
+    return result;
+}
+
+void RegressionRunner::check_golden(const std::string &golden_path, Result &result) const {
+    std::ifstream golden(golden_path);
+    if (!golden.good()) {
+        result.message = "no golden found: " + golden_path;
+        return;
+    }
+
+    std::string key;
+    uint32_t version = 0;
+    if (!(golden >> key >> version) || key != "version" || version != golden_version) {
+        result.message = "golden was written by a different version of the runner, rerun with --update: " + golden_path;
+        return;
+    }
+
+    uint64_t frame_count = 0;
+    if (!(golden >> key >> frame_count) || key != "frames") {
+        result.message = "invalid golden: " + golden_path;
+        return;
+    }
+
+    if (frame_count != result.frame_hashes.size()) {
+        result.message = "golden has " + std::to_string(frame_count) + " frames, ran " + std::to_string(result.frame_hashes.size());
+        return;
+    }
+
+    for (uint64_t i = 0; i < frame_count; i++) {
+        uint64_t frame;
+        std::string hash;
+        if (!(golden >> key >> frame >> hash) || key != "frame" || frame != i) {
+            result.message = "invalid golden: " + golden_path;
+            return;
+        }
+
+        if (hash != format_hash(result.frame_hashes[i])) {
+            result.message = "frame " + std::to_string(i) + " differs from golden";
+            return;
+        }
+    }
+
+    std::string audio_hash;
+    if (!(golden >> key >> audio_hash) || key != "audio") {
+        result.message = "invalid golden: " + golden_path;
+        return;
+    }
+
+    if (compare_audio && audio_hash != format_hash(result.audio_hash)) {
+        result.message = "audio differs from golden";
+        return;
+    }
+
+    result.passed = true;
+}
+
+bool RegressionRunner::write_golden(const std::string &golden_path, const Result &result) const {
+    std::ofstream golden(golden_path, std::ios::trunc);
+
+    golden << "version " << golden_version << "\n";
+    golden << "frames " << result.frame_hashes.size() << "\n";
+    for (size_t i = 0; i < result.frame_hashes.size(); i++) {
+        golden << "frame " << i << " " << format_hash(result.frame_hashes[i]) << "\n";
+    }
+
+    golden << "audio " << format_hash(result.audio_hash) << "\n";
+    golden.close();
+
+    return !golden.fail();
+}
+
+void RegressionRunner::report(const Demo &demo, const Result &result, bool update) {
+    double seconds = result.host_ns / 1e9;
+    double cycles_per_second = seconds > 0 ? result.cycles / seconds : 0;
+
+    std::lock_guard<std::mutex> lock(output_mutex);
+
+    std::cout << (result.passed ? (update ? "UPDATED " : "PASS ") : "FAIL ") << demo.name << ": "
+        << result.frame_hashes.size() << " frames, "
+        << result.cycles << " cycles in " << std::fixed << std::setprecision(2) << seconds << "s, "
+        << (uint64_t)cycles_per_second << " cycles/s" << std::defaultfloat;
+
+    if (!result.message.empty()) {
+        std::cout << " (" << result.message << ")";
+    }
+
+    std::cout << std::endl;
+}
+
+uint64_t RegressionRunner::hash(const uint8_t *bytes, size_t length, uint64_t hash) {
+    // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+std::string RegressionRunner::format_hash(uint64_t hash) {
+    std::ostringstream stream;
+    stream << std::hex << std::setfill('0') << std::setw(16) << hash;
+    return stream.str();
+}
@@ -0,0 +1,88 @@
+// RegressionRunner.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Runs a list of demo programs headless for a fixed number of frames, in parallel on a pool of threads
+// Each frame and the complete audio output are hashed and compared against previously stored goldens
+// Audio isn't compared for sims without an audio output, such as the ISS, though goldens still have the line for it
+
+// Manifest format, one demo per line with # starting a comment:
+// <name> <program path> <frames> [input movie path]
+// Paths are relative to the manifest
+
+// Golden format, one file per demo named <name>.golden:
+// version <version>
+// frames <count>
+// frame <index> <hash>   (once per frame)
+// audio <hash>
+
+#ifndef RegressionRunner_hpp
+#define RegressionRunner_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+
+#include "Simulation.hpp"
+
+class RegressionRunner {
+
+public:
+    struct Demo {
+        std::string name;
+        std::string program_path;
+        uint64_t frames = 0;
+        // Optional, otherwise no buttons are pressed
+        std::string movie_path;
+    };
+
+    struct Result {
+        bool passed = false;
+        std::string message;
+
+        std::vector<uint64_t> frame_hashes;
+        uint64_t audio_hash = 0;
+
+        uint64_t cycles = 0;
+        uint64_t host_ns = 0;
+    };
+
+    typedef std::function<std::unique_ptr<Simulation>(const QSPIFlashSim &flash)> SimulationFactory;
+
+    /// compare_audio is cleared for sims that don't produce audio, whose audio hashes would always match.
+    RegressionRunner(SimulationFactory factory, bool compare_audio = true) :
+        factory(factory),
+        compare_audio(compare_audio) {}
+
+    bool load_manifest(const std::string &path);
+
+    /// Selects which demos to run by name. All demos are run by default.
+    bool select_demos(const std::vector<std::string> &names);
+
+    /// Runs the selected demos on up to job_count threads, printing a line for each as it completes.
+    /// If update is set, goldens are written instead of compared.
+    /// Returns true if every demo passed.
+    bool run(const std::string &golden_dir, unsigned job_count, bool update);
+
+private:
+    SimulationFactory factory;
+    bool compare_audio;
+    std::vector<Demo> demos;
+
+    std::mutex output_mutex;
+
+    Result run_demo(const Demo &demo);
+    void check_golden(const std::string &golden_path, Result &result) const;
+    bool write_golden(const std::string &golden_path, const Result &result) const;
+    void report(const Demo &demo, const Result &result, bool update);
+
+    static uint64_t hash(const uint8_t *bytes, size_t length, uint64_t hash = 0xcbf29ce484222325);
+    static std::string format_hash(uint64_t hash);
+};
+
+#endif /* RegressionRunner_hpp */
@@ -0,0 +1,243 @@
+// SDLPresenter.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "SDLPresenter.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+// Events are still handled this often while no frames are arriving, such as during boot
+static const auto event_poll_interval = std::chrono::milliseconds(5);
+
+SDLPresenter::SDLPresenter(SDL_Window *window, size_t width, size_t height) :
+    window(window),
+    width(width),
+    height(height) {
+    reset_buffers();
+}
+
+SDLPresenter::~SDLPresenter() {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+    }
+}
+
+bool SDLPresenter::start() {
+    // Presentation is paced by vsync, which only ever blocks the main thread
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) {
+        std::cerr << "SDL_CreateRenderer() failed: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    if (!create_texture()) {
+        return false;
+    }
+
+    SDL_RenderSetScale(renderer, 1, 1);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_RenderPresent(renderer);
+
+    handle_events();
+
+    return true;
+}
+
+bool SDLPresenter::create_texture() {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+
+    texture = SDL_CreateTexture(renderer,
+        SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING,
+        (int)width,
+        (int)height
+    );
+
+    if (!texture) {
+        std::cerr << "SDL_CreateTexture() failed: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void SDLPresenter::reset_buffers() {
+    back_buffer.assign(width * height, 0xff000000);
+    pending_buffer.assign(width * height, 0xff000000);
+    front_buffer.assign(width * height, 0xff000000);
+
+    back_dirty_rows.assign(height, 0);
+    pending_dirty_rows.assign(height, 0);
+    front_dirty_rows.assign(height, 0);
+
+    submitted_hashes.assign(height, 0);
+    frame_submitted = false;
+    frame_pending = false;
+}
+
+void SDLPresenter::run() {
+    while (true) {
+        bool present = false;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait_for(lock, event_poll_interval, [this] {
+                return frame_pending || stopping || resize_pending;
+            });
+
+            // The sim thread is waiting in resize() so the buffers it uses can be replaced here
+            if (resize_pending) {
+                width = resize_width;
+                height = resize_height;
+                reset_buffers();
+
+                SDL_SetWindowSize(window, (int)width, (int)height);
+                resize_succeeded = create_texture();
+                resize_pending = false;
+                condition.notify_all();
+            }
+
+            if (frame_pending) {
+                std::swap(front_buffer, pending_buffer);
+                std::swap(front_dirty_rows, pending_dirty_rows);
+                frame_pending = false;
+                present = true;
+            } else if (stopping) {
+                break;
+            }
+        }
+
+        if (present && texture) {
+            present_front_buffer();
+        }
+
+        handle_events();
+    }
+}
+
+void SDLPresenter::present_front_buffer() {
+    auto start_time = std::chrono::steady_clock::now();
+
+    const size_t row_size = width * sizeof(uint32_t);
+
+    // Each run of consecutive changed rows is uploaded separately, leaving the rest of the texture as it was
+    size_t y = 0;
+    while (y < height) {
+        if (!front_dirty_rows[y]) {
+            y++;
+            continue;
+        }
+
+        size_t first_row = y;
+        while (y < height && front_dirty_rows[y]) {
+            y++;
+        }
+
+        SDL_Rect rect = {0, (int)first_row, (int)width, (int)(y - first_row)};
+        SDL_UpdateTexture(texture, &rect, &front_buffer[first_row * width], (int)row_size);
+
+        rows_uploaded += y - first_row;
+    }
+
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+
+    frames_presented++;
+
+    auto end_time = std::chrono::steady_clock::now();
+    present_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count();
+}
+
+void SDLPresenter::handle_events() {
+    SDL_Event e;
+    while (SDL_PollEvent(&e)) {
+        if (e.type == SDL_QUIT) {
+            quit = true;
+        }
+    }
+
+    int key_count = 0;
+    const Uint8 *state = SDL_GetKeyboardState(&key_count);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    keyboard.assign(state, state + key_count);
+}
+
+std::vector<Uint8> SDLPresenter::keyboard_state() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return keyboard;
+}
+
+void SDLPresenter::submit(const FrameSink &frame_sink) {
+    const uint64_t *hashes = frame_sink.line_hashes();
+
+    bool changed = false;
+    for (size_t y = 0; y < height; y++) {
+        bool dirty = !frame_submitted || hashes[y] != submitted_hashes[y];
+        back_dirty_rows[y] = dirty;
+        changed |= dirty;
+    }
+
+    if (!changed) {
+        frames_unchanged++;
+        return;
+    }
+
+    std::copy(hashes, hashes + height, submitted_hashes.begin());
+    frame_submitted = true;
+
+    // The copy is made before taking the lock so that the main thread is never held up by it
+    const uint32_t *pixels = frame_sink.pixels();
+    std::copy(pixels, pixels + width * height, back_buffer.begin());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Rows that changed in a frame that's about to be dropped still need to be uploaded
+        if (frame_pending) {
+            for (size_t y = 0; y < height; y++) {
+                back_dirty_rows[y] |= pending_dirty_rows[y];
+            }
+
+            frames_dropped++;
+        }
+
+        std::swap(back_buffer, pending_buffer);
+        std::swap(back_dirty_rows, pending_dirty_rows);
+        frame_pending = true;
+    }
+
+    condition.notify_all();
+}
+
+void SDLPresenter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_all();
+}
+
+bool SDLPresenter::resize(size_t width, size_t height) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    resize_width = width;
+    resize_height = height;
+    resize_pending = true;
+    condition.notify_all();
+
+    condition.wait(lock, [this] { return !resize_pending; });
+    return resize_succeeded;
+}
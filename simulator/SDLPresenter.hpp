@@ -0,0 +1,131 @@
+// SDLPresenter.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Presents completed frames to an SDL window while the sim runs on another thread
+// The sim thread only copies each frame into a back buffer and swaps it with the pending one, so it never waits on
+// texture uploads, vsync or the driver
+
+// Rendering and event handling stay on the main thread since some platforms (macOS) only allow them there
+// The renderer and streaming texture are created by start() and frames are presented by run(), both called from the
+// main thread. Everything else is called from the sim thread.
+
+// If the sim completes frames faster than they're presented, only the latest one is kept and the rest are dropped
+
+// Rows are compared using the line hashes from FrameSink. Only rows that changed since the previously submitted frame
+// are uploaded, and frames identical to it aren't handed off or presented at all.
+
+#ifndef SDLPresenter_hpp
+#define SDLPresenter_hpp
+
+#include <SDL.h>
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "FrameSink.hpp"
+
+class SDLPresenter {
+
+public:
+    SDLPresenter(SDL_Window *window, size_t width, size_t height);
+    ~SDLPresenter();
+
+    SDLPresenter(const SDLPresenter &) = delete;
+    SDLPresenter& operator=(const SDLPresenter &) = delete;
+
+    /// Main thread: creates the renderer and texture.
+    /// Returns false if either couldn't be created.
+    bool start();
+
+    /// Main thread: presents frames as they're submitted and handles window events until stop() is called.
+    /// Closing the window only sets quit_requested(), so the sim thread still decides when to stop.
+    void run();
+
+    /// Sim thread: hands off a completed frame without waiting for it to be presented.
+    /// Frames identical to the previously submitted one are skipped.
+    void submit(const FrameSink &frame_sink);
+
+    /// Sim thread: lets run() return once any pending frame is presented.
+    void stop();
+
+    /// Sim thread: has the main thread resize the window and recreate the texture to match, such as once the video
+    /// mode has been detected. Waits until both are done.
+    bool resize(size_t width, size_t height);
+
+    /// Sim thread: the window was closed.
+    bool quit_requested() const { return quit; }
+
+    /// Sim thread: copy of the keyboard state as of the last time events were handled, indexed by SDL_Scancode.
+    std::vector<Uint8> keyboard_state();
+
+    size_t frame_width() const { return width; }
+    size_t frame_height() const { return height; }
+
+    /// Host time the main thread has spent uploading and presenting frames, including any wait for vsync.
+    uint64_t present_time_ns() const { return present_ns; }
+
+    /// Only valid once run() has returned.
+    uint64_t presented_count() const { return frames_presented; }
+    uint64_t unchanged_count() const { return frames_unchanged; }
+    uint64_t dropped_count() const { return frames_dropped; }
+    uint64_t rows_uploaded_count() const { return rows_uploaded; }
+
+private:
+    SDL_Window *window;
+    SDL_Renderer *renderer = NULL;
+    SDL_Texture *texture = NULL;
+
+    // Only changed by the main thread while the sim thread waits in resize()
+    size_t width, height;
+
+    // Only the sim thread accesses back_buffer and only the main thread accesses front_buffer
+    // pending_buffer is shared and is only swapped while holding the mutex
+    // Each buffer has a flag per row that is set if the row changed and needs to be uploaded
+    std::vector<uint32_t> back_buffer;
+    std::vector<uint32_t> pending_buffer;
+    std::vector<uint32_t> front_buffer;
+
+    std::vector<uint8_t> back_dirty_rows;
+    std::vector<uint8_t> pending_dirty_rows;
+    std::vector<uint8_t> front_dirty_rows;
+
+    // Line hashes of the previously submitted frame, only accessed by the sim thread
+    std::vector<uint64_t> submitted_hashes;
+    bool frame_submitted = false;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    bool frame_pending = false;
+    bool stopping = false;
+
+    // Set by the sim thread in resize() and cleared by the main thread once the texture is recreated
+    bool resize_pending = false;
+    bool resize_succeeded = false;
+    size_t resize_width = 0, resize_height = 0;
+
+    std::vector<Uint8> keyboard;
+    std::atomic<bool> quit {false};
+    std::atomic<uint64_t> present_ns {0};
+
+    // Presented frames and rows are counted by the main thread
+    uint64_t frames_presented = 0;
+    uint64_t rows_uploaded = 0;
+    // Frames identical to the previously submitted one
+    uint64_t frames_unchanged = 0;
+    // Frames replaced by a newer one before being presented
+    uint64_t frames_dropped = 0;
+
+    bool create_texture();
+    void reset_buffers();
+    void handle_events();
+    void present_front_buffer();
+};
+
+#endif /* SDLPresenter_hpp */
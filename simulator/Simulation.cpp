@@ -1,3 +1,202 @@
 #include "Simulation.hpp"
 
-QSPIFlashSim Simulation::default_flash = QSPIFlashSim();
+#include <iostream>
+#include <fstream>
+
+// Save states:
+
+static const uint32_t host_state_magic = 0x33534349; // "ICS3"
+// Version 2: FrameSink pixel index is in pixels rather than RGB24 bytes
+// Version 3: FrameSink layout and vga_de state
+// Version 4: End marker, so that a truncated state is rejected even if the backend can't report short reads
+static const uint32_t host_state_version = 4;
+
+static const uint32_t host_state_end_magic = 0x444e4549; // "IEND"
+
+void Simulation::save_host_state(StateWriter &writer, const FrameSink &frame_sink) const {
+    writer.write_value(host_state_magic);
+    writer.write_value(host_state_version);
+
+    writer.write_value(current_time);
+    writer.write_value(clk_1x);
+    writer.write_value(clk_2x);
+
+    const bool buttons[] = {
+        button_user, button_1, button_2, button_3,
+        button_y, button_up, button_down,
+        button_l, button_r,
+        button_x, button_a,
+        button_select, button_start
+    };
+    writer.write_value(buttons);
+
+    writer.write_value<uint64_t>(frame_sink.frame_width());
+    writer.write_value<uint64_t>(frame_sink.frame_height());
+    frame_sink.save_state(writer);
+
+    writer.write_value(host_state_end_magic);
+}
+
+bool Simulation::load_host_state(StateReader &reader, FrameSink &frame_sink) {
+    uint32_t magic, version;
+    if (!reader.read_value(magic) || !reader.read_value(version)) {
+        return false;
+    }
+
+    if (magic != host_state_magic || version != host_state_version) {
+        std::cerr << "Unrecognized save state format" << std::endl;
+        return false;
+    }
+
+    bool buttons[13];
+    if (!reader.read_value(current_time) || !reader.read_value(clk_1x) || !reader.read_value(clk_2x) ||
+        !reader.read_value(buttons)) {
+        return false;
+    }
+
+    bool *button_states[] = {
+        &button_user, &button_1, &button_2, &button_3,
+        &button_y, &button_up, &button_down,
+        &button_l, &button_r,
+        &button_x, &button_a,
+        &button_select, &button_start
+    };
+    static_assert(sizeof(button_states) / sizeof(bool *) == sizeof(buttons), "Button count mismatch");
+
+    for (size_t i = 0; i < sizeof(buttons); i++) {
+        *button_states[i] = buttons[i];
+    }
+
+    uint64_t frame_width, frame_height;
+    if (!reader.read_value(frame_width) || !reader.read_value(frame_height)) {
+        return false;
+    }
+
+    // The frame is sized for the video mode detected when the state was saved, which can differ from the default
+    const uint64_t max_frame_dimension = 4096;
+    if (frame_width == 0 || frame_height == 0 || frame_width > max_frame_dimension || frame_height > max_frame_dimension) {
+        std::cerr << "Saved state has invalid frame dimensions: " << frame_width << "x" << frame_height << std::endl;
+        return false;
+    }
+
+    if (frame_width != frame_sink.frame_width() || frame_height != frame_sink.frame_height()) {
+        frame_sink.resize(frame_width, frame_height);
+    }
+
+    if (!frame_sink.load_state(reader)) {
+        return false;
+    }
+
+    uint32_t end_magic;
+    if (!reader.read_value(end_magic) || end_magic != host_state_end_magic) {
+        std::cerr << "Save state is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool Simulation::host_state_written(const std::string &path) {
+    std::ifstream stream(path, std::ios::binary | std::ios::ate);
+    if (!stream.good() || stream.tellg() < (std::streamoff)sizeof(host_state_end_magic)) {
+        return false;
+    }
+
+    uint32_t end_magic = 0;
+    stream.seekg(-(std::streamoff)sizeof(end_magic), std::ios::end);
+    stream.read((char *)&end_magic, sizeof(end_magic));
+
+    return stream.good() && end_magic == host_state_end_magic;
+}
+
+// Tracing:
+
+#if VCD_WRITE
+
+void Simulation::trace(const TraceConfig &config) {
+    trace_config = config;
+    trace_state = TraceState::WAITING;
+    trace_frame_count = 0;
+
+    prepare_trace(config);
+
+    // Without a start trigger the trace covers the whole run, including the first cycle
+    if (config.start.kind == TraceTrigger::Kind::NONE) {
+        start_trace();
+    }
+}
+
+void Simulation::check_trace_triggers(bool frame_completed) {
+    trace_frame_count += frame_completed;
+
+    switch (trace_state) {
+        case TraceState::WAITING:
+            if (trace_trigger_hit(trace_config.start)) {
+                start_trace();
+            }
+            break;
+        case TraceState::ACTIVE:
+            if (trace_config.stop.kind != TraceTrigger::Kind::NONE && trace_trigger_hit(trace_config.stop)) {
+                stop_trace(trace_config.stop.description());
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+bool Simulation::trace_trigger_hit(const TraceTrigger &trigger) const {
+    switch (trigger.kind) {
+        case TraceTrigger::Kind::NONE:
+            return true;
+        case TraceTrigger::Kind::FRAME:
+            return trace_frame_count >= trigger.value;
+        case TraceTrigger::Kind::CYCLE:
+            return cycle_count() >= trigger.value;
+        case TraceTrigger::Kind::PC:
+            return cpu_pc() == trigger.value;
+        case TraceTrigger::Kind::WRITE: {
+            CPUWrite write;
+            return cpu_write(&write) && write.includes(trigger.value);
+        }
+    }
+
+    return false;
+}
+
+void Simulation::start_trace() {
+    if (!open_trace(trace_config)) {
+        trace_failed = true;
+        trace_state = TraceState::DONE;
+        return;
+    }
+
+    std::cout << "Trace started at cycle " << cycle_count() << " (" << trace_config.start.description() << "): "
+        << trace_config.path << std::endl;
+
+    trace_active = true;
+    trace_state = TraceState::ACTIVE;
+}
+
+void Simulation::stop_trace(const std::string &reason) {
+    trace_active = false;
+    trace_state = TraceState::DONE;
+
+    if (!close_trace()) {
+        std::cerr << "Failed to write trace: " << trace_config.path << std::endl;
+        trace_failed = true;
+        return;
+    }
+
+    std::cout << "Trace stopped at cycle " << cycle_count() << " (" << reason << ")" << std::endl;
+}
+
+void Simulation::end_trace() {
+    if (trace_state == TraceState::ACTIVE) {
+        stop_trace("end of run");
+    } else if (trace_state == TraceState::WAITING) {
+        std::cout << "Trace start trigger wasn't hit (" << trace_config.start.description() << ")" << std::endl;
+    }
+}
+
+#endif
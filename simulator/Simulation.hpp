@@ -6,11 +6,27 @@
 #include <stdint.h>
 
 #include "QSPIFlashSim.hpp"
+#include "FrameSink.hpp"
+#include "AudioSink.hpp"
+#include "StateSerializer.hpp"
+#include "TraceConfig.hpp"
+
+class StopConditions;
+
+// Each instance owns all of its state (model, flash, time and inputs) so that several can run at once
+// Instances can run on different threads, as long as each one is only used by a single thread at a time
 
 class Simulation {
-    
+
 public:
-    static QSPIFlashSim default_flash;
+    enum class RunResult {
+        CYCLES_COMPLETE,
+        FRAME_COMPLETE,
+        AUDIO_BUFFER_FULL,
+        FINISHED,
+        // A stop condition was hit
+        STOPPED
+    };
 
     virtual ~Simulation() {}
 
@@ -25,12 +41,30 @@ public:
     bool button_select = false, button_start = false;
 
     virtual void forward_cmd_args(int argc, const char * argv[]) = 0;
-    
+
     virtual void preload_cpu_program(const std::vector<uint8_t> &program) = 0;
     virtual void step(uint64_t time) = 0;
 
+    /// Runs up to the given number of (clk_2x) cycles, plotting pixels into frame_sink and audio into audio_sink.
+    /// Returns early if a frame was completed, the audio sink is full, a stop condition was hit or the sim has finished.
+    /// A stop condition hit in the same cycle as one of the other results is only reported by stop_conditions.
+    virtual RunResult run_cycles(uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) = 0;
+
+    /// Total number of (clk_2x) cycles run so far.
+    uint64_t cycle_count() const { return current_time / 2; }
+
+    /// Saves the complete sim state to path, including the flash model and the raster position of frame_sink.
+    /// The same program must be loaded before restoring the state with load_state().
+    virtual bool save_state(const std::string &path, const FrameSink &frame_sink) = 0;
+    virtual bool load_state(const std::string &path, FrameSink &frame_sink) = 0;
+
 #if VCD_WRITE
-    virtual void trace(const std::string &filename) = 0;
+    /// Traces to config.path from the start trigger until the stop trigger.
+    /// The file isn't created and nothing is sampled until the start trigger is hit.
+    void trace(const TraceConfig &config);
+
+    /// Returns false if the trace couldn't be opened or written.
+    bool trace_good() const { return !trace_failed; }
 #endif
 
     virtual uint8_t r() const = 0;
@@ -39,12 +73,241 @@ public:
 
     virtual bool hsync() const = 0;
     virtual bool vsync() const = 0;
+    virtual bool de() const = 0;
+
+    struct VDPWrite {
+        bool copper_ram;
+        uint16_t address;
+        uint16_t data;
+    };
+
+    /// Returns true if the CPU made a VDP or copper RAM write in the last cycle, which is then copied to write.
+    virtual bool vdp_write(VDPWrite *write) const = 0;
+
+    struct CopperStep {
+        uint16_t raster_x;
+        uint16_t raster_y;
+        uint16_t pc;
+        uint16_t word;
+        // Set if word is data for a WRITE_REG op rather than an op
+        bool data;
+    };
+
+    /// Returns true if the copper executed an op or data word in the last cycle, which is then copied to step.
+    virtual bool copper_step(CopperStep *step) const = 0;
+
+    class CopperStepSink {
+
+    public:
+        virtual ~CopperStepSink() {}
+
+        virtual void copper_stepped(const CopperStep &step) = 0;
+    };
+
+    /// Optional sink for every op and data word executed by the copper, checked once per cycle by run_cycles().
+    CopperStepSink *copper_step_sink = NULL;
+
+    // Sprite and VRAM bus activity over one line, for checking content against the budgets of the VDP
+    struct VDPLineUsage {
+        uint16_t raster_y;
+
+        // The hit list rendered during this line, which was built during the previous one
+        uint16_t sprites_hit;
+        uint16_t sprite_pixels_hit;
+        // Sprites are rendered in 8 pixel rows, one per sprite slot that was used
+        uint16_t sprite_pixels_rendered;
+
+        // VRAM bus slots by owner, the affine layer has the bus to itself while it's fetching
+        uint16_t layer_slots;
+        uint16_t sprite_slots;
+        uint16_t host_slots;
+        uint16_t affine_slots;
+
+        // Host writes to VRAM, which are dropped if they're made while the affine layer has the bus
+        uint16_t host_writes;
+        uint16_t host_writes_dropped;
+    };
+
+    /// Returns true if a line ended in the last cycle, with the usage counted over that line copied to usage.
+    virtual bool vdp_line_usage(VDPLineUsage *usage) const = 0;
+
+    class VDPUsageSink {
+
+    public:
+        virtual ~VDPUsageSink() {}
+
+        virtual void line_used(const VDPLineUsage &usage) = 0;
+    };
+
+    /// Optional sink for the sprite and VRAM usage of every line, checked once per cycle by run_cycles().
+    VDPUsageSink *vdp_usage_sink = NULL;
+
+    /// Optional conditions checked once per cycle by run_cycles(), which returns STOPPED once one is hit.
+    /// Nothing is read from the sim for them unless this is set.
+    StopConditions *stop_conditions = NULL;
+
+    /// Address of the CPU's most recent instruction fetch, for sampling where time is spent.
+    /// The RTL sims report the fetch address, which can be a few instructions ahead of the one retiring.
+    virtual uint32_t cpu_pc() const = 0;
+
+    struct CPUWrite {
+        // Address of the word written
+        uint32_t address;
+        // Smaller writes are replicated across all byte lanes, as output by the CPU
+        uint32_t data;
+        // Byte lanes written
+        uint8_t wstrb;
+
+        /// Returns true if the byte at byte_address was written.
+        bool includes(uint32_t byte_address) const {
+            return (byte_address & ~3) == address && (wstrb >> (byte_address & 3) & 1);
+        }
+
+        /// The written bytes alone, shifted down to bit 0.
+        uint32_t value() const {
+            uint8_t lanes = wstrb & 0xf;
+            if (lanes == 0) {
+                return 0;
+            }
+
+            uint8_t shift = 0;
+            while (!(lanes & 1)) {
+                lanes >>= 1;
+                shift += 8;
+            }
+
+            uint32_t mask = lanes == 1 ? 0xff : lanes == 3 ? 0xffff : 0xffffffff;
+            return (data >> shift) & mask;
+        }
+    };
+
+    /// Returns true if the CPU completed a memory write in the last cycle, which is then copied to write.
+    virtual bool cpu_write(CPUWrite *write) const = 0;
 
     virtual bool get_samples(int16_t *left, int16_t *right) = 0;
 
+    /// The flash model instance used by this sim, for instrumentation.
+    virtual QSPIFlashSim &flash_model() = 0;
+
     virtual void final() = 0;
 
     virtual bool finished() const = 0;
+
+protected:
+    // Half-cycle count, incremented on every step()
+    uint64_t current_time = 0;
+
+    // State common to all implementations (time, clocks, inputs and raster position)
+    // Implementations save this after their own model state
+    void save_host_state(StateWriter &writer, const FrameSink &frame_sink) const;
+    bool load_host_state(StateReader &reader, FrameSink &frame_sink);
+
+    // Returns true if the file at path ends with a complete host state, for backends that can't report write errors
+    static bool host_state_written(const std::string &path);
+
+    // Shared clock loop for implementations of run_cycles()
+    // Calls are qualified with the concrete type so there is no virtual dispatch per step
+    // Implementations also include StopConditions.hpp, whose checks are inlined here
+    template <class SimulationT>
+    static RunResult run_cycles_loop(SimulationT &sim, uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink);
+
+#if VCD_WRITE
+    // Set between the start and stop triggers, implementations only sample the trace while this is set
+    bool trace_active = false;
+
+    // Called once when tracing is configured, for setup that has to happen before the start trigger
+    // open_trace() is then only left to open the file
+    virtual void prepare_trace(const TraceConfig &config) {}
+
+    virtual bool open_trace(const TraceConfig &config) = 0;
+    virtual bool close_trace() = 0;
+
+    // Checked by run_cycles_loop() after every cycle
+    void check_trace_triggers(bool frame_completed);
+
+    // Implementations call this from final() to close a trace that is still active
+    void end_trace();
+
+private:
+    enum class TraceState {
+        DISABLED, WAITING, ACTIVE, DONE
+    };
+
+    TraceConfig trace_config;
+    TraceState trace_state = TraceState::DISABLED;
+    uint64_t trace_frame_count = 0;
+    bool trace_failed = false;
+
+    bool trace_trigger_hit(const TraceTrigger &trigger) const;
+    void start_trace();
+    void stop_trace(const std::string &reason);
+#endif
 };
 
+template <class SimulationT>
+Simulation::RunResult Simulation::run_cycles_loop(SimulationT &sim, uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) {
+    const bool audio_enabled = audio_sink.enabled();
+
+    for (uint64_t cycle = 0; cycle < cycles; cycle++) {
+        if (sim.SimulationT::finished()) {
+            return RunResult::FINISHED;
+        } else if (audio_enabled && audio_sink.full()) {
+            // Sink wasn't drained after a previous return
+            return RunResult::AUDIO_BUFFER_FULL;
+        }
+
+        sim.clk_2x = 0;
+        sim.SimulationT::step(sim.current_time);
+        sim.current_time++;
+
+        sim.clk_2x = 1;
+        sim.clk_1x = sim.current_time & 2;
+        sim.SimulationT::step(sim.current_time);
+        sim.current_time++;
+
+        bool frame_completed = frame_sink.push(
+            sim.SimulationT::r(), sim.SimulationT::g(), sim.SimulationT::b(),
+            sim.SimulationT::hsync(), sim.SimulationT::vsync(), sim.SimulationT::de()
+        );
+
+#if VCD_WRITE
+        sim.check_trace_triggers(frame_completed);
+#endif
+
+        if (sim.copper_step_sink) {
+            CopperStep step;
+            if (sim.SimulationT::copper_step(&step)) {
+                sim.copper_step_sink->copper_stepped(step);
+            }
+        }
+
+        if (sim.vdp_usage_sink) {
+            VDPLineUsage usage;
+            if (sim.SimulationT::vdp_line_usage(&usage)) {
+                sim.vdp_usage_sink->line_used(usage);
+            }
+        }
+
+        bool stopped = sim.stop_conditions && sim.stop_conditions->check(sim, frame_completed);
+
+        bool audio_full = false;
+        if (audio_enabled) {
+            int16_t left, right;
+            if (sim.SimulationT::get_samples(&left, &right)) {
+                audio_full = audio_sink.push(left, right);
+            }
+        }
+
+        if (frame_completed) {
+            return RunResult::FRAME_COMPLETE;
+        } else if (audio_full) {
+            return RunResult::AUDIO_BUFFER_FULL;
+        } else if (stopped) {
+            return RunResult::STOPPED;
+        }
+    }
+
+    return RunResult::CYCLES_COMPLETE;
+}
+
 #endif /* Simulation_hpp */
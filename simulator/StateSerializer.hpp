@@ -0,0 +1,85 @@
+// StateSerializer.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Minimal binary serialization used for sim save states
+// Each sim backend provides the underlying stream since Verilator insists on owning the file itself
+
+#ifndef StateSerializer_hpp
+#define StateSerializer_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fstream>
+#include <string>
+#include <type_traits>
+
+class StateWriter {
+
+public:
+    virtual ~StateWriter() {}
+
+    virtual void write(const void *data, size_t length) = 0;
+
+    template <typename T>
+    void write_value(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be written directly");
+        write(&value, sizeof(T));
+    }
+};
+
+class StateReader {
+
+public:
+    virtual ~StateReader() {}
+
+    /// Returns false if the requested length couldn't be read.
+    virtual bool read(void *data, size_t length) = 0;
+
+    template <typename T>
+    bool read_value(T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be read directly");
+        return read(&value, sizeof(T));
+    }
+};
+
+class StateFileWriter: public StateWriter {
+
+public:
+    StateFileWriter(const std::string &path) : stream(path, std::ios::binary | std::ios::trunc) {}
+
+    void write(const void *data, size_t length) override {
+        stream.write((const char *)data, length);
+    }
+
+    bool good() const { return stream.good(); }
+
+    /// Flushes and closes the file, returning false if anything couldn't be written.
+    bool close() {
+        stream.close();
+        return !stream.fail();
+    }
+
+private:
+    std::ofstream stream;
+};
+
+class StateFileReader: public StateReader {
+
+public:
+    StateFileReader(const std::string &path) : stream(path, std::ios::binary) {}
+
+    bool read(void *data, size_t length) override {
+        stream.read((char *)data, length);
+        return stream.good();
+    }
+
+    bool good() const { return stream.good(); }
+
+private:
+    std::ifstream stream;
+};
+
+#endif /* StateSerializer_hpp */
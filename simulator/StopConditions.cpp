@@ -0,0 +1,190 @@
+// StopConditions.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "StopConditions.hpp"
+
+#include <cstdlib>
+#include <cctype>
+#include <iomanip>
+#include <iostream>
+
+static const char *action_name(StopConditions::Action action) {
+    switch (action) {
+        case StopConditions::Action::UNTIL:
+            return "until";
+        case StopConditions::Action::BREAK:
+            return "break";
+        case StopConditions::Action::EXIT_WITH_VALUE:
+            return "exit";
+    }
+
+    return "";
+}
+
+bool StopConditions::add(Action action, const std::string &spec) {
+    Condition condition;
+    condition.action = action;
+    condition.spec = spec;
+
+    size_t term_start = 0;
+    while (term_start <= spec.size()) {
+        size_t term_end = spec.find(',', term_start);
+        if (term_end == std::string::npos) {
+            term_end = spec.size();
+        }
+
+        Term term;
+        if (!parse_term(spec.substr(term_start, term_end - term_start), &term)) {
+            return false;
+        }
+
+        checks_pc |= term.trigger.kind == TraceTrigger::Kind::PC;
+        checks_write |= term.trigger.kind == TraceTrigger::Kind::WRITE;
+
+        condition.terms.push_back(term);
+        term_start = term_end + 1;
+    }
+
+    conditions.push_back(condition);
+    return true;
+}
+
+bool StopConditions::parse_term(const std::string &spec, Term *term) {
+    const std::string pc_prefix = "pc:";
+    const std::string write_prefix = "write:";
+
+    // Function names are only looked up once the ELF is loaded
+    bool is_symbol = spec.compare(0, pc_prefix.size(), pc_prefix) == 0 && spec.size() > pc_prefix.size() &&
+        !isdigit((unsigned char)spec[pc_prefix.size()]);
+
+    if (is_symbol) {
+        term->trigger.kind = TraceTrigger::Kind::PC;
+        term->symbol = spec.substr(pc_prefix.size());
+        return true;
+    }
+
+    size_t value_index = spec.find('=');
+    if (value_index == std::string::npos) {
+        return TraceTrigger::parse(spec, &term->trigger);
+    }
+
+    // Only writes can be matched against a value
+    if (spec.compare(0, write_prefix.size(), write_prefix) != 0) {
+        return false;
+    }
+
+    const std::string value = spec.substr(value_index + 1);
+    if (value.empty() || value[0] == '-') {
+        return false;
+    }
+
+    char *end = NULL;
+    uint64_t parsed_value = strtoull(value.c_str(), &end, 0);
+    if (*end != '\0' || parsed_value > UINT32_MAX) {
+        return false;
+    }
+
+    term->match_value = true;
+    term->value = parsed_value;
+
+    return TraceTrigger::parse(spec.substr(0, value_index), &term->trigger);
+}
+
+bool StopConditions::uses_symbols() const {
+    for (auto &condition : conditions) {
+        for (auto &term : condition.terms) {
+            if (!term.symbol.empty()) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool StopConditions::resolve_symbols(const ElfSymbols &symbols) {
+    bool resolved = true;
+
+    for (auto &condition : conditions) {
+        for (auto &term : condition.terms) {
+            if (term.symbol.empty()) {
+                continue;
+            }
+
+            auto symbol = symbols.find(term.symbol);
+            if (!symbol) {
+                std::cerr << "Function not found in ELF: " << term.symbol << std::endl;
+                resolved = false;
+                continue;
+            }
+
+            term.trigger.value = symbol->address;
+            term.symbol.clear();
+        }
+    }
+
+    return resolved;
+}
+
+void StopConditions::report(std::ostream &stream, const ElfSymbols *symbols) const {
+    if (!stopped()) {
+        return;
+    }
+
+    auto &condition = conditions[hit_index];
+
+    stream << "Stopped at cycle " << hit_cycle << " in frame " << frame_count
+        << " (" << action_name(condition.action) << " " << condition.spec << ")" << std::endl;
+
+    auto flags = stream.flags();
+    stream << std::hex << std::setfill('0');
+
+    stream << "PC: 0x" << std::setw(8) << hit_pc;
+
+    auto symbol = symbols ? symbols->lookup(hit_pc) : NULL;
+    if (symbol) {
+        stream << " (" << symbol->name << "+0x" << (hit_pc - symbol->address) << ")";
+    }
+
+    stream << std::endl;
+
+    if (hit_write_valid) {
+        stream << "Write: 0x" << std::setw(8) << hit_write.address << " = 0x" << std::setw(8) << hit_write.data
+            << " (wstrb 0x" << (int)hit_write.wstrb << ", value 0x" << hit_write.value() << ")" << std::endl;
+    }
+
+    stream.flags(flags);
+    stream << std::setfill(' ');
+}
+
+int StopConditions::exit_status() const {
+    if (stopped()) {
+        auto &condition = conditions[hit_index];
+
+        switch (condition.action) {
+            case Action::UNTIL:
+                return 0;
+            case Action::BREAK:
+                return BREAK_EXIT_STATUS;
+            case Action::EXIT_WITH_VALUE: {
+                uint32_t value = hit_write.value();
+                if (value == 0) {
+                    return 0;
+                }
+
+                return value < (uint32_t)(EXIT_VALUE_MAX_STATUS - EXIT_VALUE_BASE) ? EXIT_VALUE_BASE + (int)value : EXIT_VALUE_MAX_STATUS;
+            }
+        }
+    }
+
+    for (auto &condition : conditions) {
+        if (condition.action != Action::BREAK) {
+            return NOT_HIT_EXIT_STATUS;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+// StopConditions.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Conditions that end a run on an event rather than after a fixed number of cycles, for automated tests and benchmarks
+
+// A condition is one or more terms separated by commas, all of which must hold in the same cycle:
+// - frame:<n>                  frame n has started, counting from 0 at the start of the run as with --frame-dump
+// - cycle:<n>                  cycle n has been reached
+// - pc:<address>               instruction fetch from address
+// - pc:<function>              instruction fetch from the start of a function in the ELF
+// The RTL sims only see fetches, so a pc term can be hit by an instruction that is prefetched but never executed,
+// such as one following a taken branch. Write terms only match stores that actually happen.
+// - write:<address>            CPU write that includes the byte at address
+// - write:<address>=<value>    as above, only if the bytes written equal value
+// Frame and cycle terms stay true once reached, so "pc:draw_sprites,frame:100" stops at the first fetch from
+// draw_sprites in frame 100 or later
+// Numbers can be given in decimal or in hex with a 0x prefix
+
+#ifndef StopConditions_hpp
+#define StopConditions_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "Simulation.hpp"
+#include "TraceConfig.hpp"
+#include "ElfSymbols.hpp"
+
+class StopConditions {
+
+public:
+    enum class Action: uint8_t {
+        // Ends the run successfully
+        UNTIL,
+        // Ends the run with BREAK_EXIT_STATUS
+        BREAK,
+        // Ends the run with a status derived from the value written, for a "test done" store
+        EXIT_WITH_VALUE
+    };
+
+    static const int BREAK_EXIT_STATUS = 2;
+    // The run ended before an UNTIL or EXIT_WITH_VALUE condition was hit
+    static const int NOT_HIT_EXIT_STATUS = 3;
+
+    // EXIT_WITH_VALUE exits with 0 if 0 was written and EXIT_VALUE_BASE + value otherwise
+    // Values too large to fit all exit with EXIT_VALUE_MAX_STATUS, so a failing value is never mistaken for
+    // a pass or one of the statuses above
+    static const int EXIT_VALUE_BASE = 16;
+    static const int EXIT_VALUE_MAX_STATUS = 255;
+
+    /// Returns false if spec isn't a condition as described above.
+    bool add(Action action, const std::string &spec);
+
+    bool empty() const { return conditions.empty(); }
+
+    /// Returns true if any pc terms name a function rather than an address.
+    bool uses_symbols() const;
+
+    /// Resolves the function names used by pc terms, returning false if any of them aren't found.
+    bool resolve_symbols(const ElfSymbols &symbols);
+
+    /// Called by the sim once per cycle, returns true in the cycle a condition is first hit.
+    /// Nothing is checked once a condition is hit.
+    /// This is inlined into the clock loop of each sim, which has to include this header.
+    template <class SimulationT>
+    bool check(const SimulationT &sim, bool frame_completed);
+
+    bool stopped() const { return hit_index >= 0; }
+
+    /// Prints the condition that was hit and the CPU state at the time, with the PC symbolized if symbols are given.
+    void report(std::ostream &stream, const ElfSymbols *symbols) const;
+
+    /// Exit status for the run, which is 0 if no conditions are set.
+    int exit_status() const;
+
+private:
+    struct Term {
+        TraceTrigger trigger;
+
+        // Set for pc terms until resolve_symbols() is called
+        std::string symbol;
+
+        bool match_value = false;
+        uint32_t value = 0;
+    };
+
+    struct Condition {
+        Action action;
+        std::string spec;
+        std::vector<Term> terms;
+    };
+
+    std::vector<Condition> conditions;
+
+    // Only the state used by any of the terms is read from the sim
+    bool checks_pc = false;
+    bool checks_write = false;
+
+    uint64_t frame_count = 0;
+
+    // The state when a condition was hit
+    int hit_index = -1;
+    uint64_t hit_cycle = 0;
+    uint32_t hit_pc = 0;
+    bool hit_write_valid = false;
+    Simulation::CPUWrite hit_write = {0, 0, 0};
+
+    static bool parse_term(const std::string &spec, Term *term);
+
+    bool term_hit(const Term &term, uint64_t cycle, uint32_t pc, bool write_valid, const Simulation::CPUWrite &write) const {
+        switch (term.trigger.kind) {
+            case TraceTrigger::Kind::NONE:
+                return true;
+            case TraceTrigger::Kind::FRAME:
+                return frame_count >= term.trigger.value;
+            case TraceTrigger::Kind::CYCLE:
+                return cycle >= term.trigger.value;
+            case TraceTrigger::Kind::PC:
+                return term.symbol.empty() && pc == term.trigger.value;
+            case TraceTrigger::Kind::WRITE:
+                return write_valid && write.includes(term.trigger.value) && (!term.match_value || write.value() == term.value);
+        }
+
+        return false;
+    }
+};
+
+template <class SimulationT>
+bool StopConditions::check(const SimulationT &sim, bool frame_completed) {
+    if (stopped()) {
+        return false;
+    }
+
+    frame_count += frame_completed;
+
+    const uint64_t cycle = sim.cycle_count();
+    const uint32_t pc = checks_pc ? sim.SimulationT::cpu_pc() : 0;
+
+    Simulation::CPUWrite write = {0, 0, 0};
+    const bool write_valid = checks_write && sim.SimulationT::cpu_write(&write);
+
+    for (size_t i = 0; i < conditions.size(); i++) {
+        bool hit = true;
+        for (auto &term : conditions[i].terms) {
+            if (!term_hit(term, cycle, pc, write_valid, write)) {
+                hit = false;
+                break;
+            }
+        }
+
+        if (hit) {
+            hit_index = (int)i;
+            hit_cycle = cycle;
+            // The PC is read again in case it wasn't needed by any of the terms
+            hit_pc = sim.SimulationT::cpu_pc();
+            hit_write_valid = sim.SimulationT::cpu_write(&hit_write);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif /* StopConditions_hpp */
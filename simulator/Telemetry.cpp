@@ -0,0 +1,103 @@
+// Telemetry.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "Telemetry.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+bool Telemetry::open(const std::string &path) {
+    const std::string csv_extension = ".csv";
+    bool is_csv = path.size() >= csv_extension.size() &&
+        path.compare(path.size() - csv_extension.size(), csv_extension.size(), csv_extension) == 0;
+
+    format = is_csv ? Format::CSV : Format::JSONL;
+
+    stream.open(path, std::ios::trunc);
+    if (!stream.good()) {
+        std::cerr << "Failed to open telemetry file for writing: " << path << std::endl;
+        return false;
+    }
+
+    if (format == Format::CSV) {
+        stream << "frame,cycles,sim_ns,flash_ns,present_ns,audio_samples,frame_ns\n";
+    }
+
+    return stream.good();
+}
+
+bool Telemetry::record(const Frame &frame) {
+    if (format == Format::CSV) {
+        stream << frame.frame << ',' << frame.cycles << ','
+            << frame.sim_ns << ',' << frame.flash_ns << ',' << frame.present_ns << ','
+            << frame.audio_samples << ',' << frame.frame_ns << '\n';
+    } else {
+        stream << "{\"frame\":" << frame.frame
+            << ",\"cycles\":" << frame.cycles
+            << ",\"sim_ns\":" << frame.sim_ns
+            << ",\"flash_ns\":" << frame.flash_ns
+            << ",\"present_ns\":" << frame.present_ns
+            << ",\"audio_samples\":" << frame.audio_samples
+            << ",\"frame_ns\":" << frame.frame_ns << "}\n";
+    }
+
+    total_cycles += frame.cycles;
+    total_sim_ns += frame.sim_ns;
+    total_flash_ns += frame.flash_ns;
+    total_present_ns += frame.present_ns;
+    total_audio_samples += frame.audio_samples;
+    frame_times_ns.push_back(frame.frame_ns);
+
+    return stream.good();
+}
+
+bool Telemetry::close(uint64_t total_ns) {
+    double cycles_per_second = total_ns ? total_cycles * 1e9 / total_ns : 0;
+    double sim_cycles_per_second = total_sim_ns ? total_cycles * 1e9 / total_sim_ns : 0;
+    uint64_t frame_p50_ns = percentile(frame_times_ns, 50);
+    uint64_t frame_p99_ns = percentile(frame_times_ns, 99);
+
+    if (format == Format::JSONL) {
+        stream << "{\"summary\":{"
+            << "\"frames\":" << frame_times_ns.size()
+            << ",\"cycles\":" << total_cycles
+            << ",\"total_ns\":" << total_ns
+            << ",\"sim_ns\":" << total_sim_ns
+            << ",\"flash_ns\":" << total_flash_ns
+            << ",\"present_ns\":" << total_present_ns
+            << ",\"audio_samples\":" << total_audio_samples
+            << ",\"cycles_per_second\":" << (uint64_t)cycles_per_second
+            << ",\"sim_cycles_per_second\":" << (uint64_t)sim_cycles_per_second
+            << ",\"frame_p50_ns\":" << frame_p50_ns
+            << ",\"frame_p99_ns\":" << frame_p99_ns << "}}\n";
+    }
+
+    stream.close();
+
+    std::cout << "Telemetry: " << frame_times_ns.size() << " frames, "
+        << (uint64_t)cycles_per_second << " cycles/s (" << (uint64_t)sim_cycles_per_second << " in sim), "
+        << "frame time p50: " << frame_p50_ns / 1e6 << "ms, p99: " << frame_p99_ns / 1e6 << "ms" << std::endl;
+
+    if (stream.fail()) {
+        std::cerr << "Failed to write telemetry" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t Telemetry::percentile(std::vector<uint64_t> &values, uint32_t percent) {
+    if (values.empty()) {
+        return 0;
+    }
+
+    // Nearest-rank percentile
+    size_t rank = (values.size() * percent + 99) / 100;
+    size_t index = std::max<size_t>(rank, 1) - 1;
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+
+    return values[index];
+}
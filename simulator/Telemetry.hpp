@@ -0,0 +1,66 @@
+// Telemetry.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Per-frame performance counters of a sim session, written as JSON lines or CSV
+// Host times are split by where they were spent so that sim throughput can be compared across backends
+
+#ifndef Telemetry_hpp
+#define Telemetry_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+class Telemetry {
+
+public:
+    enum class Format {
+        JSONL, CSV
+    };
+
+    struct Frame {
+        uint64_t frame = 0;
+        // Simulated (clk_2x) cycles run during this frame
+        uint64_t cycles = 0;
+        // Host time spent in run_cycles(), which includes the flash model
+        uint64_t sim_ns = 0;
+        uint64_t flash_ns = 0;
+        // Host time the main thread spent uploading and presenting frames while this one ran, including any vsync wait
+        // Presenting runs alongside the sim so this overlaps sim_ns
+        uint64_t present_ns = 0;
+        // Stereo sample pairs produced
+        uint64_t audio_samples = 0;
+        // Host time since the previous frame completed
+        uint64_t frame_ns = 0;
+    };
+
+    /// The format is derived from the extension of path, CSV for ".csv" and JSON lines otherwise.
+    bool open(const std::string &path);
+
+    /// Writes a frame record. Returns false if it couldn't be written.
+    bool record(const Frame &frame);
+
+    /// Writes the end-of-run summary (JSON lines only) and prints it.
+    /// Throughput is derived from the total host time given here.
+    bool close(uint64_t total_ns);
+
+private:
+    std::ofstream stream;
+    Format format = Format::JSONL;
+
+    uint64_t total_cycles = 0;
+    uint64_t total_sim_ns = 0;
+    uint64_t total_flash_ns = 0;
+    uint64_t total_present_ns = 0;
+    uint64_t total_audio_samples = 0;
+
+    std::vector<uint64_t> frame_times_ns;
+
+    static uint64_t percentile(std::vector<uint64_t> &values, uint32_t percent);
+};
+
+#endif /* Telemetry_hpp */
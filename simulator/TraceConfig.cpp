@@ -0,0 +1,103 @@
+// TraceConfig.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "TraceConfig.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+static const struct {
+    TraceTrigger::Kind kind;
+    const char *name;
+} trigger_names[] = {
+    {TraceTrigger::Kind::FRAME, "frame"},
+    {TraceTrigger::Kind::CYCLE, "cycle"},
+    {TraceTrigger::Kind::PC, "pc"},
+    {TraceTrigger::Kind::WRITE, "write"}
+};
+
+bool TraceTrigger::parse(const std::string &spec, TraceTrigger *trigger) {
+    size_t separator_index = spec.find(':');
+    if (separator_index == std::string::npos) {
+        return false;
+    }
+
+    const std::string name = spec.substr(0, separator_index);
+    const std::string value = spec.substr(separator_index + 1);
+
+    if (value.empty()) {
+        return false;
+    }
+
+    char *end = NULL;
+    uint64_t parsed_value = strtoull(value.c_str(), &end, 0);
+    if (*end != '\0' || value[0] == '-') {
+        return false;
+    }
+
+    for (auto &trigger_name : trigger_names) {
+        if (name == trigger_name.name) {
+            trigger->kind = trigger_name.kind;
+            trigger->value = parsed_value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::string TraceTrigger::description() const {
+    for (auto &trigger_name : trigger_names) {
+        if (kind != trigger_name.kind) {
+            continue;
+        }
+
+        std::stringstream stream;
+        stream << trigger_name.name << ":";
+
+        if (kind == Kind::PC || kind == Kind::WRITE) {
+            stream << "0x" << std::hex;
+        }
+
+        stream << value;
+        return stream.str();
+    }
+
+    return "none";
+}
+
+bool TraceConfig::load_scopes(const std::string &path) {
+    std::ifstream stream(path);
+    if (!stream.good()) {
+        std::cerr << "Failed to open trace signal selection: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(stream, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+
+        size_t end = line.find_last_not_of(" \t\r");
+        scopes.push_back(line.substr(start, end - start + 1));
+    }
+
+    if (stream.bad()) {
+        std::cerr << "Failed to read trace signal selection: " << path << std::endl;
+        return false;
+    }
+
+    if (scopes.empty()) {
+        std::cerr << "No signals selected in trace signal selection: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
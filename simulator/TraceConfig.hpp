@@ -0,0 +1,58 @@
+// TraceConfig.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Settings for waveform tracing in trace builds (VCD_WRITE): the output path, the triggers that start and stop
+// tracing and the parts of the design to include
+
+// Triggers are checked once per (clk_2x) cycle:
+// - frame:<n>      start of frame n, counting from 0 at the start of the run as with --frame-dump
+// - cycle:<n>      cycle n, as counted by Simulation::cycle_count()
+// - pc:<address>   instruction fetch from address
+// - write:<address> CPU write that includes the byte at address
+// Numbers can be given in decimal or in hex with a 0x prefix
+
+#ifndef TraceConfig_hpp
+#define TraceConfig_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct TraceTrigger {
+    enum class Kind: uint8_t {
+        // Always hit, or never hit if used as a stop trigger
+        NONE,
+        FRAME,
+        CYCLE,
+        PC,
+        WRITE
+    };
+
+    Kind kind = Kind::NONE;
+    uint64_t value = 0;
+
+    /// Returns false if spec isn't a trigger as described above.
+    static bool parse(const std::string &spec, TraceTrigger *trigger);
+
+    /// Trigger in the same form it's parsed from.
+    std::string description() const;
+};
+
+struct TraceConfig {
+    std::string path;
+
+    TraceTrigger start;
+    TraceTrigger stop;
+
+    // Dot separated hierarchy paths relative to ics32_tb (i.e. "ics32.vdp"), each selecting a module or signal and
+    // everything below it. Everything is traced if this is empty.
+    std::vector<std::string> scopes;
+
+    /// Reads scopes from a file with one per line. Empty lines and lines starting with # are skipped.
+    bool load_scopes(const std::string &path);
+};
+
+#endif /* TraceConfig_hpp */
@@ -0,0 +1,236 @@
+// VDPUsageProfiler.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "VDPUsageProfiler.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "lodepng.h"
+
+bool VDPUsageProfiler::open(const std::string &path, const std::string &heatmap_path) {
+    stream.open(path, std::ios::trunc);
+    if (!stream.good()) {
+        std::cerr << "Failed to open VDP usage profile for writing: " << path << std::endl;
+        return false;
+    }
+
+    this->heatmap_path = heatmap_path;
+
+    if (!heatmap_path.empty()) {
+        frame_sprite_column.assign((size_t)timing.v_total() * 3, 0);
+        frame_host_column.assign((size_t)timing.v_total() * 3, 0);
+    }
+
+    return true;
+}
+
+void VDPUsageProfiler::line_used(const Simulation::VDPLineUsage &usage) {
+    frame_stats.add(usage);
+
+    if (heatmap_path.empty() || usage.raster_y >= timing.v_total()) {
+        return;
+    }
+
+    bool sprites_dropped = usage.sprite_pixels_rendered < usage.sprite_pixels_hit;
+    heat_color(&frame_sprite_column[usage.raster_y * 3], usage.sprite_pixels_hit, usage.sprite_slots * 8, sprites_dropped, false);
+
+    bool writes_dropped = usage.host_writes_dropped > 0;
+    heat_color(&frame_host_column[usage.raster_y * 3], usage.host_writes, usage.host_slots, writes_dropped, true);
+}
+
+bool VDPUsageProfiler::end_frame(uint64_t frame) {
+    stream << "{\"frame\":" << frame << ",";
+    write_stats(stream, frame_stats);
+    stream << "}\n";
+
+    total_stats.add(frame_stats);
+    frame_stats = Stats();
+    frame_count++;
+
+    if (!heatmap_path.empty()) {
+        const size_t column_size = frame_sprite_column.size();
+
+        if (sprite_columns.size() < heatmap_max_frames * column_size) {
+            sprite_columns.insert(sprite_columns.end(), frame_sprite_column.begin(), frame_sprite_column.end());
+            host_columns.insert(host_columns.end(), frame_host_column.begin(), frame_host_column.end());
+        } else {
+            size_t offset = ((frame_count - 1) % heatmap_max_frames) * column_size;
+            std::copy(frame_sprite_column.begin(), frame_sprite_column.end(), sprite_columns.begin() + offset);
+            std::copy(frame_host_column.begin(), frame_host_column.end(), host_columns.begin() + offset);
+        }
+
+        std::fill(frame_sprite_column.begin(), frame_sprite_column.end(), 0);
+        std::fill(frame_host_column.begin(), frame_host_column.end(), 0);
+    }
+
+    return stream.good();
+}
+
+bool VDPUsageProfiler::close() {
+    // Partial last frame, as in FlashProfiler::close()
+    total_stats.add(frame_stats);
+
+    stream << "{\"summary\":{\"frames\":" << frame_count << ",";
+    write_stats(stream, total_stats);
+    stream << "}}\n";
+
+    stream.close();
+
+    const Stats &stats = total_stats;
+
+    std::cout << "VDP usage: " << frame_count << " frames, peak of " << stats.peak_sprite_pixels
+        << " sprite pixels on line " << stats.peak_line << " with slots for " << stats.peak_sprite_capacity << std::endl;
+    std::cout << "VDP usage: " << stats.sprite_pixels_dropped << " sprite pixels dropped over "
+        << stats.lines_dropping_sprites << " lines" << std::endl;
+
+    double host_percent = stats.host_slots ? stats.host_writes * 100.0 / stats.host_slots : 0;
+    std::cout << "VDP usage: " << stats.host_writes << " host VRAM writes using "
+        << std::fixed << std::setprecision(1) << host_percent << std::defaultfloat << "% of host slots, "
+        << stats.host_writes_dropped << " dropped while the affine layer had the bus" << std::endl;
+
+    bool heatmap_written = heatmap_path.empty() || write_heatmap();
+
+    if (stream.fail()) {
+        std::cerr << "Failed to write VDP usage profile" << std::endl;
+        return false;
+    }
+
+    return heatmap_written;
+}
+
+bool VDPUsageProfiler::write_heatmap() const {
+    if (frame_count == 0) {
+        std::cerr << "No frames were completed for the VDP usage heatmap" << std::endl;
+        return false;
+    }
+
+    const unsigned heatmap_frames = std::min<uint64_t>(frame_count, (uint64_t)heatmap_max_frames);
+    // Columns are stored in a ring once it's full, so the oldest is the one the next frame would have replaced
+    const unsigned oldest_column = frame_count % heatmap_frames;
+
+    if (frame_count > heatmap_max_frames) {
+        std::cout << "VDP usage heatmap: only the last " << heatmap_frames << " of " << frame_count
+            << " frames are shown" << std::endl;
+    }
+
+    // Short runs have their columns widened so that each half is still readable
+    const unsigned column_width = std::max<unsigned>(1, heatmap_min_half_width / heatmap_frames);
+    const unsigned half_width = heatmap_frames * column_width;
+
+    // Sprite columns, a grey separator and then the host write columns
+    const unsigned width = half_width * 2 + heatmap_separator_width;
+    const unsigned height = timing.v_total();
+
+    std::vector<uint8_t> rgb((size_t)width * height * 3, 0x40);
+
+    for (unsigned y = 0; y < height; y++) {
+        uint8_t *row = &rgb[(size_t)y * width * 3];
+
+        for (unsigned x = 0; x < half_width; x++) {
+            size_t column = (oldest_column + x / column_width) % heatmap_frames;
+            size_t column_offset = (column * height + y) * 3;
+
+            std::copy_n(&sprite_columns[column_offset], 3, &row[x * 3]);
+            std::copy_n(&host_columns[column_offset], 3, &row[(half_width + heatmap_separator_width + x) * 3]);
+        }
+    }
+
+    unsigned error = lodepng::encode(heatmap_path, rgb, width, height, LCT_RGB);
+    if (error) {
+        std::cerr << "Failed to write VDP usage heatmap: " << heatmap_path << ": " << lodepng_error_text(error) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void VDPUsageProfiler::heat_color(uint8_t *rgb, uint32_t used, uint32_t available, bool dropped, bool host) {
+    if (dropped) {
+        rgb[0] = 0xff;
+        rgb[1] = 0x00;
+        rgb[2] = 0x00;
+        return;
+    }
+
+    double fraction = available ? std::min(1.0, (double)used / available) : 0;
+
+    // Sprites go from black through green to yellow, host writes from black through blue to cyan
+    uint8_t low = std::min(1.0, fraction * 2) * 0xff;
+    uint8_t high = std::max(0.0, fraction * 2 - 1) * 0xff;
+
+    rgb[0] = host ? 0 : high;
+    rgb[1] = host ? high : low;
+    rgb[2] = host ? low : 0;
+}
+
+void VDPUsageProfiler::Stats::add(const Simulation::VDPLineUsage &usage) {
+    lines++;
+
+    sprites_hit += usage.sprites_hit;
+    sprite_pixels_hit += usage.sprite_pixels_hit;
+    sprite_pixels_rendered += usage.sprite_pixels_rendered;
+
+    if (usage.sprite_pixels_rendered < usage.sprite_pixels_hit) {
+        sprite_pixels_dropped += usage.sprite_pixels_hit - usage.sprite_pixels_rendered;
+        lines_dropping_sprites++;
+    }
+
+    if (usage.sprite_pixels_hit > peak_sprite_pixels) {
+        peak_sprite_pixels = usage.sprite_pixels_hit;
+        peak_sprite_capacity = usage.sprite_slots * 8;
+        peak_line = usage.raster_y;
+    }
+
+    layer_slots += usage.layer_slots;
+    sprite_slots += usage.sprite_slots;
+    host_slots += usage.host_slots;
+    affine_slots += usage.affine_slots;
+    host_writes += usage.host_writes;
+    host_writes_dropped += usage.host_writes_dropped;
+}
+
+void VDPUsageProfiler::Stats::add(const Stats &other) {
+    lines += other.lines;
+
+    sprites_hit += other.sprites_hit;
+    sprite_pixels_hit += other.sprite_pixels_hit;
+    sprite_pixels_rendered += other.sprite_pixels_rendered;
+    sprite_pixels_dropped += other.sprite_pixels_dropped;
+    lines_dropping_sprites += other.lines_dropping_sprites;
+
+    if (other.peak_sprite_pixels > peak_sprite_pixels) {
+        peak_sprite_pixels = other.peak_sprite_pixels;
+        peak_sprite_capacity = other.peak_sprite_capacity;
+        peak_line = other.peak_line;
+    }
+
+    layer_slots += other.layer_slots;
+    sprite_slots += other.sprite_slots;
+    host_slots += other.host_slots;
+    affine_slots += other.affine_slots;
+    host_writes += other.host_writes;
+    host_writes_dropped += other.host_writes_dropped;
+}
+
+void VDPUsageProfiler::write_stats(std::ostream &stream, const Stats &stats) {
+    stream << "\"lines\":" << stats.lines
+        << ",\"sprites_hit\":" << stats.sprites_hit
+        << ",\"sprite_pixels_hit\":" << stats.sprite_pixels_hit
+        << ",\"sprite_pixels_rendered\":" << stats.sprite_pixels_rendered
+        << ",\"sprite_pixels_dropped\":" << stats.sprite_pixels_dropped
+        << ",\"lines_dropping_sprites\":" << stats.lines_dropping_sprites
+        << ",\"peak_sprite_pixels\":" << stats.peak_sprite_pixels
+        << ",\"peak_sprite_capacity\":" << stats.peak_sprite_capacity
+        << ",\"peak_line\":" << stats.peak_line
+        << ",\"layer_slots\":" << stats.layer_slots
+        << ",\"sprite_slots\":" << stats.sprite_slots
+        << ",\"host_slots\":" << stats.host_slots
+        << ",\"affine_slots\":" << stats.affine_slots
+        << ",\"host_writes\":" << stats.host_writes
+        << ",\"host_writes_dropped\":" << stats.host_writes_dropped;
+}
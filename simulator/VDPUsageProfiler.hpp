@@ -0,0 +1,94 @@
+// VDPUsageProfiler.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Sprite and VRAM bus usage report built from the per-line usage reported by the sim
+// Lines are summarized per frame and written as JSON lines, with an optional heatmap of every line of recent frames
+
+// Heatmap layout: each frame is a column and each line of the frame is a row
+// The left half is sprite pixels rendered against the sprite slots available in the line (red if any were dropped)
+// The right half is host VRAM writes against the host slots available in the line (red if any were dropped)
+// Only the most recent heatmap_max_frames frames are kept, which bounds its memory use to about 6MB for long runs
+
+#ifndef VDPUsageProfiler_hpp
+#define VDPUsageProfiler_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "Simulation.hpp"
+#include "VDPTiming.hpp"
+
+class VDPUsageProfiler : public Simulation::VDPUsageSink {
+
+public:
+    VDPUsageProfiler(const VDPTiming &timing = VDPTiming::mode_configured()) : timing(timing) {}
+
+    /// The heatmap is only written if heatmap_path isn't empty.
+    bool open(const std::string &path, const std::string &heatmap_path);
+
+    void line_used(const Simulation::VDPLineUsage &usage) override;
+
+    /// Writes a record of the lines completed since the previous frame.
+    /// Returns false if it couldn't be written.
+    bool end_frame(uint64_t frame);
+
+    /// Writes the totals for the whole run, writes the heatmap and prints a summary.
+    bool close();
+
+private:
+    struct Stats {
+        uint64_t lines = 0;
+
+        uint64_t sprites_hit = 0;
+        uint64_t sprite_pixels_hit = 0;
+        uint64_t sprite_pixels_rendered = 0;
+        uint64_t sprite_pixels_dropped = 0;
+        uint64_t lines_dropping_sprites = 0;
+
+        // Line with the most sprite pixels hit, and the sprite pixels that line had slots for
+        uint16_t peak_sprite_pixels = 0;
+        uint16_t peak_sprite_capacity = 0;
+        uint16_t peak_line = 0;
+
+        uint64_t layer_slots = 0;
+        uint64_t sprite_slots = 0;
+        uint64_t host_slots = 0;
+        uint64_t affine_slots = 0;
+        uint64_t host_writes = 0;
+        uint64_t host_writes_dropped = 0;
+
+        void add(const Simulation::VDPLineUsage &usage);
+        void add(const Stats &other);
+    };
+
+    VDPTiming timing;
+    std::ofstream stream;
+
+    Stats frame_stats;
+    Stats total_stats;
+    uint64_t frame_count = 0;
+
+    std::string heatmap_path;
+    // RGB colors of each line in the current frame and of the most recent completed frames, for sprites and host writes
+    // Once heatmap_max_frames have been completed, each frame replaces the oldest one
+    std::vector<uint8_t> frame_sprite_column;
+    std::vector<uint8_t> frame_host_column;
+    std::vector<uint8_t> sprite_columns;
+    std::vector<uint8_t> host_columns;
+
+    static const unsigned heatmap_max_frames = 2048;
+    static const unsigned heatmap_min_half_width = 256;
+    static const unsigned heatmap_separator_width = 4;
+
+    bool write_heatmap() const;
+
+    static void heat_color(uint8_t *rgb, uint32_t used, uint32_t available, bool dropped, bool host);
+    static void write_stats(std::ostream &stream, const Stats &stats);
+};
+
+#endif /* VDPUsageProfiler_hpp */
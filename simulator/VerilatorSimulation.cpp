@@ -1,15 +1,55 @@
 #include "VerilatorSimulation.hpp"
+#include "StopConditions.hpp"
 
 #include <assert.h>
+#include <iostream>
+#include <fstream>
 
 #include "Vics32_tb__Syms.h"
 
+#include <verilated_save.h>
+
+#if VERILATOR_SIM_CONTEXT
+
+Vics32_tb *VerilatorSimulation::create_tb() {
+#if VCD_WRITE
+    // Signals can only be traced if this is set before the model is constructed, even if the trace starts later
+    contextp->traceEverOn(true);
+#endif
+
+    return new Vics32_tb(contextp.get());
+}
+
+void VerilatorSimulation::forward_cmd_args(int argc, const char *argv[]) {
+    contextp->commandArgs(argc, argv);
+}
+
+bool VerilatorSimulation::finished() const {
+    return contextp->gotFinish();
+}
+
+void VerilatorSimulation::set_time(uint64_t time) {
+    contextp->time(time);
+}
+
+#else
+
 // verilator specific: called by $time in Verilog
+// This is global, so the regression runner only runs one instance at a time with these versions
 static vluint64_t main_time = 0;
 double sc_time_stamp() {
     return main_time;
 }
 
+Vics32_tb *VerilatorSimulation::create_tb() {
+#if VCD_WRITE
+    // Signals can only be traced if this is set before the model is constructed, even if the trace starts later
+    Verilated::traceEverOn(true);
+#endif
+
+    return new Vics32_tb;
+}
+
 void VerilatorSimulation::forward_cmd_args(int argc, const char *argv[]) {
     Verilated::commandArgs(argc, argv);
 }
@@ -18,6 +58,12 @@ bool VerilatorSimulation::finished() const {
     return Verilated::gotFinish();
 }
 
+void VerilatorSimulation::set_time(uint64_t time) {
+    main_time = time;
+}
+
+#endif
+
 void VerilatorSimulation::preload_cpu_program(const std::vector<uint8_t> &program) {
     auto ram_0 = tb->ics32_tb->ics32->cpu_ram->cpu_ram_0->mem;
     auto ram_1 = tb->ics32_tb->ics32->cpu_ram->cpu_ram_1->mem;
@@ -29,8 +75,12 @@ void VerilatorSimulation::preload_cpu_program(const std::vector<uint8_t> &progra
     }
 }
 
+Simulation::RunResult VerilatorSimulation::run_cycles(uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) {
+    return run_cycles_loop(*this, cycles, frame_sink, audio_sink);
+}
+
 void VerilatorSimulation::step(uint64_t time) {
-    main_time = time;
+    set_time(time);
 
     tb->clk_1x = clk_1x;
     tb->clk_2x = clk_2x;
@@ -55,21 +105,52 @@ void VerilatorSimulation::step(uint64_t time) {
 
     tb->eval();
 
+#if SIM_FLASH_TLM
+    serve_flash_transaction();
+#endif
+
+    // The pin level model is still needed for the flash accesses made directly by the CPU
     auto flash_bb = tb->ics32_tb->flash;
     uint8_t out_en;
     uint8_t io = flash.update(flash_bb->csn, flash_bb->clk, flash_bb->in, &out_en);
     flash.check_conflicts(flash_bb->in_en);
 
+#if !SIM_FLASH_TLM
     tb->eval();
+#endif
 
     flash_bb->out = io;
     flash_bb->out_en = out_en;
 
 #if VCD_WRITE
-    trace_update(time);
+    if (trace_active) {
+        trace_update(time);
+    }
 #endif
 }
 
+#if SIM_FLASH_TLM
+
+void VerilatorSimulation::serve_flash_transaction() {
+    auto tlm_bb = tb->ics32_tb->ics32->flash_arbiter->flash_reader->flash_tlm;
+
+    if (!tlm_bb->valid) {
+        flash_transaction_served = false;
+        return;
+    }
+
+    if (flash_transaction_served && tlm_bb->address == flash_transaction_address) {
+        return;
+    }
+
+    tlm_bb->data = flash.read_transaction(tlm_bb->address, tlm_bb->size ? 4 : 2);
+
+    flash_transaction_served = true;
+    flash_transaction_address = tlm_bb->address;
+}
+
+#endif
+
 bool VerilatorSimulation::get_samples(int16_t *left, int16_t *right) {
     auto dac = tb->ics32_tb->audio;
     bool has_sample = dac->valid && dac->clk;
@@ -85,6 +166,93 @@ bool VerilatorSimulation::get_samples(int16_t *left, int16_t *right) {
     return has_sample;
 }
 
+// Save states:
+
+// Verilator owns the save state file so the remaining sim state is appended using its own serializer
+
+class VerilatedStateWriter: public StateWriter {
+
+public:
+    VerilatedStateWriter(VerilatedSerialize &os) : os(os) {}
+
+    void write(const void *data, size_t length) override {
+        os.write(data, length);
+    }
+
+private:
+    VerilatedSerialize &os;
+};
+
+class VerilatedStateReader: public StateReader {
+
+public:
+    VerilatedStateReader(VerilatedDeserialize &os) : os(os) {}
+
+    // Verilator closes the file on read errors and fills anything read past the end with zeros
+    // Truncated states are caught by the end marker checked by load_host_state()
+    bool read(void *data, size_t length) override {
+        if (!os.isOpen()) {
+            return false;
+        }
+
+        os.read(data, length);
+        return os.isOpen();
+    }
+
+private:
+    VerilatedDeserialize &os;
+};
+
+bool VerilatorSimulation::save_state(const std::string &path, const FrameSink &frame_sink) {
+    VerilatedSave os;
+    os.open(path.c_str());
+    if (!os.isOpen()) {
+        std::cerr << "Failed to open save state for writing: " << path << std::endl;
+        return false;
+    }
+
+    os << *tb;
+
+    VerilatedStateWriter writer(os);
+    flash.save_state(writer);
+    save_host_state(writer, frame_sink);
+
+    os.close();
+
+    // VerilatedSave has no error state, so the file is checked for the end of the host state instead
+    if (!host_state_written(path)) {
+        std::cerr << "Failed to write save state: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool VerilatorSimulation::load_state(const std::string &path, FrameSink &frame_sink) {
+    VerilatedRestore os;
+    os.open(path.c_str());
+    if (!os.isOpen()) {
+        std::cerr << "Failed to open save state for reading: " << path << std::endl;
+        return false;
+    }
+
+    os >> *tb;
+
+    VerilatedStateReader reader(os);
+    bool loaded = flash.load_state(reader) && load_host_state(reader, frame_sink);
+
+    os.close();
+
+    if (!loaded) {
+        std::cerr << "Failed to load save state: " << path << std::endl;
+        return false;
+    }
+
+    set_time(current_time);
+
+    return true;
+}
+
 #if VCD_WRITE
 
 void VerilatorSimulation::trace_update(uint64_t time) {
@@ -92,14 +260,43 @@ void VerilatorSimulation::trace_update(uint64_t time) {
     tfp->dump((vluint64_t)time);
 }
 
-void VerilatorSimulation::trace(const std::string &filename) {
-    Verilated::traceEverOn(true);
+void VerilatorSimulation::prepare_trace(const TraceConfig &config) {
+    tfp = std::unique_ptr<TraceFile>(new TraceFile);
+    trace_path = config.path;
 
-    tfp = std::unique_ptr<VerilatedVcdC>(new VerilatedVcdC);
+    // Scopes can only be selected at runtime with dumpvars(), otherwise the whole design is traced
+#if defined(VERILATOR_VERSION_INTEGER) && VERILATOR_VERSION_INTEGER >= 5000000
+    for (auto &scope : config.scopes) {
+        tfp->dumpvars(99, "ics32_tb." + scope);
+    }
+#else
+    if (!config.scopes.empty()) {
+        std::cerr << "Trace signal selection requires Verilator 5 or later, tracing all signals" << std::endl;
+    }
+#endif
 
     tb->trace(tfp.get(), 99);
-    tfp->open(filename.c_str());
-    assert(tfp->isOpen());
+}
+
+bool VerilatorSimulation::open_trace(const TraceConfig &config) {
+    tfp->open(config.path.c_str());
+
+    if (!tfp->isOpen()) {
+        std::cerr << "Failed to open trace for writing: " << config.path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool VerilatorSimulation::close_trace() {
+    // Verilator closes the file itself if a write fails, which is the only way the failure is reported
+    bool written = tfp->isOpen();
+    tfp->close();
+
+    // The FST writer reports nothing at all, so at least check the file has something in it
+    std::ifstream stream(trace_path, std::ios::binary | std::ios::ate);
+    return written && stream.good() && stream.tellg() > 0;
 }
 
 #endif
@@ -124,12 +321,86 @@ bool VerilatorSimulation::vsync() const {
     return tb->vga_vsync;
 }
 
+bool VerilatorSimulation::de() const {
+    return tb->vga_de;
+}
+
+bool VerilatorSimulation::vdp_write(VDPWrite *write) const {
+    auto monitor = tb->ics32_tb->vdp_monitor;
+    if (!monitor->valid) {
+        return false;
+    }
+
+    assert(write);
+
+    write->copper_ram = monitor->copper;
+    write->address = monitor->address;
+    write->data = monitor->data;
+
+    return true;
+}
+
+bool VerilatorSimulation::copper_step(CopperStep *step) const {
+    auto monitor = tb->ics32_tb->copper_monitor;
+    if (!monitor->valid) {
+        return false;
+    }
+
+    assert(step);
+
+    step->raster_x = monitor->raster_x;
+    step->raster_y = monitor->raster_y;
+    step->pc = monitor->pc;
+    step->word = monitor->word;
+    step->data = monitor->data;
+
+    return true;
+}
+
+bool VerilatorSimulation::vdp_line_usage(VDPLineUsage *usage) const {
+    auto monitor = tb->ics32_tb->vdp_usage_monitor;
+    if (!monitor->valid) {
+        return false;
+    }
+
+    assert(usage);
+
+    usage->raster_y = monitor->raster_y;
+    usage->sprites_hit = monitor->sprites_hit;
+    usage->sprite_pixels_hit = monitor->sprite_pixels_hit;
+    usage->sprite_pixels_rendered = monitor->sprite_rows * 8;
+    usage->layer_slots = monitor->layer_slots;
+    usage->sprite_slots = monitor->sprite_slots;
+    usage->host_slots = monitor->host_slots;
+    usage->affine_slots = monitor->affine_slots;
+    usage->host_writes = monitor->host_writes;
+    usage->host_writes_dropped = monitor->host_writes_dropped;
+
+    return true;
+}
+
+uint32_t VerilatorSimulation::cpu_pc() const {
+    return tb->ics32_tb->cpu_monitor->pc;
+}
+
+bool VerilatorSimulation::cpu_write(CPUWrite *write) const {
+    auto monitor = tb->ics32_tb->cpu_monitor;
+    if (!monitor->write_valid) {
+        return false;
+    }
+
+    assert(write);
+    write->address = monitor->write_address;
+    write->data = monitor->write_data;
+    write->wstrb = monitor->write_wstrb;
+
+    return true;
+}
+
 void VerilatorSimulation::final() {
     tb->final();
 
 #if VCD_WRITE
-    if (tfp) {
-        tfp->close();
-    }
+    end_trace();
 #endif
 }
@@ -6,23 +6,35 @@
 #include "Simulation.hpp"
 #include "obj_dir/Vics32_tb.h"
 
-#if VCD_WRITE
+#if VCD_WRITE && TRACE_FST
+#include <verilated_fst_c.h>
+#elif VCD_WRITE
 #include <verilated_vcd_c.h>
 #endif
 
-class VerilatorSimulation: public Simulation {
+// Verilator 4.200 and later keep the simulation time and $finish state in a VerilatedContext, so each instance has its
+// own and several can run at once
+// Older versions keep them in process wide state, so only one instance can be stepped at a time
+#if defined(VERILATOR_VERSION_INTEGER) && VERILATOR_VERSION_INTEGER >= 4200000
+#define VERILATOR_SIM_CONTEXT 1
+#else
+#define VERILATOR_SIM_CONTEXT 0
+#endif
+
+class VerilatorSimulation final: public Simulation {
 
 public:
-    VerilatorSimulation() : flash(Simulation::default_flash) {}
+    /// The flash model is copied, which shares its contents with flash rather than copying them.
+    VerilatorSimulation(const QSPIFlashSim &flash) : flash(flash) {}
 
     void forward_cmd_args(int argc, const char * argv[]) override;
 
     void preload_cpu_program(const std::vector<uint8_t> &program) override;
     void step(uint64_t time) override;
+    RunResult run_cycles(uint64_t cycles, FrameSink &frame_sink, AudioSink &audio_sink) override;
 
-#if VCD_WRITE
-    void trace(const std::string &filename) override;
-#endif
+    bool save_state(const std::string &path, const FrameSink &frame_sink) override;
+    bool load_state(const std::string &path, FrameSink &frame_sink) override;
 
     uint8_t r() const override;
     uint8_t g() const override;
@@ -30,20 +42,58 @@ public:
 
     bool hsync() const override;
     bool vsync() const override;
+    bool de() const override;
+
+    bool vdp_write(VDPWrite *write) const override;
+    bool copper_step(CopperStep *step) const override;
+    bool vdp_line_usage(VDPLineUsage *usage) const override;
+
+    uint32_t cpu_pc() const override;
+    bool cpu_write(CPUWrite *write) const override;
 
     bool get_samples(int16_t *left, int16_t *right) override;
 
+    QSPIFlashSim &flash_model() override { return flash; }
+
     void final() override;
 
     bool finished() const override;
     
 private:
-    std::unique_ptr<Vics32_tb> tb = std::unique_ptr<Vics32_tb>(new Vics32_tb);
+#if VERILATOR_SIM_CONTEXT
+    // Declared before tb so that it's constructed first and destroyed last
+    std::unique_ptr<VerilatedContext> contextp = std::unique_ptr<VerilatedContext>(new VerilatedContext);
+#endif
+
+    Vics32_tb *create_tb();
+    void set_time(uint64_t time);
+
+    std::unique_ptr<Vics32_tb> tb = std::unique_ptr<Vics32_tb>(create_tb());
     QSPIFlashSim flash;
 
+#if SIM_FLASH_TLM
+    // Address of the transaction level read that was last served, if it's still active
+    bool flash_transaction_served = false;
+    uint32_t flash_transaction_address = 0;
+
+    void serve_flash_transaction();
+#endif
+
 #if VCD_WRITE
-    std::unique_ptr<VerilatedVcdC> tfp;
+    // FST if the sim was built with --trace-fst, which is much smaller and faster to write than VCD
+#if TRACE_FST
+    typedef VerilatedFstC TraceFile;
+#else
+    typedef VerilatedVcdC TraceFile;
+#endif
+
+    std::unique_ptr<TraceFile> tfp;
+    std::string trace_path;
     void trace_update(uint64_t time);
+
+    void prepare_trace(const TraceConfig &config) override;
+    bool open_trace(const TraceConfig &config) override;
+    bool close_trace() override;
 #endif
 };
 
@@ -0,0 +1,264 @@
+// VideoWriter.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "VideoWriter.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+VideoWriter::VideoWriter(size_t queue_size) :
+    queue(std::max<size_t>(1, queue_size)),
+    yuv_table(1 << 12)
+{
+    for (uint32_t color = 0; color < yuv_table.size(); color++) {
+        uint8_t r = (color >> 8 & 0xf) * 0x11;
+        uint8_t g = (color >> 4 & 0xf) * 0x11;
+        uint8_t b = (color & 0xf) * 0x11;
+
+        yuv_table[color] = yuv_from_rgb(r, g, b);
+    }
+}
+
+VideoWriter::~VideoWriter() {
+    close();
+}
+
+VideoWriter::Format VideoWriter::format_for_path(const std::string &path) {
+    const std::string rgb_extension = ".rgb";
+
+    bool is_rgb = path.size() > rgb_extension.size() &&
+        path.compare(path.size() - rgb_extension.size(), rgb_extension.size(), rgb_extension) == 0;
+
+    return is_rgb ? Format::RGB : Format::Y4M;
+}
+
+bool VideoWriter::open(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to open video file for writing: " << path << std::endl;
+        return false;
+    }
+
+    return open(file, format_for_path(path));
+}
+
+bool VideoWriter::open(FILE *file, Format format) {
+    if (!file) {
+        std::cerr << "Failed to open video stream for writing" << std::endl;
+        return false;
+    }
+
+    // Buffering is left to the writer thread, which writes whole frames at a time
+    setvbuf(file, NULL, _IONBF, 0);
+
+    this->file = file;
+    output_format = format;
+
+    return start();
+}
+
+void VideoWriter::set_frame_rate(uint32_t numerator, uint32_t denominator) {
+    // Reduced so the header shows a recognizable rate where possible
+    uint32_t a = numerator, b = denominator;
+    while (b != 0) {
+        uint32_t remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+
+    uint32_t divisor = std::max<uint32_t>(1, a);
+    rate_numerator = numerator / divisor;
+    rate_denominator = denominator / divisor;
+}
+
+bool VideoWriter::start() {
+    stopping = false;
+    write_failed = false;
+    queue_head = 0;
+    queue_count = 0;
+
+    thread = std::thread(&VideoWriter::write_loop, this);
+    running = true;
+
+    return true;
+}
+
+bool VideoWriter::write(const FrameSink &frame_sink) {
+    if (!running) {
+        return false;
+    }
+
+    if (width == 0) {
+        width = frame_sink.frame_width();
+        height = frame_sink.frame_height();
+    } else if (frame_sink.frame_width() != width || frame_sink.frame_height() != height) {
+        std::cerr << "Video frame size changed from " << width << "x" << height << " to "
+            << frame_sink.frame_width() << "x" << frame_sink.frame_height() << ", which can't be streamed" << std::endl;
+        return false;
+    }
+
+    size_t tail = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (queue_count == queue.size()) {
+            frames_waited++;
+            condition.wait(lock, [this] { return queue_count < queue.size(); });
+        }
+
+        if (write_failed) {
+            return false;
+        }
+
+        tail = (queue_head + queue_count) % queue.size();
+    }
+
+    // The copy is made without holding the lock since the writer thread doesn't touch this buffer until it's queued
+    Frame &frame = queue[tail];
+    const uint32_t *pixels = frame_sink.pixels();
+    frame.pixels.assign(pixels, pixels + width * height);
+    frame.hash = frame_sink.frame_hash();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue_count++;
+    }
+
+    condition.notify_all();
+
+    return true;
+}
+
+bool VideoWriter::close() {
+    if (!running) {
+        return !write_failed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_all();
+    thread.join();
+    running = false;
+
+    if (fclose(file) != 0) {
+        write_failed = true;
+    }
+
+    file = NULL;
+
+    std::cout << "Video: " << frames_written << " frames of " << width << "x" << height << " at "
+        << rate_numerator << "/" << rate_denominator << " fps, " << frames_waited << " waited on the writer" << std::endl;
+
+    if (write_failed) {
+        std::cerr << "Failed to write video" << std::endl;
+    }
+
+    return !write_failed;
+}
+
+void VideoWriter::write_loop() {
+    bool header_written = false;
+
+    while (true) {
+        size_t head = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return queue_count > 0 || stopping; });
+
+            if (queue_count == 0) {
+                break;
+            }
+
+            head = queue_head;
+        }
+
+        const Frame &frame = queue[head];
+
+        bool written = true;
+        if (!write_failed) {
+            if (!header_written) {
+                written = write_header();
+                header_written = true;
+            }
+
+            // Frames identical to the previously written one are written again without being converted
+            if (encoded_frame.empty() || frame.hash != encoded_frame_hash) {
+                encode(frame);
+                encoded_frame_hash = frame.hash;
+            }
+
+            written = written && fwrite(encoded_frame.data(), 1, encoded_frame.size(), file) == encoded_frame.size();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // Queued frames are still taken after a failure so the sim thread is never left waiting on them
+            write_failed |= !written;
+            frames_written += !write_failed;
+
+            queue_head = (queue_head + 1) % queue.size();
+            queue_count--;
+        }
+
+        condition.notify_all();
+    }
+}
+
+bool VideoWriter::write_header() {
+    if (output_format != Format::Y4M) {
+        return true;
+    }
+
+    std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height)
+        + " F" + std::to_string(rate_numerator) + ":" + std::to_string(rate_denominator)
+        + " Ip A1:1 C444 XCOLORRANGE=LIMITED\n";
+
+    return fwrite(header.data(), 1, header.size(), file) == header.size();
+}
+
+void VideoWriter::encode(const Frame &frame) {
+    const size_t pixel_count = width * height;
+
+    if (output_format == Format::RGB) {
+        encoded_frame.resize(pixel_count * 3);
+        FrameSink::rgb24_from_argb32(frame.pixels.data(), pixel_count, encoded_frame.data());
+        return;
+    }
+
+    static const char frame_header[] = "FRAME\n";
+    const size_t header_size = sizeof(frame_header) - 1;
+
+    encoded_frame.resize(header_size + pixel_count * 3);
+    std::copy(frame_header, frame_header + header_size, encoded_frame.begin());
+
+    uint8_t *y_plane = &encoded_frame[header_size];
+    uint8_t *u_plane = y_plane + pixel_count;
+    uint8_t *v_plane = u_plane + pixel_count;
+
+    for (size_t i = 0; i < pixel_count; i++) {
+        // The low 4 bits of each component are copies of the high 4 bits
+        uint32_t pixel = frame.pixels[i];
+        uint32_t color = (pixel >> 12 & 0xf00) | (pixel >> 8 & 0x0f0) | (pixel >> 4 & 0x00f);
+        uint32_t yuv = yuv_table[color];
+
+        y_plane[i] = yuv >> 16;
+        u_plane[i] = yuv >> 8;
+        v_plane[i] = yuv;
+    }
+}
+
+uint32_t VideoWriter::yuv_from_rgb(uint8_t r, uint8_t g, uint8_t b) {
+    // BT.601 limited range
+    int y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    int u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    int v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+
+    return (uint32_t)y << 16 | (uint32_t)u << 8 | (uint32_t)v;
+}
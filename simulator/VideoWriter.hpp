@@ -0,0 +1,114 @@
+// VideoWriter.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Streams completed frames as uncompressed video, either YUV4MPEG2 (.y4m) or headerless RGB24 (.rgb)
+// Both can be read by ffmpeg and the like, and Y4M carries its own frame size and rate so it can also be piped
+
+// Frames are copied into a fixed number of queued buffers and then converted and written from a dedicated thread,
+// so the sim thread only waits on disk I/O if the writer falls behind by the whole queue
+// Frames aren't dropped since every frame is needed to keep the video in sync with any captured audio
+
+// Y4M frames are 4:4:4 BT.601 limited range, converted using a table of every 12-bit color the VDP can output
+
+#ifndef VideoWriter_hpp
+#define VideoWriter_hpp
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "FrameSink.hpp"
+
+class VideoWriter {
+
+public:
+    enum class Format {
+        Y4M, RGB
+    };
+
+    /// Queue size is given in frames.
+    VideoWriter(size_t queue_size = 8);
+    ~VideoWriter();
+
+    VideoWriter(const VideoWriter &) = delete;
+    VideoWriter& operator=(const VideoWriter &) = delete;
+
+    /// Raw RGB is written if path has an .rgb extension and Y4M otherwise.
+    static Format format_for_path(const std::string &path);
+
+    /// Creates the file at path, overwriting any existing one, and starts the writer thread.
+    bool open(const std::string &path);
+
+    /// Takes ownership of an already open file, such as a duplicate of stdout.
+    bool open(FILE *file, Format format);
+
+    /// Frame rate as a fraction, written in the Y4M header. Must be set before the first frame.
+    void set_frame_rate(uint32_t numerator, uint32_t denominator);
+
+    /// Sim thread: queues a copy of the frame to be written, only waiting if the queue is full.
+    /// The size of the first frame is used for the rest of the video.
+    /// Returns false if an earlier frame couldn't be written.
+    bool write(const FrameSink &frame_sink);
+
+    /// Writes out any queued frames, closes the file and prints a summary.
+    bool close();
+
+    Format format() const { return output_format; }
+
+private:
+    struct Frame {
+        std::vector<uint32_t> pixels;
+        uint64_t hash = 0;
+    };
+
+    FILE *file = NULL;
+    Format output_format = Format::Y4M;
+
+    uint32_t rate_numerator = 60;
+    uint32_t rate_denominator = 1;
+
+    size_t width = 0, height = 0;
+
+    // Frames from queue_head onwards are owned by the writer thread, the rest by the sim thread
+    // queue_head and queue_count are only changed while holding the mutex
+    std::vector<Frame> queue;
+    size_t queue_head = 0;
+    size_t queue_count = 0;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    bool stopping = false;
+    bool running = false;
+    bool write_failed = false;
+
+    uint64_t frames_written = 0;
+    // Frames that had to wait for the writer thread to free up a buffer
+    uint64_t frames_waited = 0;
+
+    // Only accessed by the writer thread
+    // The encoded bytes of the last frame are reused as long as the frame hash doesn't change
+    std::vector<uint8_t> encoded_frame;
+    uint64_t encoded_frame_hash = 0;
+
+    // Packed Y, U and V of each 12-bit color
+    std::vector<uint32_t> yuv_table;
+
+    bool start();
+    void write_loop();
+
+    bool write_header();
+    void encode(const Frame &frame);
+
+    static uint32_t yuv_from_rgb(uint8_t r, uint8_t g, uint8_t b);
+};
+
+#endif /* VideoWriter_hpp */
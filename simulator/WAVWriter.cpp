@@ -0,0 +1,81 @@
+// WAVWriter.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "WAVWriter.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+WAVWriter::~WAVWriter() {
+    close();
+}
+
+bool WAVWriter::open(const std::string &path, uint32_t sample_rate) {
+    auto open_status = tinywav_open_write(
+        &tw,
+        2,
+        sample_rate,
+        TW_INT16,
+        TW_INTERLEAVED,
+        path.c_str()
+    );
+
+    if (open_status) {
+        std::cerr << "Failed to open WAV file for writing: " << path << std::endl;
+        return false;
+    }
+
+    is_open = true;
+    write_failed = false;
+    block_count = 0;
+
+    return true;
+}
+
+bool WAVWriter::write(const int16_t *samples, size_t count) {
+    if (!is_open || write_failed) {
+        return false;
+    }
+
+    while (count > 0) {
+        size_t copy_count = std::min(count, block.size() - block_count);
+        std::copy(samples, samples + copy_count, block.begin() + block_count);
+
+        block_count += copy_count;
+        samples += copy_count;
+        count -= copy_count;
+
+        if (block_count == block.size() && !flush()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool WAVWriter::close() {
+    if (!is_open) {
+        return !write_failed;
+    }
+
+    flush();
+    tinywav_close_write(&tw);
+    is_open = false;
+
+    return !write_failed;
+}
+
+bool WAVWriter::flush() {
+    size_t written = tinywav_write_i16(&tw, block.data(), (int)(block_count / 2));
+
+    if (written != block_count) {
+        std::cerr << "Failed to write WAV samples" << std::endl;
+        write_failed = true;
+    }
+
+    block_count = 0;
+    return !write_failed;
+}
@@ -0,0 +1,50 @@
+// WAVWriter.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Streams interleaved stereo int16 samples to a WAV file as the sim runs
+// Samples are written in fixed size blocks so memory use doesn't grow with the length of the capture
+
+#ifndef WAVWriter_hpp
+#define WAVWriter_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "tinywav.h"
+
+class WAVWriter {
+
+public:
+    /// Block size is given in stereo sample pairs.
+    WAVWriter(size_t block_size = 16384) : block(block_size * 2) {}
+    ~WAVWriter();
+
+    WAVWriter(const WAVWriter &) = delete;
+    WAVWriter& operator=(const WAVWriter &) = delete;
+
+    /// Creates the file at path, overwriting any existing one.
+    bool open(const std::string &path, uint32_t sample_rate = 44100);
+
+    /// Appends interleaved samples (left, right, left, right...), writing out any completed blocks.
+    /// Returns false if a block couldn't be written.
+    bool write(const int16_t *samples, size_t count);
+
+    /// Writes out remaining samples and patches the header with the final length.
+    bool close();
+
+private:
+    TinyWav tw;
+    bool is_open = false;
+    bool write_failed = false;
+
+    std::vector<int16_t> block;
+    size_t block_count = 0;
+
+    bool flush();
+};
+
+#endif /* WAVWriter_hpp */
@@ -0,0 +1,289 @@
+// copper_view.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Viewer for copper traces written by the sim with --copper-trace
+// Summarizes copper busy time per line, register writes that landed in the active display, missed targets and waits
+// that last until the next frame
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <getopt.h>
+#include <cstdlib>
+
+#include "lodepng.h"
+
+#include "CopperTrace.hpp"
+
+enum LongOption {
+    OPT_FRAME = 0x100,
+    OPT_PNG
+};
+
+static const struct option long_options[] = {
+    {"frame", required_argument, NULL, OPT_FRAME},
+    {"png", required_argument, NULL, OPT_PNG},
+    {NULL, 0, NULL, 0}
+};
+
+struct LineStats {
+    // Each op and data word takes one cycle to execute
+    uint32_t busy_cycles = 0;
+    uint32_t ops = 0;
+    uint32_t writes = 0;
+    // Writes made after the horizontal blank ended, which can visibly change the line mid-way
+    uint32_t active_writes = 0;
+    uint16_t first_x = 0;
+    uint16_t last_x = 0;
+    std::vector<CopperTraceRecord> missed_targets;
+    std::vector<CopperTraceRecord> next_frame_waits;
+};
+
+struct FrameStats {
+    std::map<uint16_t, LineStats> lines;
+};
+
+static void print_frame_summary(uint32_t frame, const FrameStats &stats) {
+    uint32_t busy_cycles = 0, writes = 0, active_writes = 0, missed_targets = 0, next_frame_waits = 0;
+    uint32_t max_busy_cycles = 0;
+    uint16_t max_busy_line = 0;
+
+    for (auto &line : stats.lines) {
+        busy_cycles += line.second.busy_cycles;
+        writes += line.second.writes;
+        active_writes += line.second.active_writes;
+        missed_targets += line.second.missed_targets.size();
+        next_frame_waits += line.second.next_frame_waits.size();
+
+        if (line.second.busy_cycles > max_busy_cycles) {
+            max_busy_cycles = line.second.busy_cycles;
+            max_busy_line = line.first;
+        }
+    }
+
+    std::cout << "frame " << frame << ": " << stats.lines.size() << " lines, "
+        << busy_cycles << " busy cycles (max " << max_busy_cycles << " on line " << max_busy_line << "), "
+        << writes << " writes (" << active_writes << " during active display), "
+        << missed_targets << " missed targets, " << next_frame_waits << " waits for the next frame" << std::endl;
+}
+
+static void print_frame_lines(uint32_t frame, const FrameStats &stats) {
+    std::cout << std::endl;
+    std::cout << "frame " << frame << ":" << std::endl;
+    std::cout << "  line   busy    ops  writes  active  x range" << std::endl;
+
+    for (auto &entry : stats.lines) {
+        const LineStats &line = entry.second;
+
+        std::cout << "  " << std::setw(4) << entry.first
+            << std::setw(7) << line.busy_cycles
+            << std::setw(7) << line.ops
+            << std::setw(8) << line.writes
+            << std::setw(8) << line.active_writes
+            << "  " << line.first_x << "-" << line.last_x << std::endl;
+
+        for (auto &record : line.missed_targets) {
+            std::cout << "        missed target: wait at pc 0x" << std::hex << std::setfill('0') << std::setw(3) << record.pc
+                << " (op 0x" << std::setw(4) << record.word << std::dec << std::setfill(' ')
+                << ") at x " << record.raster_x << " targets a position already passed or out of range" << std::endl;
+        }
+
+        for (auto &record : line.next_frame_waits) {
+            std::cout << "        next frame: wait at pc 0x" << std::hex << std::setfill('0') << std::setw(3) << record.pc
+                << " (op 0x" << std::setw(4) << record.word << std::dec << std::setfill(' ')
+                << ") at x " << record.raster_x << " is never reached this frame" << std::endl;
+        }
+    }
+}
+
+static bool write_timeline_png(const std::string &path, const std::vector<CopperTraceRecord> &records, const VDPTiming &timing) {
+    const unsigned width = timing.h_total();
+    const unsigned height = timing.v_total();
+
+    std::vector<uint8_t> rgba((size_t)width * height * 4);
+
+    auto plot = [&] (uint16_t x, uint16_t y, uint32_t color) {
+        if (x >= width || y >= height) {
+            return;
+        }
+
+        uint8_t *pixel = &rgba[((size_t)y * width + x) * 4];
+        pixel[0] = color >> 16;
+        pixel[1] = color >> 8;
+        pixel[2] = color;
+        pixel[3] = 0xff;
+    };
+
+    // Blanking is black and the active display is dark grey
+    for (unsigned y = 0; y < height; y++) {
+        for (unsigned x = 0; x < width; x++) {
+            plot(x, y, timing.active_display(x, y) ? 0x303030 : 0x000000);
+        }
+    }
+
+    for (auto &record : records) {
+        uint32_t color = 0x8080ff;
+
+        if (record.flags & CopperTraceRecord::WRITE) {
+            color = timing.active_display(record.raster_x, record.raster_y) ? 0xff4040 : 0x40ff40;
+        }
+
+        if (record.flags & CopperTraceRecord::MISSED_TARGET) {
+            // The rest of the line is highlighted so that single pixel misses stand out
+            for (uint16_t x = record.raster_x; x < width; x++) {
+                plot(x, record.raster_y, 0x600060);
+            }
+
+            color = 0xff00ff;
+        } else if (record.flags & CopperTraceRecord::WAIT_NEXT_FRAME) {
+            color = 0x00e0e0;
+        }
+
+        plot(record.raster_x, record.raster_y, color);
+    }
+
+    unsigned error = lodepng::encode(path, rgba, width, height);
+    if (error) {
+        std::cerr << "Failed to write PNG: " << path << ": " << lodepng_error_text(error) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        std::cout << "Usage: copper_view [options] <trace>" << std::endl;
+        std::cout << std::endl;
+        std::cout << "  --frame <n>              Show copper activity on each line of frame <n>" << std::endl;
+        std::cout << "  --png <path>             Write a timeline of the frame as a PNG with a pixel per cycle (default: frame 0)" << std::endl;
+        std::cout << std::endl;
+        std::cout << "Timeline colors: ops are blue, register writes are green in the blank and red during active display," << std::endl;
+        std::cout << "missed targets are magenta and waits for the next frame are cyan" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    int64_t selected_frame = -1;
+    std::string png_path = "";
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, (char **)argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case OPT_FRAME:
+                selected_frame = strtoll(optarg, NULL, 10);
+                if (selected_frame < 0) {
+                    std::cerr << "--frame argument must be a positive integer" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_PNG:
+                png_path = optarg;
+                if (png_path.empty()) {
+                    std::cerr << "PNG path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case '?':
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cerr << "Expected trace path after any options" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!png_path.empty() && selected_frame < 0) {
+        selected_frame = 0;
+    }
+
+    CopperTraceReader reader;
+    if (!reader.open(argv[optind])) {
+        return EXIT_FAILURE;
+    }
+
+    const VDPTiming &timing = reader.video_timing();
+
+    // Only one frame is held at a time, apart from the records of the selected frame for the timeline
+
+    FrameStats frame_stats;
+    uint32_t current_frame = 0;
+    bool frame_pending = false;
+    bool selected_frame_found = false;
+
+    FrameStats selected_stats;
+    std::vector<CopperTraceRecord> selected_records;
+
+    auto end_frame = [&] {
+        print_frame_summary(current_frame, frame_stats);
+
+        if ((int64_t)current_frame == selected_frame) {
+            selected_stats = frame_stats;
+            selected_frame_found = true;
+        }
+
+        frame_stats = FrameStats();
+    };
+
+    CopperTraceRecord record;
+    while (reader.read(&record)) {
+        if (frame_pending && record.frame != current_frame) {
+            end_frame();
+        }
+
+        current_frame = record.frame;
+        frame_pending = true;
+
+        LineStats &line = frame_stats.lines[record.raster_y];
+        if (line.busy_cycles == 0) {
+            line.first_x = record.raster_x;
+        }
+
+        line.busy_cycles++;
+        line.last_x = record.raster_x;
+        line.ops += !(record.flags & CopperTraceRecord::DATA);
+
+        if (record.flags & CopperTraceRecord::WRITE) {
+            line.writes++;
+            line.active_writes += timing.active_display(record.raster_x, record.raster_y);
+        }
+
+        if (record.flags & CopperTraceRecord::MISSED_TARGET) {
+            line.missed_targets.push_back(record);
+        } else if (record.flags & CopperTraceRecord::WAIT_NEXT_FRAME) {
+            line.next_frame_waits.push_back(record);
+        }
+
+        if ((int64_t)record.frame == selected_frame) {
+            selected_records.push_back(record);
+        }
+    }
+
+    if (frame_pending) {
+        end_frame();
+    } else {
+        std::cout << "No copper ops were traced" << std::endl;
+    }
+
+    if (selected_frame < 0) {
+        return EXIT_SUCCESS;
+    }
+
+    if (!selected_frame_found) {
+        std::cerr << "Frame " << selected_frame << " not found in trace" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    print_frame_lines(selected_frame, selected_stats);
+
+    if (!png_path.empty() && !write_timeline_png(png_path, selected_records, timing)) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
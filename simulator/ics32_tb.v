@@ -6,6 +6,8 @@
 
 `default_nettype none
 
+`include "vram_slot_encoding.vh"
+
 module ics32_tb(
     input clk_1x,
     input clk_2x,
@@ -38,10 +40,21 @@ module ics32_tb(
     input btn_select,
     input btn_start
 );
+    // Selected with VIDEO_MODE in the Makefile
+`ifdef SIM_VIDEO_MODE_640x480
+    localparam ENABLE_WIDESCREEN = 0;
+    localparam CLK_1X_FREQ = `CLK_1X_STANDARD;
+    localparam CLK_2X_FREQ = `CLK_2X_STANDARD;
+`else
+    localparam ENABLE_WIDESCREEN = 1;
+    localparam CLK_1X_FREQ = `CLK_1X_WIDESCREEN;
+    localparam CLK_2X_FREQ = `CLK_2X_WIDESCREEN;
+`endif
+
     ics32 #(
-        .CLK_1X_FREQ(`CLK_1X_WIDESCREEN),
-        .CLK_2X_FREQ(`CLK_2X_WIDESCREEN),
-        .ENABLE_WIDESCREEN(1),
+        .CLK_1X_FREQ(CLK_1X_FREQ),
+        .CLK_2X_FREQ(CLK_2X_FREQ),
+        .ENABLE_WIDESCREEN(ENABLE_WIDESCREEN),
         .ENABLE_FAST_CPU(0),
         .RESET_DURATION_EXPONENT(2),
         .ADPCM_STEP_LUT_PATH("../hardware/adpcm_step_lut.hex"),
@@ -84,7 +97,32 @@ module ics32_tb(
 
         .audio_output_valid(audio_valid),
         .audio_output_l(audio_l),
-        .audio_output_r(audio_r)
+        .audio_output_r(audio_r),
+
+        .sim_vdp_write_en(sim_vdp_write_en),
+        .sim_vdp_write_address(sim_vdp_write_address),
+        .sim_cop_ram_write_en(sim_cop_ram_write_en),
+        .sim_cop_ram_write_address(sim_cop_ram_write_address),
+        .sim_write_data(sim_write_data),
+
+        .sim_cpu_pc(sim_cpu_pc),
+        .sim_cpu_write_valid(sim_cpu_write_valid),
+        .sim_cpu_write_address(sim_cpu_write_address),
+        .sim_cpu_write_data(sim_cpu_write_data),
+        .sim_cpu_write_wstrb(sim_cpu_write_wstrb),
+
+        .sim_cop_op_valid(sim_cop_op_valid),
+        .sim_cop_data_valid(sim_cop_data_valid),
+        .sim_cop_pc(sim_cop_pc),
+        .sim_cop_word(sim_cop_word),
+        .sim_cop_raster_x(sim_cop_raster_x),
+        .sim_cop_raster_y(sim_cop_raster_y),
+
+        .sim_vdp_vram_slot(sim_vdp_vram_slot),
+        .sim_vdp_vram_host_write(sim_vdp_vram_host_write),
+        .sim_vdp_sprite_hit(sim_vdp_sprite_hit),
+        .sim_vdp_sprite_hit_wide(sim_vdp_sprite_hit_wide),
+        .sim_vdp_sprite_row_fetched(sim_vdp_sprite_row_fetched)
     );
 
     // --- Gamepad reading ---
@@ -188,6 +226,217 @@ module ics32_tb(
         .in_r(audio_r)
     );
 
+    // --- VDP write monitor blackbox ---
+
+    // Write enables are held until the VDP accepts the write so only the first cycle of each is reported
+    // The outputs are registered so they can be read after the clk_2x edge that the write was made on
+
+    wire sim_vdp_write_en, sim_cop_ram_write_en;
+    wire [6:0] sim_vdp_write_address;
+    wire [10:0] sim_cop_ram_write_address;
+    wire [15:0] sim_write_data;
+
+    reg sim_vdp_write_en_r, sim_cop_ram_write_en_r;
+
+    reg vdp_monitor_valid;
+    reg vdp_monitor_copper;
+    reg [10:0] vdp_monitor_address;
+    reg [15:0] vdp_monitor_data;
+
+    always @(posedge clk_2x) begin
+        sim_vdp_write_en_r <= sim_vdp_write_en;
+        sim_cop_ram_write_en_r <= sim_cop_ram_write_en;
+
+        vdp_monitor_valid <= (sim_vdp_write_en && !sim_vdp_write_en_r) ||
+            (sim_cop_ram_write_en && !sim_cop_ram_write_en_r);
+        vdp_monitor_copper <= sim_cop_ram_write_en;
+        vdp_monitor_address <= sim_cop_ram_write_en ? sim_cop_ram_write_address : {4'b0, sim_vdp_write_address};
+        vdp_monitor_data <= sim_write_data;
+    end
+
+    vdp_monitor_bb vdp_monitor(
+        .valid(vdp_monitor_valid),
+        .copper(vdp_monitor_copper),
+        .address(vdp_monitor_address),
+        .data(vdp_monitor_data)
+    );
+
+    // --- CPU monitor blackbox ---
+
+    // Sampled by the PC profiler, this is the last instruction fetch rather than the retired instruction
+    // Writes are checked by trace triggers and stop conditions, with only the first clk_2x cycle of each reported
+    // as with the VDP monitor
+
+    wire [31:0] sim_cpu_pc;
+    wire sim_cpu_write_valid;
+    wire [31:0] sim_cpu_write_address;
+    wire [31:0] sim_cpu_write_data;
+    wire [3:0] sim_cpu_write_wstrb;
+
+    reg sim_cpu_write_valid_r;
+
+    reg cpu_monitor_write_valid;
+    reg [31:0] cpu_monitor_write_address;
+    reg [31:0] cpu_monitor_write_data;
+    reg [3:0] cpu_monitor_write_wstrb;
+
+    always @(posedge clk_2x) begin
+        sim_cpu_write_valid_r <= sim_cpu_write_valid;
+
+        cpu_monitor_write_valid <= sim_cpu_write_valid && !sim_cpu_write_valid_r;
+        cpu_monitor_write_address <= sim_cpu_write_address;
+        cpu_monitor_write_data <= sim_cpu_write_data;
+        cpu_monitor_write_wstrb <= sim_cpu_write_wstrb;
+    end
+
+    cpu_monitor_bb cpu_monitor(
+        .pc(sim_cpu_pc),
+        .write_valid(cpu_monitor_write_valid),
+        .write_address(cpu_monitor_write_address),
+        .write_data(cpu_monitor_write_data),
+        .write_wstrb(cpu_monitor_write_wstrb)
+    );
+
+    // --- Copper monitor blackbox ---
+
+    // Registered like the VDP write monitor so that the op executed during a cycle can be read after its clk_2x edge
+
+    wire sim_cop_op_valid, sim_cop_data_valid;
+    wire [10:0] sim_cop_pc;
+    wire [15:0] sim_cop_word;
+    wire [10:0] sim_cop_raster_x;
+    wire [9:0] sim_cop_raster_y;
+
+    reg copper_monitor_valid;
+    reg copper_monitor_data;
+    reg [10:0] copper_monitor_pc;
+    reg [15:0] copper_monitor_word;
+    reg [10:0] copper_monitor_raster_x;
+    reg [9:0] copper_monitor_raster_y;
+
+    always @(posedge clk_2x) begin
+        copper_monitor_valid <= sim_cop_op_valid || sim_cop_data_valid;
+        copper_monitor_data <= sim_cop_data_valid;
+        copper_monitor_pc <= sim_cop_pc;
+        copper_monitor_word <= sim_cop_word;
+        copper_monitor_raster_x <= sim_cop_raster_x;
+        copper_monitor_raster_y <= sim_cop_raster_y;
+    end
+
+    copper_monitor_bb copper_monitor(
+        .valid(copper_monitor_valid),
+        .data(copper_monitor_data),
+        .pc(copper_monitor_pc),
+        .word(copper_monitor_word),
+        .raster_x(copper_monitor_raster_x),
+        .raster_y(copper_monitor_raster_y)
+    );
+
+    // --- VDP usage monitor blackbox ---
+
+    // Sprite and VRAM bus activity is counted over each line and reported for one cycle after the line ends
+    // The sprite hit list built during a line is rendered during the following one, so hits are reported with that line
+
+    wire [1:0] sim_vdp_vram_slot;
+    wire sim_vdp_vram_host_write;
+    wire sim_vdp_sprite_hit, sim_vdp_sprite_hit_wide;
+    wire sim_vdp_sprite_row_fetched;
+
+    wire vdp_usage_line_ended = sim_cop_raster_x == 0;
+
+    reg [9:0] vdp_usage_raster_y;
+
+    reg [8:0] vdp_usage_sprites_hit_next;
+    reg [12:0] vdp_usage_sprite_pixels_hit_next;
+
+    reg [8:0] vdp_usage_sprites_hit;
+    reg [12:0] vdp_usage_sprite_pixels_hit;
+    reg [8:0] vdp_usage_sprite_rows;
+    reg [10:0] vdp_usage_layer_slots, vdp_usage_sprite_slots, vdp_usage_host_slots, vdp_usage_affine_slots;
+    reg [8:0] vdp_usage_host_writes, vdp_usage_host_writes_dropped;
+
+    // Counts including the current cycle, so that the cycle the line ends on isn't lost
+
+    wire [8:0] vdp_usage_sprites_hit_next_nx = vdp_usage_sprites_hit_next + sim_vdp_sprite_hit;
+    wire [12:0] vdp_usage_sprite_pixels_hit_next_nx = vdp_usage_sprite_pixels_hit_next +
+        (sim_vdp_sprite_hit ? (sim_vdp_sprite_hit_wide ? 16 : 8) : 0);
+
+    wire [8:0] vdp_usage_sprite_rows_nx = vdp_usage_sprite_rows + sim_vdp_sprite_row_fetched;
+    wire [10:0] vdp_usage_layer_slots_nx = vdp_usage_layer_slots + (sim_vdp_vram_slot == `VRAM_SLOT_LAYERS);
+    wire [10:0] vdp_usage_sprite_slots_nx = vdp_usage_sprite_slots + (sim_vdp_vram_slot == `VRAM_SLOT_SPRITES);
+    wire [10:0] vdp_usage_host_slots_nx = vdp_usage_host_slots + (sim_vdp_vram_slot == `VRAM_SLOT_HOST);
+    wire [10:0] vdp_usage_affine_slots_nx = vdp_usage_affine_slots + (sim_vdp_vram_slot == `VRAM_SLOT_AFFINE);
+    wire [8:0] vdp_usage_host_writes_nx = vdp_usage_host_writes + sim_vdp_vram_host_write;
+    wire [8:0] vdp_usage_host_writes_dropped_nx = vdp_usage_host_writes_dropped +
+        (sim_vdp_vram_host_write && sim_vdp_vram_slot == `VRAM_SLOT_AFFINE);
+
+    reg vdp_usage_monitor_valid;
+    reg [9:0] vdp_usage_monitor_raster_y;
+    reg [8:0] vdp_usage_monitor_sprites_hit;
+    reg [12:0] vdp_usage_monitor_sprite_pixels_hit;
+    reg [8:0] vdp_usage_monitor_sprite_rows;
+    reg [10:0] vdp_usage_monitor_layer_slots, vdp_usage_monitor_sprite_slots;
+    reg [10:0] vdp_usage_monitor_host_slots, vdp_usage_monitor_affine_slots;
+    reg [8:0] vdp_usage_monitor_host_writes, vdp_usage_monitor_host_writes_dropped;
+
+    always @(posedge clk_2x) begin
+        vdp_usage_monitor_valid <= vdp_usage_line_ended;
+
+        if (vdp_usage_line_ended) begin
+            vdp_usage_monitor_raster_y <= vdp_usage_raster_y;
+            vdp_usage_monitor_sprites_hit <= vdp_usage_sprites_hit;
+            vdp_usage_monitor_sprite_pixels_hit <= vdp_usage_sprite_pixels_hit;
+            vdp_usage_monitor_sprite_rows <= vdp_usage_sprite_rows_nx;
+            vdp_usage_monitor_layer_slots <= vdp_usage_layer_slots_nx;
+            vdp_usage_monitor_sprite_slots <= vdp_usage_sprite_slots_nx;
+            vdp_usage_monitor_host_slots <= vdp_usage_host_slots_nx;
+            vdp_usage_monitor_affine_slots <= vdp_usage_affine_slots_nx;
+            vdp_usage_monitor_host_writes <= vdp_usage_host_writes_nx;
+            vdp_usage_monitor_host_writes_dropped <= vdp_usage_host_writes_dropped_nx;
+
+            // The hit list built during the line that ended is rendered during the next one
+            vdp_usage_sprites_hit <= vdp_usage_sprites_hit_next_nx;
+            vdp_usage_sprite_pixels_hit <= vdp_usage_sprite_pixels_hit_next_nx;
+            vdp_usage_sprites_hit_next <= 0;
+            vdp_usage_sprite_pixels_hit_next <= 0;
+
+            vdp_usage_sprite_rows <= 0;
+            vdp_usage_layer_slots <= 0;
+            vdp_usage_sprite_slots <= 0;
+            vdp_usage_host_slots <= 0;
+            vdp_usage_affine_slots <= 0;
+            vdp_usage_host_writes <= 0;
+            vdp_usage_host_writes_dropped <= 0;
+        end else begin
+            vdp_usage_sprites_hit_next <= vdp_usage_sprites_hit_next_nx;
+            vdp_usage_sprite_pixels_hit_next <= vdp_usage_sprite_pixels_hit_next_nx;
+
+            vdp_usage_sprite_rows <= vdp_usage_sprite_rows_nx;
+            vdp_usage_layer_slots <= vdp_usage_layer_slots_nx;
+            vdp_usage_sprite_slots <= vdp_usage_sprite_slots_nx;
+            vdp_usage_host_slots <= vdp_usage_host_slots_nx;
+            vdp_usage_affine_slots <= vdp_usage_affine_slots_nx;
+            vdp_usage_host_writes <= vdp_usage_host_writes_nx;
+            vdp_usage_host_writes_dropped <= vdp_usage_host_writes_dropped_nx;
+        end
+
+        vdp_usage_raster_y <= sim_cop_raster_y;
+    end
+
+    vdp_usage_monitor_bb vdp_usage_monitor(
+        .valid(vdp_usage_monitor_valid),
+        .raster_y(vdp_usage_monitor_raster_y),
+        .sprites_hit(vdp_usage_monitor_sprites_hit),
+        .sprite_pixels_hit(vdp_usage_monitor_sprite_pixels_hit),
+        .sprite_rows(vdp_usage_monitor_sprite_rows),
+        .layer_slots(vdp_usage_monitor_layer_slots),
+        .sprite_slots(vdp_usage_monitor_sprite_slots),
+        .host_slots(vdp_usage_monitor_host_slots),
+        .affine_slots(vdp_usage_monitor_affine_slots),
+        .host_writes(vdp_usage_monitor_host_writes),
+        .host_writes_dropped(vdp_usage_monitor_host_writes_dropped)
+    );
+
 endmodule
 
 (* cxxrtl_blackbox *)
@@ -215,3 +464,77 @@ module audio_dac_bb(
 /* verilator public_module */
 
 endmodule
+
+(* cxxrtl_blackbox *)
+module vdp_monitor_bb(
+    input valid /* verilator public */,
+    input copper /* verilator public */,
+    input [10:0] address /* verilator public */,
+    input [15:0] data /* verilator public */
+);
+
+/* verilator public_module */
+
+endmodule
+
+(* cxxrtl_blackbox *)
+module cpu_monitor_bb(
+    input [31:0] pc /* verilator public */,
+    input write_valid /* verilator public */,
+    input [31:0] write_address /* verilator public */,
+    input [31:0] write_data /* verilator public */,
+    input [3:0] write_wstrb /* verilator public */
+);
+
+/* verilator public_module */
+
+endmodule
+
+(* cxxrtl_blackbox *)
+module copper_monitor_bb(
+    input valid /* verilator public */,
+    input data /* verilator public */,
+    input [10:0] pc /* verilator public */,
+    input [15:0] word /* verilator public */,
+    input [10:0] raster_x /* verilator public */,
+    input [9:0] raster_y /* verilator public */
+);
+
+/* verilator public_module */
+
+endmodule
+
+(* cxxrtl_blackbox *)
+module vdp_usage_monitor_bb(
+    input valid /* verilator public */,
+    input [9:0] raster_y /* verilator public */,
+    input [8:0] sprites_hit /* verilator public */,
+    input [12:0] sprite_pixels_hit /* verilator public */,
+    input [8:0] sprite_rows /* verilator public */,
+    input [10:0] layer_slots /* verilator public */,
+    input [10:0] sprite_slots /* verilator public */,
+    input [10:0] host_slots /* verilator public */,
+    input [10:0] affine_slots /* verilator public */,
+    input [8:0] host_writes /* verilator public */,
+    input [8:0] host_writes_dropped /* verilator public */
+);
+
+/* verilator public_module */
+
+endmodule
+
+`ifdef SIM_FLASH_TLM
+
+(* cxxrtl_blackbox *)
+module flash_tlm_bb(
+    input valid /* verilator public */,
+    input [23:0] address /* verilator public */,
+    input size /* verilator public */,
+    (* cxxrtl_sync *) output [31:0] data /* verilator public */
+);
+
+/* verilator public_module */
+
+endmodule
+
+`endif
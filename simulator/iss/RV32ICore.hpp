@@ -0,0 +1,198 @@
+// RV32ICore.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Instruction set simulator for the RV32I base ISA, as implemented by the PicoRV32 / VexRiscv configs in ics32.v
+// There are no CSRs, interrupts or traps. Anything outside of RV32I stops the core.
+
+// The core is templated on its bus so memory accesses are direct calls rather than virtual ones:
+//
+// uint32_t fetch(uint32_t address)
+// uint32_t load(uint32_t address, uint8_t size)            (zero-extended, size is 1, 2 or 4 bytes)
+// void store(uint32_t address, uint32_t data, uint8_t size)
+
+#ifndef RV32ICore_hpp
+#define RV32ICore_hpp
+
+#include <stdint.h>
+
+template <class BusT>
+class RV32ICore {
+
+public:
+    RV32ICore(BusT &bus) : bus(bus) {}
+
+    void reset(uint32_t reset_pc, uint32_t reset_sp) {
+        for (auto &reg : x) {
+            reg = 0;
+        }
+
+        x[2] = reset_sp;
+        pc = reset_pc;
+        halted = false;
+    }
+
+    /// Executes a single instruction.
+    /// Returns false if the instruction isn't supported, in which case the core is halted at that instruction.
+    bool step();
+
+    /// Set after an unsupported instruction was encountered.
+    bool is_halted() const { return halted; }
+
+    uint32_t pc = 0;
+    uint32_t x[32] = {0};
+
+private:
+    BusT &bus;
+    bool halted = false;
+
+    enum Opcode: uint8_t {
+        LOAD = 0x03,
+        MISC_MEM = 0x0f,
+        OP_IMM = 0x13,
+        AUIPC = 0x17,
+        STORE = 0x23,
+        OP = 0x33,
+        LUI = 0x37,
+        BRANCH = 0x63,
+        JALR = 0x67,
+        JAL = 0x6f,
+        SYSTEM = 0x73
+    };
+
+    static int32_t imm_i(uint32_t op) { return (int32_t)op >> 20; }
+
+    static int32_t imm_s(uint32_t op) {
+        return ((int32_t)op >> 25) << 5 | ((op >> 7) & 0x1f);
+    }
+
+    static int32_t imm_b(uint32_t op) {
+        return ((int32_t)op >> 31) << 12 | ((op >> 7) & 0x01) << 11 | ((op >> 25) & 0x3f) << 5 | ((op >> 8) & 0x0f) << 1;
+    }
+
+    static int32_t imm_j(uint32_t op) {
+        return ((int32_t)op >> 31) << 20 | (op & 0xff000) | ((op >> 20) & 0x01) << 11 | ((op >> 21) & 0x3ff) << 1;
+    }
+
+    static uint32_t alu(uint8_t funct3, bool alt, uint32_t a, uint32_t b) {
+        switch (funct3) {
+            case 0: return alt ? a - b : a + b;
+            case 1: return a << (b & 0x1f);
+            case 2: return (int32_t)a < (int32_t)b;
+            case 3: return a < b;
+            case 4: return a ^ b;
+            case 5: return alt ? (uint32_t)((int32_t)a >> (b & 0x1f)) : a >> (b & 0x1f);
+            case 6: return a | b;
+            default: return a & b;
+        }
+    }
+};
+
+template <class BusT>
+bool RV32ICore<BusT>::step() {
+    if (halted) {
+        return false;
+    }
+
+    const uint32_t op = bus.fetch(pc);
+
+    const uint8_t rd = (op >> 7) & 0x1f;
+    const uint8_t funct3 = (op >> 12) & 0x07;
+    const uint32_t rs1 = x[(op >> 15) & 0x1f];
+    const uint32_t rs2 = x[(op >> 20) & 0x1f];
+
+    uint32_t next_pc = pc + 4;
+    uint32_t result = 0;
+    bool write_rd = true;
+
+    switch (op & 0x7f) {
+        case LUI:
+            result = op & 0xfffff000;
+            break;
+        case AUIPC:
+            result = pc + (op & 0xfffff000);
+            break;
+        case JAL:
+            result = next_pc;
+            next_pc = pc + imm_j(op);
+            break;
+        case JALR:
+            result = next_pc;
+            next_pc = (rs1 + imm_i(op)) & ~1;
+            break;
+        case BRANCH: {
+            bool taken;
+            switch (funct3) {
+                case 0: taken = rs1 == rs2; break;
+                case 1: taken = rs1 != rs2; break;
+                case 4: taken = (int32_t)rs1 < (int32_t)rs2; break;
+                case 5: taken = (int32_t)rs1 >= (int32_t)rs2; break;
+                case 6: taken = rs1 < rs2; break;
+                case 7: taken = rs1 >= rs2; break;
+                default: halted = true; return false;
+            }
+
+            if (taken) {
+                next_pc = pc + imm_b(op);
+            }
+
+            write_rd = false;
+        } break;
+        case LOAD: {
+            uint32_t address = rs1 + imm_i(op);
+            switch (funct3) {
+                case 0: result = (int32_t)(int8_t)bus.load(address, 1); break;
+                case 1: result = (int32_t)(int16_t)bus.load(address, 2); break;
+                case 2: result = bus.load(address, 4); break;
+                case 4: result = bus.load(address, 1); break;
+                case 5: result = bus.load(address, 2); break;
+                default: halted = true; return false;
+            }
+        } break;
+        case STORE: {
+            uint32_t address = rs1 + imm_s(op);
+            switch (funct3) {
+                case 0: bus.store(address, rs2, 1); break;
+                case 1: bus.store(address, rs2, 2); break;
+                case 2: bus.store(address, rs2, 4); break;
+                default: halted = true; return false;
+            }
+
+            write_rd = false;
+        } break;
+        case OP_IMM: {
+            // Only SRAI uses the alternate encoding for immediates
+            bool alt = (funct3 == 5) && (op & (1 << 30));
+            result = alu(funct3, alt, rs1, imm_i(op));
+        } break;
+        case OP:
+            if (op & 0xbe000000) {
+                // M extension or otherwise undefined
+                halted = true;
+                return false;
+            }
+
+            result = alu(funct3, op & (1 << 30), rs1, rs2);
+            break;
+        case MISC_MEM:
+            // FENCE has no effect with a single core and no caches
+            write_rd = false;
+            break;
+        case SYSTEM:
+        default:
+            halted = true;
+            return false;
+    }
+
+    if (write_rd && rd) {
+        x[rd] = result;
+    }
+
+    pc = next_pc;
+
+    return true;
+}
+
+#endif /* RV32ICore_hpp */
@@ -1,4 +1,12 @@
+// SDL is optional and only needed for windowed video / audio output
+#ifndef SDL_SUPPORT
+#define SDL_SUPPORT 0
+#endif
+
+#if SDL_SUPPORT
 #include <SDL.h>
+#include "SDLPresenter.hpp"
+#endif
 
 #include <fstream>
 #include <iterator>
@@ -7,10 +15,30 @@
 #include <memory>
 #include <getopt.h>
 #include <limits>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
 
 #include "QSPIFlashSim.hpp"
-
-#include "tinywav.h"
+#include "FrameDumper.hpp"
+#include "VideoWriter.hpp"
+#include "FrameSink.hpp"
+#include "AudioSink.hpp"
+#include "AudioRing.hpp"
+#include "LockstepChecker.hpp"
+#include "WAVWriter.hpp"
+#include "InputMovie.hpp"
+#include "Telemetry.hpp"
+#include "FlashProfiler.hpp"
+#include "PCProfiler.hpp"
+#include "CopperTrace.hpp"
+#include "VDPUsageProfiler.hpp"
+#include "StopConditions.hpp"
+#include "ElfSymbols.hpp"
+#include "VDPTiming.hpp"
 
 #ifdef SIM_VERILATOR
 
@@ -24,9 +52,15 @@ const std::string title = "verilator";
 typedef CXXRTLSimulation SimulationImpl;
 const std::string title = "cxxrtl";
 
+#elif defined(SIM_ISS)
+
+#include "ISSSimulation.hpp"
+typedef ISSSimulation SimulationImpl;
+const std::string title = "iss";
+
 #else
 
-#error Expected one of SIM_VERILATOR or SIM_CXXRTL to be defined
+#error Expected one of SIM_VERILATOR, SIM_CXXRTL or SIM_ISS to be defined
 
 #endif
 
@@ -34,24 +68,165 @@ const std::string title = "cxxrtl";
 
 #define AUDIO_SUPPORT
 
+#if SDL_SUPPORT
 void audio_callback(void *userdata, Uint8 *stream, int len);
-std::deque<int16_t> audio_callback_samples;
 
-SDL_AudioDeviceID init_sdl_audio(void);
-bool write_captured_audio(const std::string &path, const std::vector<int16_t> &samples);
+SDL_AudioDeviceID init_sdl_audio(AudioRing *ring);
+#endif
+
+// Long options:
+
+enum LongOption {
+    OPT_HEADLESS = 0x100,
+    OPT_FRAME_DUMP,
+    OPT_FRAME_DUMP_SELECT,
+    OPT_VIDEO,
+    OPT_FRAMES,
+    OPT_SAVE_STATE,
+    OPT_SAVE_STATE_FRAME,
+    OPT_LOAD_STATE,
+    OPT_DIFF,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_TELEMETRY,
+    OPT_FLASH_PROFILE,
+    OPT_FLASH_MAP,
+    OPT_PC_PROFILE,
+    OPT_PC_INTERVAL,
+    OPT_ELF,
+    OPT_COPPER_TRACE,
+    OPT_VDP_USAGE,
+    OPT_VDP_HEATMAP,
+    OPT_SHOW_BLANKING,
+    OPT_TRACE,
+    OPT_TRACE_START,
+    OPT_TRACE_STOP,
+    OPT_TRACE_SIGNALS,
+    OPT_UNTIL,
+    OPT_BREAK,
+    OPT_EXIT_ON_WRITE
+};
+
+static const struct option long_options[] = {
+    {"headless", no_argument, NULL, OPT_HEADLESS},
+    {"frame-dump", required_argument, NULL, OPT_FRAME_DUMP},
+    {"frame-dump-select", required_argument, NULL, OPT_FRAME_DUMP_SELECT},
+    {"video", required_argument, NULL, OPT_VIDEO},
+    {"frames", required_argument, NULL, OPT_FRAMES},
+    {"save-state", required_argument, NULL, OPT_SAVE_STATE},
+    {"save-state-frame", required_argument, NULL, OPT_SAVE_STATE_FRAME},
+    {"load-state", required_argument, NULL, OPT_LOAD_STATE},
+    {"diff", no_argument, NULL, OPT_DIFF},
+    {"record", required_argument, NULL, OPT_RECORD},
+    {"replay", required_argument, NULL, OPT_REPLAY},
+    {"telemetry", required_argument, NULL, OPT_TELEMETRY},
+    {"flash-profile", required_argument, NULL, OPT_FLASH_PROFILE},
+    {"flash-map", required_argument, NULL, OPT_FLASH_MAP},
+    {"pc-profile", required_argument, NULL, OPT_PC_PROFILE},
+    {"pc-interval", required_argument, NULL, OPT_PC_INTERVAL},
+    {"elf", required_argument, NULL, OPT_ELF},
+    {"copper-trace", required_argument, NULL, OPT_COPPER_TRACE},
+    {"vdp-usage", required_argument, NULL, OPT_VDP_USAGE},
+    {"vdp-heatmap", required_argument, NULL, OPT_VDP_HEATMAP},
+    {"show-blanking", no_argument, NULL, OPT_SHOW_BLANKING},
+    {"trace", required_argument, NULL, OPT_TRACE},
+    {"trace-start", required_argument, NULL, OPT_TRACE_START},
+    {"trace-stop", required_argument, NULL, OPT_TRACE_STOP},
+    {"trace-signals", required_argument, NULL, OPT_TRACE_SIGNALS},
+    {"until", required_argument, NULL, OPT_UNTIL},
+    {"break", required_argument, NULL, OPT_BREAK},
+    {"exit-on-write", required_argument, NULL, OPT_EXIT_ON_WRITE},
+    {NULL, 0, NULL, 0}
+};
 
 int main(int argc, const char **argv) {
     if (argc < 2) {
-        std::cout << "Usage: <sim> <test-program>" << std::endl;
+        std::cout << "Usage: <sim> [options] <test-program>" << std::endl;
+        std::cout << std::endl;
+        std::cout << "  -t <cycles>              Stop after the given number of cycles, counting from any loaded save state" << std::endl;
+        std::cout << "  -w <path>                Capture audio output to a WAV file" << std::endl;
+        std::cout << "  -a                       Play audio output (requires SDL)" << std::endl;
+        std::cout << "  --headless               Run without opening a window" << std::endl;
+        std::cout << "  --show-blanking          Show the blanking area around the active display in the window and frame dumps" << std::endl;
+        std::cout << "  --frames <count>         Stop after the given number of frames" << std::endl;
+        std::cout << "  --frame-dump <path>      Write frames to <path> (.ppm or .png) with the frame number appended" << std::endl;
+        std::cout << "  --frame-dump-select <n>  Only dump the given frames i.e. \"0,10-20,100-\"" << std::endl;
+        std::cout << "  --video <path>           Stream every frame as Y4M video, or raw RGB24 for a .rgb path (\"-\" for Y4M to stdout)" << std::endl;
+        std::cout << "  --save-state <path>      Write a save state when the sim stops" << std::endl;
+        std::cout << "  --save-state-frame <n>   Write the save state after frame <n> instead" << std::endl;
+        std::cout << "  --load-state <path>      Resume from a save state written by the same sim and program" << std::endl;
+        std::cout << "  --diff                   Check video output against the behavioral VDP model, stopping on mismatch (audio is not checked)" << std::endl;
+        std::cout << "  --record <path>          Record gamepad input of each frame to an input movie" << std::endl;
+        std::cout << "  --replay <path>          Replay gamepad input from an input movie, stopping at its end unless --frames is set" << std::endl;
+        std::cout << "  --telemetry <path>       Write per-frame performance counters as JSON lines, or CSV for a .csv path" << std::endl;
+        std::cout << "  --flash-profile <path>   Write per-frame and per-region flash bus traffic as JSON lines" << std::endl;
+        std::cout << "  --flash-map <path>       Label flash regions in the profile, one \"<start> <end> <label>\" per line" << std::endl;
+        std::cout << "  --pc-profile <path>      Sample the CPU PC and write folded stacks, or per-frame histograms for a .jsonl path" << std::endl;
+        std::cout << "  --pc-interval <cycles>   Cycles between PC samples (default: 1000)" << std::endl;
+        std::cout << "  --elf <path>             ELF to symbolize PC samples and find functions in stop conditions (default: the program path with .elf extension)" << std::endl;
+        std::cout << "  --copper-trace <path>    Write every op executed by the copper to a binary trace for copper_view" << std::endl;
+        std::cout << "  --vdp-usage <path>       Write per-frame sprite and VRAM bus usage against the VDP's budgets as JSON lines" << std::endl;
+        std::cout << "  --vdp-heatmap <path>     Write a PNG heatmap of the sprite and VRAM usage of every line of the last 2048 frames" << std::endl;
+        std::cout << "  --trace <path>           Trace build waveform output (default: ics.fst or ics.vcd)" << std::endl;
+        std::cout << "  --trace-start <trigger>  Start tracing at frame:<n>, cycle:<n>, pc:<address> or write:<address>" << std::endl;
+        std::cout << "  --trace-stop <trigger>   Stop tracing at a trigger as above (default: end of run)" << std::endl;
+        std::cout << "  --trace-signals <path>   Only trace the scopes listed in a file, one per line i.e. \"ics32.vdp\"" << std::endl;
+        std::cout << "  --until <condition>      Stop once the condition is hit i.e. \"pc:main_loop,frame:10\" or \"write:0x20000=1\"" << std::endl;
+        std::cout << "  --break <condition>      Stop once the condition is hit, exiting with status 2" << std::endl;
+        std::cout << "  --exit-on-write <addr>   Stop on a CPU write to <addr>, exiting with 0 if 0 was written or 16 + value" << std::endl;
         return EXIT_SUCCESS;
     }
 
     std::string wav_output_path = "";
     int64_t sim_cycles = std::numeric_limits<int64_t>::max();
+    uint64_t sim_frames = std::numeric_limits<uint64_t>::max();
     bool enable_audio_output = false;
 
+    // Headless is implied if there's no display to present to
+    bool headless = !SDL_SUPPORT;
+    bool show_blanking = false;
+
+    std::unique_ptr<FrameDumper> frame_dumper;
+    std::string frame_dump_selection = "";
+
+    std::string video_path = "";
+
+    std::string save_state_path = "";
+    std::string load_state_path = "";
+    int64_t save_state_frame = -1;
+
+    bool lockstep_diff = false;
+
+    std::string record_path = "";
+    std::string replay_path = "";
+
+    std::string telemetry_path = "";
+
+    std::string flash_profile_path = "";
+    std::string flash_map_path = "";
+
+    std::string pc_profile_path = "";
+    int64_t pc_sample_interval = -1;
+    std::string elf_path = "";
+
+    std::string copper_trace_path = "";
+    std::string vdp_usage_path = "";
+    std::string vdp_heatmap_path = "";
+
+    // Tracing options are accepted by all sims so that they can be rejected with a clear message in non-trace builds
+    TraceConfig trace_config;
+#if TRACE_FST
+    trace_config.path = "ics.fst";
+#else
+    trace_config.path = "ics.vcd";
+#endif
+    bool trace_options_set = false;
+
+    // Checked by the sim every cycle, but only if any are set
+    StopConditions stop_conditions;
+
     int opt = 0;
-    while ((opt = getopt_long(argc, (char **)argv, "w:t:na", NULL, NULL)) != -1) {
+    while ((opt = getopt_long(argc, (char **)argv, "w:t:na", long_options, NULL)) != -1) {
         switch (opt) {
             case 'w':
 #ifdef AUDIO_SUPPORT
@@ -67,11 +242,11 @@ int main(int argc, const char **argv) {
             return EXIT_FAILURE;
 #endif
             case 'a':
-#ifdef AUDIO_SUPPORT
+#if defined(AUDIO_SUPPORT) && SDL_SUPPORT
                 enable_audio_output = true;
                 break;
 #else
-                std::cerr << "Can't enable audio output (wasn't built with AUDIO_SUPPORT)" << std::endl;
+                std::cerr << "Can't enable audio output (wasn't built with AUDIO_SUPPORT and SDL_SUPPORT)" << std::endl;
                 return EXIT_FAILURE;
 #endif
             case 't':
@@ -80,11 +255,295 @@ int main(int argc, const char **argv) {
                     std::cerr << "-t argument must be a non-zero positive integer" << std::endl;
                     return EXIT_FAILURE;
                 }
+                break;
+            case OPT_HEADLESS:
+                headless = true;
+                break;
+            case OPT_SHOW_BLANKING:
+                show_blanking = true;
+                break;
+            case OPT_FRAMES: {
+                int64_t frames = strtoll(optarg, NULL, 10);
+                if (frames <= 0) {
+                    std::cerr << "--frames argument must be a non-zero positive integer" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                sim_frames = frames;
+            } break;
+            case OPT_FRAME_DUMP:
+                if (!*optarg) {
+                    std::cerr << "Frame dump path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                frame_dumper = std::unique_ptr<FrameDumper>(new FrameDumper(optarg));
+                break;
+            case OPT_FRAME_DUMP_SELECT:
+                frame_dump_selection = optarg;
+                break;
+            case OPT_VIDEO:
+                video_path = optarg;
+                if (video_path.empty()) {
+                    std::cerr << "Video path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_SAVE_STATE:
+                save_state_path = optarg;
+                if (save_state_path.empty()) {
+                    std::cerr << "Save state path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_SAVE_STATE_FRAME:
+                save_state_frame = strtoll(optarg, NULL, 10);
+                if (save_state_frame < 0) {
+                    std::cerr << "--save-state-frame argument must be a positive integer" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_LOAD_STATE:
+                load_state_path = optarg;
+                if (load_state_path.empty()) {
+                    std::cerr << "Load state path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_DIFF:
+                lockstep_diff = true;
+                break;
+            case OPT_RECORD:
+                record_path = optarg;
+                if (record_path.empty()) {
+                    std::cerr << "Input movie path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_TELEMETRY:
+                telemetry_path = optarg;
+                if (telemetry_path.empty()) {
+                    std::cerr << "Telemetry path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_FLASH_PROFILE:
+                flash_profile_path = optarg;
+                if (flash_profile_path.empty()) {
+                    std::cerr << "Flash profile path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_FLASH_MAP:
+                flash_map_path = optarg;
+                if (flash_map_path.empty()) {
+                    std::cerr << "Flash map path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_PC_PROFILE:
+                pc_profile_path = optarg;
+                if (pc_profile_path.empty()) {
+                    std::cerr << "PC profile path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_PC_INTERVAL:
+                pc_sample_interval = strtoll(optarg, NULL, 10);
+                if (pc_sample_interval <= 0) {
+                    std::cerr << "--pc-interval argument must be a non-zero positive integer" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_ELF:
+                elf_path = optarg;
+                if (elf_path.empty()) {
+                    std::cerr << "ELF path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_COPPER_TRACE:
+                copper_trace_path = optarg;
+                if (copper_trace_path.empty()) {
+                    std::cerr << "Copper trace path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_VDP_USAGE:
+                vdp_usage_path = optarg;
+                if (vdp_usage_path.empty()) {
+                    std::cerr << "VDP usage path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_VDP_HEATMAP:
+                vdp_heatmap_path = optarg;
+                if (vdp_heatmap_path.empty()) {
+                    std::cerr << "VDP heatmap path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_TRACE:
+                trace_config.path = optarg;
+                trace_options_set = true;
+                if (trace_config.path.empty()) {
+                    std::cerr << "Trace path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_TRACE_START:
+            case OPT_TRACE_STOP: {
+                auto &trigger = (opt == OPT_TRACE_START ? trace_config.start : trace_config.stop);
+                trace_options_set = true;
+                if (!TraceTrigger::parse(optarg, &trigger)) {
+                    std::cerr << "Invalid trace trigger: " << optarg << std::endl;
+                    return EXIT_FAILURE;
+                }
+            } break;
+            case OPT_TRACE_SIGNALS:
+                trace_options_set = true;
+                if (!trace_config.load_scopes(optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_UNTIL:
+            case OPT_BREAK: {
+                auto action = (opt == OPT_UNTIL ? StopConditions::Action::UNTIL : StopConditions::Action::BREAK);
+                if (!stop_conditions.add(action, optarg)) {
+                    std::cerr << "Invalid stop condition: " << optarg << std::endl;
+                    return EXIT_FAILURE;
+                }
+            } break;
+            case OPT_EXIT_ON_WRITE: {
+                char *end = NULL;
+                strtoull(optarg, &end, 0);
+
+                bool valid = *optarg && *optarg != '-' && *end == '\0' &&
+                    stop_conditions.add(StopConditions::Action::EXIT_WITH_VALUE, std::string("write:") + optarg);
+
+                if (!valid) {
+                    std::cerr << "--exit-on-write argument must be an address" << std::endl;
+                    return EXIT_FAILURE;
+                }
+            } break;
+            case OPT_REPLAY:
+                replay_path = optarg;
+                if (replay_path.empty()) {
+                    std::cerr << "Input movie path must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
             case '?':
                 return EXIT_FAILURE;
         }
     }
 
+    if (!frame_dump_selection.empty()) {
+        if (!frame_dumper) {
+            std::cerr << "--frame-dump-select requires --frame-dump to also be set" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if (!frame_dumper->select_frames(frame_dump_selection)) {
+            std::cerr << "Invalid frame selection: " << frame_dump_selection << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (save_state_frame >= 0 && save_state_path.empty()) {
+        std::cerr << "--save-state-frame requires --save-state to also be set" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!record_path.empty() && !replay_path.empty()) {
+        std::cerr << "--record and --replay can't be used together" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Input movies are opened before the sim is created so that errors are reported right away
+
+    std::unique_ptr<InputMovie> input_recording;
+    if (!record_path.empty()) {
+        input_recording = std::unique_ptr<InputMovie>(new InputMovie());
+        if (!input_recording->create(record_path)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::unique_ptr<InputMovie> input_replay;
+    if (!replay_path.empty()) {
+        input_replay = std::unique_ptr<InputMovie>(new InputMovie());
+        if (!input_replay->load(replay_path)) {
+            return EXIT_FAILURE;
+        }
+
+        if (sim_frames == std::numeric_limits<uint64_t>::max()) {
+            sim_frames = input_replay->frame_count();
+        }
+    }
+
+    if (!flash_map_path.empty() && flash_profile_path.empty()) {
+        std::cerr << "--flash-map requires --flash-profile to also be set" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (pc_sample_interval > 0 && pc_profile_path.empty()) {
+        std::cerr << "--pc-interval requires --pc-profile to also be set" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!elf_path.empty() && pc_profile_path.empty() && !stop_conditions.uses_symbols()) {
+        std::cerr << "--elf requires --pc-profile or a stop condition with a function name" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!vdp_heatmap_path.empty() && vdp_usage_path.empty()) {
+        std::cerr << "--vdp-heatmap requires --vdp-usage to also be set" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#if !VCD_WRITE
+    if (trace_options_set) {
+        std::cerr << "Tracing requires a trace build (verilator_sim_trace or cxxrtl_sim_trace)" << std::endl;
+        return EXIT_FAILURE;
+    }
+#else
+    (void)trace_options_set;
+#endif
+
+    bool trace_stop_ordered = trace_config.start.kind != trace_config.stop.kind ||
+        (trace_config.start.kind != TraceTrigger::Kind::FRAME && trace_config.start.kind != TraceTrigger::Kind::CYCLE) ||
+        trace_config.stop.value > trace_config.start.value;
+
+    if (!trace_stop_ordered) {
+        std::cerr << "--trace-stop must be after --trace-start" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#if defined(SIM_ISS)
+    if (!flash_profile_path.empty()) {
+        // Flash is read directly without going through the SPI interface
+        std::cerr << "Flash profiling isn't supported by the ISS sim" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (enable_audio_output || !wav_output_path.empty()) {
+        // The DSP output isn't modelled yet so there would be nothing to play or write
+        std::cerr << "Audio output (-a, -w) isn't supported by the ISS sim yet" << std::endl;
+        return EXIT_FAILURE;
+    }
+#elif SIM_FLASH_TLM
+    if (!flash_profile_path.empty()) {
+        // Flash controller reads are served as single transactions that never reach the SPI interface
+        std::cerr << "Flash profiling isn't supported in FLASH_TLM builds, rebuild with FLASH_TLM=0" << std::endl;
+        return EXIT_FAILURE;
+    }
+#endif
+
+    if (lockstep_diff && !load_state_path.empty()) {
+        // The model has to see every VDP write from reset onwards
+        std::cerr << "--diff can't be used with --load-state" << std::endl;
+        return EXIT_FAILURE;
+    }
+
 #ifdef AUDIO_SUPPORT
     bool wav_output_required = !wav_output_path.empty();
     bool audio_capture_required = enable_audio_output || wav_output_required;
@@ -93,6 +552,46 @@ int main(int argc, const char **argv) {
     bool audio_capture_required = false;
 #endif
 
+    // WAV output is streamed to disk as the sim runs
+    // The header has the exact rate the samples are output at so that the audio stays in sync with any video output
+
+    WAVWriter wav_writer;
+    if (wav_output_required && !wav_writer.open(wav_output_path, VDPTiming::mode_configured().audio_sample_rate())) {
+        return EXIT_FAILURE;
+    }
+
+    // Video output is also streamed as the sim runs, from its own thread
+
+    std::unique_ptr<VideoWriter> video_writer;
+    if (!video_path.empty()) {
+        video_writer = std::unique_ptr<VideoWriter>(new VideoWriter());
+
+        bool video_opened = false;
+        if (video_path == "-") {
+            // The video gets its own copy of stdout and everything else printed to stdout goes to stderr instead
+            std::cout.flush();
+            fflush(stdout);
+
+            int video_fd = dup(STDOUT_FILENO);
+            video_opened = video_writer->open(video_fd >= 0 ? fdopen(video_fd, "wb") : NULL, VideoWriter::Format::Y4M);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        } else {
+            video_opened = video_writer->open(video_path);
+        }
+
+        if (!video_opened) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::unique_ptr<Telemetry> telemetry;
+    if (!telemetry_path.empty()) {
+        telemetry = std::unique_ptr<Telemetry>(new Telemetry());
+        if (!telemetry->open(telemetry_path)) {
+            return EXIT_FAILURE;
+        }
+    }
+
     // 1. Load test program...
 
     if (optind >= argc) {
@@ -102,297 +601,630 @@ int main(int argc, const char **argv) {
 
     auto cpu_program_path = argv[optind];
 
-    std::ifstream cpu_program_stream(cpu_program_path, std::ios::binary);
+    std::ifstream cpu_program_stream(cpu_program_path, std::ios::binary | std::ios::ate);
     if (cpu_program_stream.fail()) {
         std::cerr << "Failed to open file: " << cpu_program_path << std::endl;
         return EXIT_FAILURE;
     }
 
-    std::vector<uint8_t> cpu_program(std::istreambuf_iterator<char>(cpu_program_stream), {});
-    cpu_program_stream.close();
+    size_t cpu_program_size = cpu_program_stream.tellg();
 
-    if (cpu_program.size() % 4) {
-        std::cerr << "Program has irregular size: " << cpu_program.size() << std::endl;
+    if (cpu_program_size % 4) {
+        std::cerr << "Program has irregular size: " << cpu_program_size << std::endl;
         return EXIT_FAILURE;
     }
 
     const size_t flash_user_base = 0x200000;
     const size_t flash_ipl_size = 0x10000;
 
+    // Only the IPL is read here, for sims that preload it into CPU RAM
+
+    std::vector<uint8_t> cpu_ipl(flash_ipl_size, 0);
+    cpu_program_stream.seekg(0);
+    cpu_program_stream.read(reinterpret_cast<char *>(cpu_ipl.data()), std::min(cpu_program_size, flash_ipl_size));
+    cpu_program_stream.close();
+
     // Prepare flash before initializing the core sim instance
+    // The program is mapped into flash rather than copied, and the sim's copy of the flash model shares it
 
     QSPIFlashSim flash_sim;
     flash_sim.powered_down = true;
     flash_sim.enable_info_logging = false;
 
-    if (cpu_program.size() < flash_ipl_size) {
-        cpu_program.resize(flash_ipl_size);
+    if (!flash_sim.load_file(cpu_program_path, flash_user_base, flash_ipl_size)) {
+        return EXIT_FAILURE;
     }
 
-    flash_sim.load(cpu_program, flash_user_base);
-    Simulation::default_flash = flash_sim;
-
-    SimulationImpl sim;
+    SimulationImpl sim(flash_sim);
     sim.forward_cmd_args(argc, argv);
-    sim.preload_cpu_program(cpu_program);
+    sim.preload_cpu_program(cpu_ipl);
 
-    // 2. Present an SDL window to simulate video output
+    std::unique_ptr<FlashProfiler> flash_profiler;
+    if (!flash_profile_path.empty()) {
+        flash_profiler = std::unique_ptr<FlashProfiler>(new FlashProfiler(sim));
+        if (!flash_map_path.empty() && !flash_profiler->load_regions(flash_map_path)) {
+            return EXIT_FAILURE;
+        }
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
+        if (!flash_profiler->open(flash_profile_path)) {
+            return EXIT_FAILURE;
+        }
+
+        sim.flash_model().transaction_sink = flash_profiler.get();
+    }
+
+    if (elf_path.empty()) {
+        // Programs are built as prog.elf which is then converted to prog.bin
+        std::string program_path = cpu_program_path;
+        size_t extension = program_path.find_last_of('.');
+        size_t separator = program_path.find_last_of('/');
+        bool has_extension = extension != std::string::npos && (separator == std::string::npos || extension > separator);
+        elf_path = (has_extension ? program_path.substr(0, extension) : program_path) + ".elf";
+    }
+
+    std::unique_ptr<PCProfiler> pc_profiler;
+    if (!pc_profile_path.empty()) {
+        const uint64_t default_pc_sample_interval = 1000;
+        uint64_t interval = pc_sample_interval > 0 ? pc_sample_interval : default_pc_sample_interval;
+
+        pc_profiler = std::unique_ptr<PCProfiler>(new PCProfiler(sim, interval));
+        if (!pc_profiler->load_symbols(elf_path) || !pc_profiler->open(pc_profile_path)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::unique_ptr<CopperTracer> copper_tracer;
+    if (!copper_trace_path.empty()) {
+        copper_tracer = std::unique_ptr<CopperTracer>(new CopperTracer());
+        if (!copper_tracer->open(copper_trace_path)) {
+            return EXIT_FAILURE;
+        }
+
+        sim.copper_step_sink = copper_tracer.get();
+    }
+
+    std::unique_ptr<VDPUsageProfiler> vdp_usage_profiler;
+    if (!vdp_usage_path.empty()) {
+        vdp_usage_profiler = std::unique_ptr<VDPUsageProfiler>(new VDPUsageProfiler());
+        if (!vdp_usage_profiler->open(vdp_usage_path, vdp_heatmap_path)) {
+            return EXIT_FAILURE;
+        }
+
+        sim.vdp_usage_sink = vdp_usage_profiler.get();
+    }
+
+    // Stop conditions (optional)
+
+    std::unique_ptr<ElfSymbols> stop_symbols;
+    if (stop_conditions.uses_symbols()) {
+        stop_symbols = std::unique_ptr<ElfSymbols>(new ElfSymbols());
+        if (!stop_symbols->load(elf_path) || !stop_conditions.resolve_symbols(*stop_symbols)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!stop_conditions.empty()) {
+        sim.stop_conditions = &stop_conditions;
+    }
+
+    // 2. Present an SDL window to simulate video output (unless running headless)
+
+    // The frame is first sized for the mode the sim was built for and is resized if a different mode is detected
+    // from vga_de at the end of the first frame
+
+    auto frame_layout = (show_blanking ? FrameSink::Layout::RASTER : FrameSink::Layout::ACTIVE);
+
+    auto frame_width = [&] (const VDPTiming &timing) -> size_t {
+        return show_blanking ? timing.h_total() : timing.h_active;
+    };
+
+    auto frame_height = [&] (const VDPTiming &timing) -> size_t {
+        return show_blanking ? timing.v_total() : timing.v_active;
+    };
+
+    const VDPTiming configured_timing = VDPTiming::mode_configured();
+    FrameSink frame_sink(frame_width(configured_timing), frame_height(configured_timing), frame_layout);
+
+    if (video_writer) {
+        video_writer->set_frame_rate(configured_timing.pixel_clock, configured_timing.frame_cycles());
+    }
+
+    // Returns false if no active display was output yet, otherwise resizes the frame if needed
+    auto detect_video_mode = [&] (bool *resized) -> bool {
+        size_t active_width, active_height;
+        if (!frame_sink.active_size(&active_width, &active_height)) {
+            return false;
+        }
+
+        size_t width = frame_sink.frame_width();
+        size_t height = frame_sink.frame_height();
+
+        VDPTiming timing;
+        if (VDPTiming::mode_with_active_size(active_width, active_height, &timing)) {
+            std::cout << "Video mode: " << timing.h_active << "x" << timing.v_active
+                << " (" << timing.h_total() << "x" << timing.v_total() << " total)" << std::endl;
+
+            width = frame_width(timing);
+            height = frame_height(timing);
+
+            if (video_writer) {
+                video_writer->set_frame_rate(timing.pixel_clock, timing.frame_cycles());
+            }
+        } else {
+            std::cout << "Unrecognized video mode with a " << active_width << "x" << active_height << " active display" << std::endl;
+
+            // Only the active display can be sized without knowing the rest of the timing
+            if (!show_blanking) {
+                width = active_width;
+                height = active_height;
+            }
+        }
+
+        *resized = (width != frame_sink.frame_width() || height != frame_sink.frame_height());
+        if (*resized) {
+            frame_sink.resize(width, height);
+        }
+
+        return true;
+    };
+
+#if SDL_SUPPORT
+    SDL_Window *window = NULL;
+    std::unique_ptr<SDLPresenter> presenter;
+
+    Uint32 sdl_subsystems = (headless ? 0 : SDL_INIT_VIDEO) | (enable_audio_output ? SDL_INIT_AUDIO : 0);
+    bool sdl_required = sdl_subsystems != 0;
+
+    if (sdl_required && SDL_Init(sdl_subsystems) != 0) {
         std::cerr << "SDL_Init() failed: " << SDL_GetError() << std::endl;
         return EXIT_FAILURE;
     }
 
-    // SDL defaults to Metal API on MacOS and is incredibly slow to run SDL_RenderPresent()
-    // Hint to use OpenGL if possible
+    if (!headless) {
+        // SDL defaults to Metal API on MacOS and is incredibly slow to run SDL_RenderPresent()
+        // Hint to use OpenGL if possible
 #if TARGET_OS_MAC
-    SDL_SetHint(SDL_HINT_RENDER_DRIVER, "opengl");
+        SDL_SetHint(SDL_HINT_RENDER_DRIVER, "opengl");
+#endif
+
+        window = SDL_CreateWindow(
+            ("ics32-sim (" + title + ")").c_str(),
+            SDL_WINDOWPOS_CENTERED,
+            SDL_WINDOWPOS_CENTERED,
+            (int)frame_sink.frame_width(),
+            (int)frame_sink.frame_height(),
+            SDL_WINDOW_SHOWN
+        );
+
+        if (!window) {
+            std::cerr << "SDL_CreateWindow() failed: " << SDL_GetError() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // Frames are presented on the main thread while the sim runs on its own, so the sim never waits on the renderer
+        presenter = std::unique_ptr<SDLPresenter>(new SDLPresenter(window, frame_sink.frame_width(), frame_sink.frame_height()));
+        if (!presenter->start()) {
+            return EXIT_FAILURE;
+        }
+    }
+#else
+    // Always headless without SDL
+    (void)headless;
 #endif
 
-    // 848x480 is assumed (smaller video modes will still appear correctly)
-
-    const auto active_width = 848;
-    const auto offscreen_width = 240;
-    const auto total_width = active_width + offscreen_width;
-
-    const auto active_height = 480;
-    const auto offscreen_height = 37;
-    const auto total_height = active_height + offscreen_height;
-
-    auto window = SDL_CreateWindow(
-       ("ics32-sim (" + title + ")").c_str(),
-       SDL_WINDOWPOS_CENTERED,
-       SDL_WINDOWPOS_CENTERED,
-       total_width,
-       total_height,
-       SDL_WINDOW_SHOWN
-   );
-
-    auto renderer = SDL_CreateRenderer(window, -1, 0);
-    SDL_RenderSetScale(renderer, 1, 1);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-
-    SDL_Texture *texture = SDL_CreateTexture(renderer,
-        SDL_PIXELFORMAT_RGB24,
-        SDL_TEXTUREACCESS_STATIC,
-        total_width,
-        total_height
-    );
-
-    const size_t rgb24_size = 3;
-    uint8_t *pixels = (uint8_t *)std::calloc(total_width * total_height * rgb24_size, sizeof(uint8_t));
-    assert(pixels);
-
-    int current_x = 0;
-    int current_y = 0;
-    size_t pixel_index = 0;
+    // Samples are drained into the host side buffers after every run_cycles() batch
+    const size_t audio_sink_capacity = 4096;
+    AudioSink audio_sink(audio_capture_required ? audio_sink_capacity : 0);
+
+    std::unique_ptr<LockstepChecker> lockstep_checker;
+    if (lockstep_diff) {
+        lockstep_checker = std::unique_ptr<LockstepChecker>(new LockstepChecker());
+
+        // The model has no audio block, so a passing run says nothing about audio
+        std::cout << "--diff: only video is checked against the VDP model, audio output is not compared" << std::endl;
+    }
 
 #if VCD_WRITE
-    sim.trace("ics.vcd");
+    sim.trace(trace_config);
 #endif
 
-    bool vga_hsync_previous = true;
-    bool vga_vsync_previous = true;
-
     // Audio init
 
+#if SDL_SUPPORT
+    // Passes samples to the SDL audio thread, with room for a few callbacks worth of samples
+    const size_t audio_ring_capacity = 16384;
+    AudioRing audio_ring(enable_audio_output ? audio_ring_capacity : 1);
+
     SDL_AudioDeviceID audio_device_id = 0;
     if (enable_audio_output) {
-        audio_device_id = init_sdl_audio();
+        audio_device_id = init_sdl_audio(&audio_ring);
     }
+#endif
 
     sim.clk_1x = 0;
     sim.clk_2x = 0;
 
-    uint64_t time = 0;
-    uint64_t previous_ticks = 0;
-
-    const auto sdl_poll_interval = 10000;
-    auto sdl_poll_counter = sdl_poll_interval;
-
-    std::vector<int16_t> audio_samples;
-
-    while (!sim.finished() && (time / 2) < sim_cycles) {
-        sim.clk_2x = 0;
-        sim.step(time);
-        time++;
-
-        sim.clk_2x = 1;
-        sim.clk_1x = time & 2;
-        sim.step(time);
-        time++;
-
-        const auto extend_color = [] (uint8_t component) {
-            return component | component << 4;
-        };
-
-        // Plot current output pixel
-        bool active_display = sim.vsync() && sim.hsync();
-        bool in_bounds = current_x < total_width && current_y < total_height;
-        if (active_display && in_bounds) {
-            pixels[pixel_index++] = extend_color(sim.r());
-            pixels[pixel_index++] = extend_color(sim.g());
-            pixels[pixel_index++] = extend_color(sim.b());
-        } else if (active_display) {
-            std::cout << "Attempted to draw out of bounds pixel: (" << current_x << ", " << current_y << ")" << std::endl;
+    // Resuming from a save state skips the boot process entirely
+
+    if (!load_state_path.empty()) {
+        if (!sim.load_state(load_state_path, frame_sink)) {
+            return EXIT_FAILURE;
         }
 
-        current_x++;
+        std::cout << "Resumed from save state at cycle: " << sim.cycle_count() << std::endl;
+    }
 
-        const auto update_pixel_index = [&] () {
-            pixel_index = current_y * total_width * rgb24_size;
-        };
+    // -t counts cycles from wherever the run starts, including a restored state
+    const uint64_t start_cycle = sim.cycle_count();
+    const uint64_t end_cycle = start_cycle + std::min<uint64_t>(sim_cycles, std::numeric_limits<uint64_t>::max() - start_cycle);
 
-        if (!sim.hsync()) {
-            current_x = 0;
-            update_pixel_index();
-        }
+    uint64_t frame_count = 0;
+    auto previous_frame_time = std::chrono::steady_clock::now();
 
-        if (sim.hsync() && !vga_hsync_previous) {
-            current_y++;
-            update_pixel_index();
-        }
+    // Telemetry (optional)
 
-        vga_hsync_previous = sim.hsync();
+    auto elapsed_ns = [](std::chrono::steady_clock::time_point start) -> uint64_t {
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    };
 
-        if (!sim.vsync()) {
-            current_y = 0;
-            update_pixel_index();
-        }
+    const auto session_start_time = previous_frame_time;
+    Telemetry::Frame telemetry_frame;
+    uint64_t telemetry_frame_start_cycle = sim.cycle_count();
+    uint64_t telemetry_frame_start_flash_ns = 0;
+    uint64_t telemetry_frame_start_present_ns = 0;
+
+    // Frames are presented on the main thread, so its running total is sampled once per frame like the flash time
+    auto present_time_ns = [&]() -> uint64_t {
+#if SDL_SUPPORT
+        return presenter ? presenter->present_time_ns() : 0;
+#else
+        return 0;
+#endif
+    };
 
-        if (sim.vsync() && !vga_vsync_previous) {
-            const auto stride = total_width * rgb24_size;
-            SDL_UpdateTexture(texture, NULL, pixels, stride);
-            SDL_RenderCopy(renderer, texture, NULL, NULL);
-            SDL_RenderPresent(renderer);
+    if (telemetry) {
+        // Flash timing has some overhead so it's only enabled when needed
+        sim.flash_model().enable_update_timing = true;
+        telemetry_frame_start_flash_ns = sim.flash_model().update_time_ns();
+    }
 
-            // Simulate gamepad input with keyboard
+#if SDL_SUPPORT
+    // Windowed runs return to the host loop periodically to check whether the window was closed
+    const uint64_t sdl_poll_interval = 10000;
+#endif
 
-            SDL_PumpEvents();
-            const Uint8 *state = SDL_GetKeyboardState(NULL);
+    bool wav_write_failed = false;
+    bool telemetry_failed = false;
+    bool flash_profile_failed = false;
+    bool pc_profile_failed = false;
+    bool copper_trace_failed = false;
+    bool vdp_usage_failed = false;
+    bool present_failed = false;
+    bool video_failed = false;
+    bool trace_failed = false;
+    bool video_mode_detected = false;
+    bool input_recording_failed = false;
+    bool frame_dump_failed = false;
+    bool save_state_failed = false;
+    bool state_saved = false;
+
+    // Runs on its own thread for windowed runs, with the main thread presenting frames and handling SDL events
+    auto run_sim = [&] {
+        while (sim.cycle_count() < end_cycle && frame_count < sim_frames && !stop_conditions.stopped()) {
+            uint64_t batch_cycles = end_cycle - sim.cycle_count();
+#if SDL_SUPPORT
+            if (!headless) {
+                batch_cycles = std::min(batch_cycles, sdl_poll_interval);
+            }
+#endif
+            if (pc_profiler) {
+                batch_cycles = std::min(batch_cycles, pc_profiler->cycles_until_sample());
+            }
 
-            sim.button_user = state[SDL_SCANCODE_LSHIFT];
-            sim.button_1 = state[SDL_SCANCODE_RIGHT];
-            sim.button_2 = state[SDL_SCANCODE_RSHIFT];
-            sim.button_3 = state[SDL_SCANCODE_LEFT];
+            auto sim_start_time = std::chrono::steady_clock::now();
 
-            sim.button_up = state[SDL_SCANCODE_UP];
-            sim.button_down = state[SDL_SCANCODE_DOWN];
+            auto result = lockstep_checker ?
+                lockstep_checker->run_cycles(sim, batch_cycles, frame_sink, audio_sink) :
+                sim.run_cycles(batch_cycles, frame_sink, audio_sink);
 
-            sim.button_l = state[SDL_SCANCODE_Q];
-            sim.button_r = state[SDL_SCANCODE_W];
+            telemetry_frame.sim_ns += elapsed_ns(sim_start_time);
 
-            sim.button_x = state[SDL_SCANCODE_A];
-            sim.button_a = state[SDL_SCANCODE_S];
-            sim.button_y = state[SDL_SCANCODE_Z];
+            if (pc_profiler) {
+                pc_profiler->sample();
+            }
 
-            sim.button_start = state[SDL_SCANCODE_E];
-            sim.button_select = state[SDL_SCANCODE_R];
-            
-            // Measure time spent to render frame
+            // Audio capture (optional)
 
-            uint64_t current_ticks = SDL_GetTicks();
-            double delta = current_ticks - previous_ticks;
-            auto fps_estimate = 1 / (delta / 1000.f);
-            std::cout << "Frame drawn in: " << delta << "ms, " << fps_estimate << "fps" << std::endl;
-            previous_ticks = current_ticks;
-        }
+            if (audio_sink.size() > 0) {
+                const int16_t *samples = audio_sink.samples();
+                telemetry_frame.audio_samples += audio_sink.size() / 2;
+#if SDL_SUPPORT
+                if (enable_audio_output) {
+                    audio_ring.push(samples, audio_sink.size() / 2);
+                }
+#endif
 
-        vga_vsync_previous = sim.vsync();
+                if (wav_output_required && !wav_writer.write(samples, audio_sink.size())) {
+                    wav_write_failed = true;
+                    break;
+                }
 
-        // Audio capture (optional)
+                audio_sink.clear();
+            }
 
-        if (audio_capture_required) {
-            int16_t audio_left, audio_right;
-            if (sim.get_samples(&audio_left, &audio_right)) {
-                if (enable_audio_output) {
-                    audio_callback_samples.push_back(audio_left);
-                    audio_callback_samples.push_back(audio_right);
+            if (result == Simulation::RunResult::FINISHED) {
+                break;
+            }
+
+            if (result == Simulation::RunResult::FRAME_COMPLETE) {
+                // A frame resized for a newly detected mode has nothing drawn in it so it isn't output
+                bool frame_resized = false;
+                if (!video_mode_detected) {
+                    video_mode_detected = detect_video_mode(&frame_resized);
+                }
+
+                if (!frame_resized && frame_dumper && !frame_dumper->dump(frame_count, frame_sink)) {
+                    frame_dump_failed = true;
+                    break;
                 }
 
-                if (wav_output_required) {
-                    audio_samples.push_back(audio_left);
-                    audio_samples.push_back(audio_right);
+                // Every frame is streamed, including a blank one in place of a resized frame, to stay in sync with the audio
+                if (video_writer && !video_writer->write(frame_sink)) {
+                    video_failed = true;
+                    break;
+                }
+
+#if SDL_SUPPORT
+                if (!headless) {
+                    // The frame can also be resized by loading a save state made in another mode
+                    bool presenter_resized = presenter->frame_width() != frame_sink.frame_width() ||
+                        presenter->frame_height() != frame_sink.frame_height();
+
+                    if (presenter_resized) {
+                        // The window is resized along with the texture on the main thread, which owns both
+                        if (!presenter->resize(frame_sink.frame_width(), frame_sink.frame_height())) {
+                            present_failed = true;
+                            break;
+                        }
+                    }
+
+                    if (!frame_resized) {
+                        presenter->submit(frame_sink);
+                    }
+                }
+
+                if (!headless && !input_replay) {
+                    // Simulate gamepad input with keyboard, as of the last time the main thread handled events
+
+                    auto state = presenter->keyboard_state();
+
+                    sim.button_user = state[SDL_SCANCODE_LSHIFT];
+                    sim.button_1 = state[SDL_SCANCODE_RIGHT];
+                    sim.button_2 = state[SDL_SCANCODE_RSHIFT];
+                    sim.button_3 = state[SDL_SCANCODE_LEFT];
+
+                    sim.button_up = state[SDL_SCANCODE_UP];
+                    sim.button_down = state[SDL_SCANCODE_DOWN];
+
+                    sim.button_l = state[SDL_SCANCODE_Q];
+                    sim.button_r = state[SDL_SCANCODE_W];
+
+                    sim.button_x = state[SDL_SCANCODE_A];
+                    sim.button_a = state[SDL_SCANCODE_S];
+                    sim.button_y = state[SDL_SCANCODE_Z];
+
+                    sim.button_start = state[SDL_SCANCODE_E];
+                    sim.button_select = state[SDL_SCANCODE_R];
+                }
+#endif
+
+                // Input movies (optional)
+
+                if (input_replay) {
+                    InputMovie::apply(sim, input_replay->frame_buttons(frame_count));
+                } else if (input_recording && !input_recording->record(InputMovie::buttons(sim))) {
+                    std::cerr << "Failed to write input movie: " << record_path << std::endl;
+                    input_recording_failed = true;
+                    break;
                 }
+
+                if (save_state_frame >= 0 && frame_count == (uint64_t)save_state_frame) {
+                    save_state_failed = !sim.save_state(save_state_path, frame_sink);
+                    state_saved = true;
+                }
+
+                frame_count++;
+
+                // Measure time spent to render frame, which is only printed for windowed runs to keep batch output short
+
+                auto current_frame_time = std::chrono::steady_clock::now();
+                if (!headless) {
+                    double delta = std::chrono::duration<double, std::milli>(current_frame_time - previous_frame_time).count();
+                    auto fps_estimate = 1 / (delta / 1000.f);
+                    std::cout << "Frame drawn in: " << delta << "ms, " << fps_estimate << "fps" << std::endl;
+                }
+
+                if (telemetry) {
+                    telemetry_frame.frame = frame_count - 1;
+                    telemetry_frame.cycles = sim.cycle_count() - telemetry_frame_start_cycle;
+                    telemetry_frame.flash_ns = sim.flash_model().update_time_ns() - telemetry_frame_start_flash_ns;
+                    telemetry_frame.present_ns = present_time_ns() - telemetry_frame_start_present_ns;
+                    telemetry_frame.frame_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(current_frame_time - previous_frame_time).count();
+
+                    if (!telemetry->record(telemetry_frame)) {
+                        std::cerr << "Failed to write telemetry: " << telemetry_path << std::endl;
+                        telemetry_failed = true;
+                        break;
+                    }
+
+                    telemetry_frame_start_cycle = sim.cycle_count();
+                    telemetry_frame_start_flash_ns = sim.flash_model().update_time_ns();
+                    telemetry_frame_start_present_ns = present_time_ns();
+                }
+
+                if (flash_profiler && !flash_profiler->end_frame(frame_count - 1)) {
+                    std::cerr << "Failed to write flash profile: " << flash_profile_path << std::endl;
+                    flash_profile_failed = true;
+                    break;
+                }
+
+                if (pc_profiler && !pc_profiler->end_frame(frame_count - 1)) {
+                    std::cerr << "Failed to write PC profile: " << pc_profile_path << std::endl;
+                    pc_profile_failed = true;
+                    break;
+                }
+
+                if (vdp_usage_profiler && !vdp_usage_profiler->end_frame(frame_count - 1)) {
+                    std::cerr << "Failed to write VDP usage profile: " << vdp_usage_path << std::endl;
+                    vdp_usage_failed = true;
+                    break;
+                }
+
+                telemetry_frame = Telemetry::Frame();
+                previous_frame_time = current_frame_time;
             }
-        }
 
-        // Exit check
+            // Exit check
 
-        if (!(--sdl_poll_counter)) {
-            SDL_Event e;
-            if (SDL_PollEvent(&e) && (e.type == SDL_QUIT)) {
+#if SDL_SUPPORT
+            if (!headless && presenter->quit_requested()) {
                 std::cout << "Quitting.." << "\n";
                 break;
             }
+#endif
+        }
 
-            sdl_poll_counter = sdl_poll_interval;
+#if SDL_SUPPORT
+        // Lets the main thread return from presenting once any pending frame is shown
+        if (presenter) {
+            presenter->stop();
         }
+#endif
     };
 
+#if SDL_SUPPORT
+    if (!headless) {
+        // SDL rendering and events have to stay on the main thread on some platforms (macOS) so the sim is moved off it
+        std::thread sim_thread(run_sim);
+        presenter->run();
+        sim_thread.join();
+    } else {
+        run_sim();
+    }
+#else
+    run_sim();
+#endif
+
+    // The state at the stop is printed here and can also be saved with --save-state
+
+    if (stop_conditions.stopped()) {
+        stop_conditions.report(std::cout, stop_symbols.get());
+    }
+
+    if (!save_state_path.empty() && !state_saved) {
+        save_state_failed = !sim.save_state(save_state_path, frame_sink);
+    }
+
     sim.final();
 
+#if VCD_WRITE
+    trace_failed = !sim.trace_good();
+#endif
+
+#if SDL_SUPPORT
     if (audio_device_id >= 2) {
         SDL_CloseAudioDevice(audio_device_id);
+
+        std::cout << "Audio underruns: " << audio_ring.underrun_count()
+            << ", overruns: " << audio_ring.overrun_count() << " (stereo samples)" << std::endl;
     }
 
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    if (!headless) {
+        std::cout << "Frames presented: " << presenter->presented_count()
+            << ", unchanged: " << presenter->unchanged_count()
+            << ", dropped: " << presenter->dropped_count()
+            << ", rows uploaded: " << presenter->rows_uploaded_count() << std::endl;
 
-    std::free(pixels);
+        presenter.reset();
+        SDL_DestroyWindow(window);
+    }
 
-    if (wav_output_required) {
-        if (!write_captured_audio(wav_output_path, audio_samples)) {
-            return EXIT_FAILURE;
-        }
+    if (sdl_required) {
+        SDL_Quit();
     }
+#endif
 
-    return EXIT_SUCCESS;
-}
+    if (wav_output_required && !wav_writer.close()) {
+        wav_write_failed = true;
+    }
 
-// Audio related functions:
+    if (video_writer && !video_writer->close()) {
+        video_failed = true;
+    }
+
+    if (telemetry && !telemetry->close(elapsed_ns(session_start_time))) {
+        telemetry_failed = true;
+    }
+
+    if (input_recording && !input_recording->close()) {
+        input_recording_failed = true;
+    }
+
+    if (flash_profiler && !flash_profiler->close()) {
+        flash_profile_failed = true;
+    }
 
-bool write_captured_audio(const std::string &path, const std::vector<int16_t> &samples) {
-    TinyWav tw;
-    auto open_status = tinywav_open_write(
-        &tw,
-        2,
-        44100,
-        TW_INT16,
-        TW_INTERLEAVED,
-        path.c_str()
-    );
+    if (pc_profiler && !pc_profiler->close()) {
+        pc_profile_failed = true;
+    }
+
+    if (copper_tracer && !copper_tracer->close()) {
+        copper_trace_failed = true;
+    }
 
-    if (open_status) {
-        std::cerr << "Failed to open WAV file for writing: " << path << std::endl;
-        return false;
+    if (vdp_usage_profiler && !vdp_usage_profiler->close()) {
+        vdp_usage_failed = true;
     }
 
-    // tinywav expects floats regardless of the encoded format
-    std::vector<float> float_samples;
-    for (auto sample : samples) {
-        float_samples.push_back(((float)sample) / 32767);
+    if (frame_dump_failed || save_state_failed || wav_write_failed || input_recording_failed || telemetry_failed ||
+        flash_profile_failed || pc_profile_failed || copper_trace_failed || vdp_usage_failed || present_failed ||
+        video_failed || trace_failed) {
+        return EXIT_FAILURE;
+    }
+
+    if (lockstep_checker) {
+        if (lockstep_checker->mismatch_found()) {
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "No model mismatches found in " << lockstep_checker->lines_compared() << " lines (audio not checked)" << std::endl;
     }
 
-    tinywav_write_f(&tw, &float_samples[0], (int)(float_samples.size() / 2));
-    tinywav_close_write(&tw);
+    int stop_exit_status = stop_conditions.exit_status();
+    if (stop_exit_status == StopConditions::NOT_HIT_EXIT_STATUS && !stop_conditions.stopped()) {
+        std::cerr << "Run ended before an --until or --exit-on-write condition was hit" << std::endl;
+    }
 
-    return true;
+    return stop_exit_status;
 }
 
-SDL_AudioDeviceID init_sdl_audio() {
+// Audio related functions:
+
+#if SDL_SUPPORT
+
+SDL_AudioDeviceID init_sdl_audio(AudioRing *ring) {
     SDL_AudioSpec want, have;
     SDL_AudioDeviceID dev;
 
+    // The audio block outputs a sample every fixed number of pixel clocks, which is only roughly 44.1KHz
     SDL_memset(&want, 0, sizeof(want));
-    want.freq = 44100;
+    want.freq = VDPTiming::mode_configured().audio_sample_rate();
     want.format = AUDIO_S16;
     want.channels = 2;
     want.samples = 4096;
     want.callback = audio_callback;
+    want.userdata = ring;
 
     dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
     if (dev == 0) {
@@ -402,6 +1234,8 @@ SDL_AudioDeviceID init_sdl_audio() {
             std::cerr << "Could not open device with SDL AUDIO_S16 format" << std::endl;
         }
 
+        std::cout << "Audio output: " << have.freq << "Hz" << std::endl;
+
         SDL_PauseAudioDevice(dev, 0);
     }
 
@@ -410,13 +1244,11 @@ SDL_AudioDeviceID init_sdl_audio() {
 
 // SDL audio callback:
 
-void audio_callback(void *userdata, Uint8 *stream, int len) {
-    std::memset(stream, 0, len);
-
-    size_t length = std::min((size_t)len / 4, audio_callback_samples.size() / 2);
-    int16_t *samples = (int16_t *)stream;
-    std::copy(audio_callback_samples.cbegin(), audio_callback_samples.cbegin() + length, samples);
-    audio_callback_samples.erase(audio_callback_samples.cbegin(), audio_callback_samples.cbegin() + length);
+// This runs on the SDL audio thread so it must not block, allocate or log
 
-    std::cout << "Audio: copied " << length << " stereo samples" << "\n";
+void audio_callback(void *userdata, Uint8 *stream, int len) {
+    auto ring = static_cast<AudioRing *>(userdata);
+    ring->pop((int16_t *)stream, (size_t)len / 4);
 }
+
+#endif
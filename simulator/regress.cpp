@@ -0,0 +1,152 @@
+// regress.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Demo regression runner, built against one of the sim implementations like main.cpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <getopt.h>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/stat.h>
+
+#include "RegressionRunner.hpp"
+
+#ifdef SIM_VERILATOR
+
+#include "VerilatorSimulation.hpp"
+typedef VerilatorSimulation SimulationImpl;
+const std::string title = "verilator";
+// Older Verilator versions keep the sim time in process wide state, so only one demo can run at a time
+const bool parallel_supported = VERILATOR_SIM_CONTEXT;
+const bool audio_supported = true;
+
+#elif defined(SIM_CXXRTL)
+
+#include "CXXRTLSimulation.hpp"
+typedef CXXRTLSimulation SimulationImpl;
+const std::string title = "cxxrtl";
+const bool parallel_supported = true;
+const bool audio_supported = true;
+
+#elif defined(SIM_ISS)
+
+#include "ISSSimulation.hpp"
+typedef ISSSimulation SimulationImpl;
+const std::string title = "iss";
+const bool parallel_supported = true;
+// The ISS has no audio, so its output is always silent
+const bool audio_supported = false;
+
+#else
+
+#error Expected one of SIM_VERILATOR, SIM_CXXRTL or SIM_ISS to be defined
+
+#endif
+
+enum LongOption {
+    OPT_UPDATE = 0x100,
+    OPT_GOLDENS
+};
+
+static const struct option long_options[] = {
+    {"update", no_argument, NULL, OPT_UPDATE},
+    {"goldens", required_argument, NULL, OPT_GOLDENS},
+    {NULL, 0, NULL, 0}
+};
+
+static bool create_directories(const std::string &path) {
+    // Each parent is created up to the next separator, skipping a leading one for absolute paths
+    for (size_t end = path.find('/', 1); end != std::string::npos; end = path.find('/', end + 1)) {
+        std::string directory = path.substr(0, end);
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+int main(int argc, const char **argv) {
+    if (argc < 2) {
+        std::cout << "Usage: <sim>_regress [options] <manifest> [demo names...]" << std::endl;
+        std::cout << std::endl;
+        std::cout << "  -j <jobs>                Number of demos to run at once (default: number of cores)" << std::endl;
+        std::cout << "  --goldens <dir>          Golden directory (default: goldens/" << title << " next to the manifest)" << std::endl;
+        std::cout << "  --update                 Write goldens from this run instead of comparing against them" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    unsigned job_count = parallel_supported ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+    std::string golden_dir = "";
+    bool update = false;
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, (char **)argv, "j:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j': {
+                long jobs = strtol(optarg, NULL, 10);
+                if (jobs <= 0) {
+                    std::cerr << "-j argument must be a non-zero positive integer" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                if (jobs > 1 && !parallel_supported) {
+                    std::cerr << "-j greater than 1 requires a sim built with Verilator 4.200 or later" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                job_count = jobs;
+            } break;
+            case OPT_GOLDENS:
+                golden_dir = optarg;
+                if (golden_dir.empty()) {
+                    std::cerr << "Golden directory must not be empty" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_UPDATE:
+                update = true;
+                break;
+            case '?':
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cerr << "Expected manifest path after any options" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string manifest_path = argv[optind++];
+
+    if (golden_dir.empty()) {
+        size_t separator = manifest_path.find_last_of('/');
+        std::string manifest_dir = (separator == std::string::npos ? "." : manifest_path.substr(0, separator));
+        golden_dir = manifest_dir + "/goldens/" + title;
+    }
+
+    if (update && !create_directories(golden_dir)) {
+        std::cerr << "Failed to create golden directory: " << golden_dir << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    RegressionRunner runner([] (const QSPIFlashSim &flash) {
+        return std::unique_ptr<Simulation>(new SimulationImpl(flash));
+    }, audio_supported);
+
+    if (!runner.load_manifest(manifest_path)) {
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> demo_names(argv + optind, argv + argc);
+    if (!demo_names.empty() && !runner.select_demos(demo_names)) {
+        return EXIT_FAILURE;
+    }
+
+    return runner.run(golden_dir, job_count, update) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
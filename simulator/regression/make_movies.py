@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+'''
+Generate the scripted input movies used by demos.txt for the interactive demos.
+
+Each movie is a fixed sequence of button presses rather than a recording, so it doesn't
+depend on the toolchain or sim the demos are run with. Movies recorded with --record
+can be used in the manifest in the same way.
+
+Usage:
+    make_movies.py [output dir]    (default: movies/ next to this script)
+'''
+# SPDX-License-Identifier: MIT
+import os
+import struct
+import sys
+
+# See InputMovie.hpp for the format
+MAGIC = b'ics32inp'
+VERSION = 1
+
+# InputMovie::Button bits, named after the gamepad buttons the demos see (see pad_btn in ics32_tb.v)
+RIGHT = 1 << 1      # button_1
+B = 1 << 2          # button_2
+LEFT = 1 << 3       # button_3
+UP = 1 << 4
+DOWN = 1 << 5
+L = 1 << 6
+R = 1 << 7
+X = 1 << 8
+A = 1 << 9
+Y = 1 << 10
+START = 1 << 11
+SELECT = 1 << 12
+
+# Each demo has a frame count matching demos.txt and a list of (first frame, frames held, buttons)
+# Presses are separated by at least one released frame since most demos act on button edges
+MOVIES = {
+    'tetris': (300, [
+        (30, 4, START),
+        (70, 2, LEFT), (76, 2, LEFT), (90, 2, B),
+        (110, 2, DOWN),
+        (150, 2, RIGHT), (156, 2, RIGHT), (162, 2, Y), (180, 2, DOWN),
+        (220, 2, L), (226, 2, R), (240, 2, DOWN),
+    ]),
+    'platformer': (300, [
+        (20, 100, RIGHT), (60, 20, B),
+        (140, 100, LEFT), (180, 4, B),
+        (260, 20, RIGHT | B),
+    ]),
+    'affine_platformer': (300, [
+        (20, 100, RIGHT), (60, 20, B),
+        (140, 100, LEFT), (180, 4, B),
+        (260, 20, RIGHT | B),
+    ]),
+    'audio_drumkit': (300, [
+        (30, 2, B), (90, 2, LEFT), (150, 2, RIGHT),
+        (210, 2, B | LEFT | RIGHT), (240, 30, B),
+    ]),
+}
+
+
+def movie_frames(frame_count, presses):
+    frames = [0] * frame_count
+    for first, length, buttons in presses:
+        for frame in range(first, min(first + length, frame_count)):
+            frames[frame] |= buttons
+
+    return frames
+
+
+def main():
+    output_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), 'movies')
+    os.makedirs(output_dir, exist_ok=True)
+
+    for name, (frame_count, presses) in sorted(MOVIES.items()):
+        path = os.path.join(output_dir, name + '.inp')
+        with open(path, 'wb') as f:
+            f.write(MAGIC)
+            f.write(struct.pack('<I', VERSION))
+            for buttons in movie_frames(frame_count, presses):
+                f.write(struct.pack('<H', buttons))
+
+        print(path)
+
+
+if __name__ == '__main__':
+    main()
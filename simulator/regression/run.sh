@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Builds the demos listed in demos.txt and the regression runner, then runs all demos
+# Usage: ./run.sh [sim] [runner options...], where sim is one of verilator (default), cxxrtl or iss
+
+# Goldens depend on the toolchain the demos were built with, so none are committed
+# Any that are missing from goldens/<sim>/ are generated from this build first, with a warning that those demos
+# weren't actually checked
+
+set -e
+
+cd "$(dirname "$0")"
+
+SIM=${1:-verilator}
+shift || true
+
+for DEMO in $(grep -v '^#' demos.txt | awk '{ print $2 }'); do
+    make -C "$(dirname "$DEMO")"
+done
+
+make -C .. ${SIM}_regress SDL_SUPPORT=0
+
+# Goldens in another directory or being updated anyway are left to the runner
+GENERATE_MISSING=1
+for ARG in "$@"; do
+    if [ "$ARG" == "--update" ] || [ "$ARG" == "--goldens" ]; then
+        GENERATE_MISSING=0
+    fi
+done
+
+if [ $GENERATE_MISSING -eq 1 ]; then
+    MISSING=""
+    for NAME in $(grep -v '^#' demos.txt | awk '{ print $1 }'); do
+        if [ ! -f "goldens/${SIM}/${NAME}.golden" ]; then
+            MISSING="$MISSING $NAME"
+        fi
+    done
+
+    if [ -n "$MISSING" ]; then
+        echo "################################################################################"
+        echo "WARNING: no ${SIM} goldens for:${MISSING}"
+        echo "Generating them from this build, so these demos are NOT checked for regressions"
+        echo "Check their output and keep regression/goldens/${SIM}/ to compare against later"
+        echo "################################################################################"
+
+        ../${SIM}_regress --update demos.txt $MISSING
+    fi
+fi
+
+../${SIM}_regress demos.txt "$@"
@@ -32,12 +32,12 @@ int tinywav_open_write(TinyWav *tw,
     TinyWavSampleFormat sampFmt, TinyWavChannelFormat chanFmt,
     const char *path) {
 #if _WIN32
-  errno_t err = fopen_s(&tw->f, path, "w");
-  assert(err == 0);
+  errno_t err = fopen_s(&tw->f, path, "wb");
+  if (err != 0) return -1;
 #else
-  tw->f = fopen(path, "w");
+  tw->f = fopen(path, "wb");
 #endif
-  assert(tw->f != NULL);
+  if (tw->f == NULL) return -1;
   tw->numChannels = numChannels;
   tw->totalFramesWritten = 0;
   tw->sampFmt = sampFmt;
@@ -238,6 +238,15 @@ size_t tinywav_write_f(TinyWav *tw, void *f, int len) {
   }
 }
 
+size_t tinywav_write_i16(TinyWav *tw, const int16_t *samples, int len) {
+  // int16 samples are written as-is, without the float conversion of tinywav_write_f()
+  if (tw->sampFmt != TW_INT16 || tw->chanFmt != TW_INTERLEAVED) return 0;
+
+  size_t written = fwrite(samples, sizeof(int16_t), tw->numChannels*len, tw->f);
+  tw->totalFramesWritten += written / tw->numChannels;
+  return written;
+}
+
 void tinywav_close_write(TinyWav *tw) {
   uint32_t data_len = tw->totalFramesWritten * tw->numChannels * tw->sampFmt;
 
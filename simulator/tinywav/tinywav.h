@@ -73,7 +73,7 @@ typedef struct TinyWav {
  * @param chanFmt      The channel format (how the channel data is layed out in memory)
  * @param path         The path of the file to write to. The file will be overwritten.
  *
- * @return  The error code. Zero if no error.
+ * @return  The error code. Zero if no error, -1 if the file couldn't be opened.
  */
 int tinywav_open_write(TinyWav *tw,
     int16_t numChannels, int32_t samplerate,
@@ -116,6 +116,18 @@ void tinywav_close_read(TinyWav *tw);
  */
 size_t tinywav_write_f(TinyWav *tw, void *f, int len);
 
+/**
+ * Write interleaved int16 sample data to file without any conversion.
+ * The file must have been opened with TW_INT16 and TW_INTERLEAVED.
+ *
+ * @param tw       The TinyWav structure which has already been prepared.
+ * @param samples  A pointer to the interleaved sample data to write.
+ * @param len      The number of frames to write.
+ *
+ * @return The total number of samples written to file.
+ */
+size_t tinywav_write_i16(TinyWav *tw, const int16_t *samples, int len);
+
 /** Stop writing to the file. The Tinywav struct is now invalid. */
 void tinywav_close_write(TinyWav *tw);
 
@@ -0,0 +1,142 @@
+// VDPCopper.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "VDPCopper.hpp"
+
+void VDPCopper::reset() {
+    pc = 0;
+    target_x = 0;
+    target_y = 0;
+    state = State::OP_PREFETCH;
+}
+
+VDPCopper::RegisterWrite VDPCopper::step(uint16_t raster_x, uint16_t raster_y) {
+    RegisterWrite write = {false, 0, 0};
+
+    const uint16_t word = ram[pc];
+
+    execution.valid = (state == State::OP_DECODE || state == State::DATA_FETCH);
+    execution.data = (state == State::DATA_FETCH);
+    execution.pc = pc;
+    execution.word = word;
+    execution.raster_x = raster_x;
+    execution.raster_y = raster_y;
+
+    switch (state) {
+        case State::OP_PREFETCH:
+            state = State::OP_DECODE;
+            break;
+        case State::OP_DECODE: {
+            Op op = (Op)(word >> 14);
+
+            switch (op) {
+                case Op::SET_TARGET: {
+                    bool wait = word & (1 << 12);
+                    bool select_y = word & (1 << 11);
+                    uint16_t value = word & 0x7ff;
+
+                    if (select_y) {
+                        target_y = value & 0x3ff;
+                    } else {
+                        target_x = value;
+                    }
+
+                    state = (wait ? State::RASTER_WAITING : State::OP_DECODE);
+                    pc = (pc + 1) % ram_size;
+                } break;
+                case Op::WRITE_REG:
+                    write_target_reg = word & 0x1f;
+                    write_batch_count = (word >> 6) & 0x1f;
+                    write_auto_wait = word & (1 << 11);
+                    write_increment_mode = (word >> 12) & 0x03;
+                    write_counter = 0;
+
+                    state = State::DATA_FETCH;
+                    pc = (pc + 1) % ram_size;
+                    break;
+                case Op::JUMP:
+                    pc = word & 0x7ff;
+                    state = State::OP_PREFETCH;
+                    break;
+                case Op::WRITE_COMPRESSED:
+                    write.valid = true;
+                    write.address = word & 0x1f;
+                    write.data = (word >> 6) & 0x1f;
+
+                    if (word & (1 << 11)) {
+                        target_y = (raster_y + 1) & 0x3ff;
+                    }
+
+                    pc = (pc + 1) % ram_size;
+                    break;
+            }
+
+            op_current = op;
+        } break;
+        case State::DATA_FETCH: {
+            uint8_t reg_offset = 0;
+            bool batch_complete = true;
+
+            switch (write_increment_mode) {
+                case 1:
+                    reg_offset = write_counter & 1;
+                    batch_complete = write_counter & 1;
+                    break;
+                case 2:
+                    reg_offset = write_counter & 3;
+                    batch_complete = (write_counter & 3) == 3;
+                    break;
+            }
+
+            write.valid = true;
+            write.address = (write_target_reg + reg_offset) & 0x1f;
+            write.data = word;
+
+            write_counter = (write_counter + 1) & 3;
+
+            if (batch_complete) {
+                if (write_batch_count == 0) {
+                    state = State::OP_DECODE;
+                } else {
+                    write_batch_count--;
+
+                    if (write_auto_wait) {
+                        target_y = (raster_y + 1) & 0x3ff;
+                        state = State::RASTER_WAITING;
+                    }
+                }
+            }
+
+            pc = (pc + 1) % ram_size;
+        } break;
+        case State::RASTER_WAITING:
+            if (target_hit(raster_x, raster_y)) {
+                bool resume_batch = (op_current == Op::WRITE_REG && write_auto_wait);
+                state = (resume_batch ? State::DATA_FETCH : State::OP_DECODE);
+            }
+            break;
+    }
+
+    return write;
+}
+
+uint32_t VDPCopper::idle_cycles(uint16_t raster_x, uint16_t raster_y, const VDPTiming &timing) const {
+    if (state != State::RASTER_WAITING) {
+        return 0;
+    }
+
+    const uint32_t frame_cycles = timing.frame_cycles();
+
+    if (target_x >= timing.h_total() || target_y >= timing.v_total()) {
+        // Target is never reached so the copper is stalled until it is reset
+        return frame_cycles;
+    }
+
+    uint32_t current = (uint32_t)raster_y * timing.h_total() + raster_x;
+    uint32_t target = (uint32_t)target_y * timing.h_total() + target_x;
+
+    return (target + frame_cycles - current) % frame_cycles;
+}
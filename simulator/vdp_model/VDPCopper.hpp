@@ -0,0 +1,90 @@
+// VDPCopper.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Functional model of vdp_copper.v
+// Executes one op (or data word) per VDP cycle and can skip ahead while waiting on a raster target
+
+#ifndef VDPCopper_hpp
+#define VDPCopper_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "VDPTiming.hpp"
+
+class VDPCopper {
+
+public:
+    static const size_t ram_size = 0x800;
+
+    struct RegisterWrite {
+        bool valid;
+        uint8_t address;
+        uint16_t data;
+    };
+
+    struct Execution {
+        bool valid;
+        // Set if word is data for a WRITE_REG op rather than an op
+        bool data;
+        uint16_t pc;
+        uint16_t word;
+        uint16_t raster_x;
+        uint16_t raster_y;
+    };
+
+    VDPCopper(const uint16_t *ram) : ram(ram) {}
+
+    /// Stops the copper and resets its PC, as the RTL does while the copper is disabled.
+    void reset();
+
+    /// Runs a single cycle at the given raster position.
+    /// Returns the register write made during this cycle, if any.
+    RegisterWrite step(uint16_t raster_x, uint16_t raster_y);
+
+    /// The op or data word executed by the last step(), which isn't valid if the copper was waiting or prefetching.
+    const Execution &last_execution() const { return execution; }
+
+    /// Number of cycles that can be skipped without the copper doing anything.
+    /// This is 0 unless the copper is waiting on a raster target.
+    uint32_t idle_cycles(uint16_t raster_x, uint16_t raster_y, const VDPTiming &timing) const;
+
+private:
+    enum class State {
+        OP_DECODE, DATA_FETCH, RASTER_WAITING, OP_PREFETCH
+    };
+
+    enum class Op {
+        SET_TARGET = 0,
+        WRITE_COMPRESSED = 1,
+        WRITE_REG = 2,
+        JUMP = 3
+    };
+
+    const uint16_t *ram;
+
+    State state = State::OP_PREFETCH;
+    Op op_current = Op::SET_TARGET;
+    uint16_t pc = 0;
+
+    Execution execution = {false, false, 0, 0, 0, 0};
+
+    uint16_t target_x = 0;
+    uint16_t target_y = 0;
+
+    // WRITE_REG working state
+    uint8_t write_target_reg = 0;
+    uint8_t write_batch_count = 0;
+    bool write_auto_wait = false;
+    uint8_t write_increment_mode = 0;
+    uint8_t write_counter = 0;
+
+    bool target_hit(uint16_t raster_x, uint16_t raster_y) const {
+        return target_x == raster_x && target_y == raster_y;
+    }
+};
+
+#endif /* VDPCopper_hpp */
@@ -0,0 +1,521 @@
+// VDPModel.cpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+#include "VDPModel.hpp"
+
+#include <algorithm>
+
+VDPModel::VDPModel(const VDPTiming &timing) :
+    timing(timing),
+    copper(copper_ram),
+    frame((size_t)timing.h_active * timing.v_active, 0),
+    frame_layers((size_t)timing.h_active * timing.v_active, (uint8_t)Layer::NONE),
+    sprite_line_display(sprite_line_size, 0),
+    sprite_line_pending(sprite_line_size, 0) {}
+
+// Host interface:
+
+void VDPModel::write(uint8_t reg, uint16_t data) {
+    render_pending();
+    write_register(reg & 0x1f, data);
+}
+
+uint16_t VDPModel::read(uint8_t reg) const {
+    return (reg & 0x02) ? current_y : current_x;
+}
+
+void VDPModel::write_copper_ram(uint16_t address, uint16_t data) {
+    copper_ram[address % VDPCopper::ram_size] = data;
+}
+
+void VDPModel::write_register(uint8_t reg, uint16_t data) {
+    if (reg & 0x10) {
+        switch ((reg >> 2) & 0x03) {
+            case 0: scroll_x[reg & 0x03] = data; break;
+            case 1: scroll_y[reg & 0x03] = data; break;
+        }
+
+        return;
+    }
+
+    switch (reg) {
+        case 0:
+            sprite_meta_address = data & 0xff;
+            sprite_meta_block = 0;
+            break;
+        case 1:
+            // Blocks are written in x, y, g order before moving on to the next sprite
+            switch (sprite_meta_block) {
+                case 0: sprite_x_block[sprite_meta_address] = data; break;
+                case 1: sprite_y_block[sprite_meta_address] = data; break;
+                case 2: sprite_g_block[sprite_meta_address] = data; break;
+            }
+
+            if (sprite_meta_block == 2) {
+                sprite_meta_address++;
+            }
+
+            sprite_meta_block = (sprite_meta_block + 1) % 3;
+            break;
+        case 2:
+            palette_address = data & 0xff;
+            break;
+        case 3:
+            palette[palette_address++] = data;
+            break;
+        case 4:
+            vram_address = data & 0x7fff;
+            break;
+        case 5:
+            write_vram(data);
+            break;
+        case 6:
+            vram_address_increment = data & 0xff;
+            break;
+        case 7:
+            sprite_tile_base = (data >> 10) & 0x0f;
+            break;
+        case 8:
+            copper_enable = data & 0x01;
+
+            if (!copper_enable) {
+                copper.reset();
+            }
+            break;
+        case 9:
+            scroll_tile_base = data;
+            break;
+        case 10:
+            scroll_map_base = data;
+            break;
+        case 11:
+            layer_enable = data & 0x3f;
+            break;
+        case 12:
+            alpha_over_enable = data & 0x1f;
+            break;
+        case 13:
+            scroll_use_wide_map = data & 0x0f;
+            break;
+        default:
+            break;
+    }
+}
+
+void VDPModel::write_vram(uint16_t data) {
+    current_line_usage.host_writes++;
+
+    // The affine layer has exclusive use of VRAM while it's fetching, which silently drops host writes
+    if (affine_enabled() && affine_fetching()) {
+        current_line_usage.host_writes_dropped++;
+    } else {
+        uint16_t word_address = (vram_address >> 1) % vram_size;
+
+        if (vram_address & 1) {
+            vram_odd[word_address] = data;
+        } else {
+            vram_even[word_address] = data;
+        }
+    }
+
+    vram_address = (vram_address + vram_address_increment) & 0x7fff;
+}
+
+bool VDPModel::affine_fetching() const {
+    // Fetching starts ahead of the active display to fill the affine pipeline (vdp.v affine_x_start)
+    return current_x >= timing.h_offscreen() - 16 || current_x == 0;
+}
+
+// Timing:
+
+void VDPModel::run(uint64_t cycles) {
+    while (cycles > 0) {
+        uint64_t skip = cycles;
+        copper_stepped = false;
+        line_ended = false;
+
+        if (copper_enable) {
+            uint32_t idle = copper.idle_cycles(current_x, current_y, timing);
+
+            if (!idle) {
+                auto write = copper.step(current_x, current_y);
+                copper_stepped = true;
+                if (write.valid) {
+                    render_pending();
+                    write_register(write.address, write.data);
+                }
+
+                skip = 1;
+            } else {
+                skip = std::min(skip, (uint64_t)idle);
+            }
+        }
+
+        cycles -= skip;
+
+        while (skip > 0) {
+            uint32_t line_remaining = timing.h_total() - current_x;
+            if (skip < line_remaining) {
+                current_x += skip;
+                break;
+            }
+
+            skip -= line_remaining;
+            advance_line();
+        }
+    }
+}
+
+bool VDPModel::copper_execution(VDPCopper::Execution *execution) const {
+    if (!copper_stepped || !copper.last_execution().valid) {
+        return false;
+    }
+
+    *execution = copper.last_execution();
+
+    return true;
+}
+
+bool VDPModel::line_usage(LineUsage *usage) const {
+    if (!line_ended) {
+        return false;
+    }
+
+    *usage = previous_line_usage;
+
+    return true;
+}
+
+void VDPModel::end_line_usage() {
+    LineUsage &usage = current_line_usage;
+    usage.raster_y = current_y;
+
+    // Fetching starts 16 cycles ahead of the active display and ends on the first cycle of the next line
+    usage.affine_slots = affine_enabled() ? timing.h_active + 16 + 1 : 0;
+
+    // Every 8 cycles has one host slot, one sprite slot and 6 layer slots
+    uint16_t shared_cycles = timing.h_total() - usage.affine_slots;
+    usage.host_slots = shared_cycles / 8;
+    usage.sprite_slots = shared_cycles / 8;
+    usage.layer_slots = shared_cycles - usage.host_slots - usage.sprite_slots;
+
+    usage.sprite_pixels_rendered = std::min(usage.sprite_pixels_hit, (uint16_t)(usage.sprite_slots * 8));
+
+    previous_line_usage = usage;
+    line_ended = true;
+
+    current_line_usage = {};
+}
+
+void VDPModel::advance_line() {
+    current_x = timing.h_total();
+    render_pending();
+    end_line_usage();
+
+    current_x = 0;
+    current_y++;
+
+    if (current_y == timing.v_total()) {
+        current_y = 0;
+        frames_completed++;
+    }
+
+    line_render_x = 0;
+
+    // The line buffer drawn during the previous line is now displayed
+    std::swap(sprite_line_display, sprite_line_pending);
+
+    uint16_t next_line = (current_y + 1) % timing.v_total();
+    if (next_line < timing.v_active) {
+        auto hits = render_sprite_line((next_line + sprite_line_offset) & 0x1ff, sprite_line_pending);
+        current_line_usage.sprites_hit = hits.sprites;
+        current_line_usage.sprite_pixels_hit = hits.pixels;
+    }
+}
+
+void VDPModel::sync_raster(uint16_t x, uint16_t y) {
+    current_x = x % timing.h_total();
+    current_y = y % timing.v_total();
+
+    line_render_x = (current_x > timing.h_offscreen() ? current_x - timing.h_offscreen() : 0);
+    line_render_x = std::min(line_render_x, timing.h_active);
+
+    // Both sprite line buffers depend on the raster position
+    render_sprite_line((current_y + sprite_line_offset) & 0x1ff, sprite_line_display);
+    auto hits = render_sprite_line((current_y + 1 + sprite_line_offset) & 0x1ff, sprite_line_pending);
+
+    current_line_usage = {};
+    current_line_usage.sprites_hit = hits.sprites;
+    current_line_usage.sprite_pixels_hit = hits.pixels;
+}
+
+// Rendering:
+
+void VDPModel::render_pending() {
+    if (current_y >= timing.v_active || current_x <= timing.h_offscreen()) {
+        return;
+    }
+
+    render_span(current_x - timing.h_offscreen());
+}
+
+void VDPModel::render_span(uint16_t x_end) {
+    if (line_render_x >= x_end) {
+        return;
+    }
+
+    // The blender checks the source alpha of the previous pixel when deciding if a source is visible
+    if (line_render_x == 0) {
+        previous_source_alpha = resolve_pixel(-1, current_y, 0).source_alpha;
+    }
+
+    size_t line_base = (size_t)current_y * timing.h_active;
+
+    for (uint16_t x = line_render_x; x < x_end; x++) {
+        auto resolved = resolve_pixel(x, current_y, previous_source_alpha);
+
+        frame[line_base + x] = resolved.color;
+        frame_layers[line_base + x] = resolved.layer;
+
+        previous_source_alpha = resolved.source_alpha;
+    }
+
+    line_render_x = x_end;
+}
+
+VDPModel::ResolvedPixel VDPModel::resolve_pixel(int32_t x, uint16_t y, uint8_t previous_source_alpha) const {
+    const uint8_t sprites_layer = 1 << (uint8_t)Layer::SPRITES;
+
+    // The standard VRAM arbiter only fetches 3 scroll layers and the affine layer replaces all of them
+    uint8_t layers = layer_enable & (affine_enabled() ? (sprites_layer | 0x01) : (sprites_layer | 0x07));
+
+    uint8_t scroll_pixels[4] = {0};
+    uint8_t opaque_layers = 0;
+
+    if (affine_enabled()) {
+        scroll_pixels[0] = affine_pixel(x, y);
+        opaque_layers |= (scroll_pixels[0] != 0);
+    } else {
+        for (uint8_t layer = 0; layer < 3; layer++) {
+            if (layers & (1 << layer)) {
+                scroll_pixels[layer] = scroll_pixel(layer, x, y);
+                opaque_layers |= (scroll_pixels[layer] & 0x0f ? 1 << layer : 0);
+            }
+        }
+    }
+
+    uint16_t sprite_entry = sprite_line_display[x & (sprite_line_size - 1)];
+    opaque_layers |= (sprite_entry & 0x0f ? sprites_layer : 0);
+
+    uint8_t visible_layers = layers & opaque_layers;
+
+    auto primary = prioritize(visible_layers & ~alpha_over_enable, scroll_pixels, sprite_entry);
+    auto masked = prioritize(visible_layers & alpha_over_enable, scroll_pixels, sprite_entry);
+
+    // A primary layer with higher priority than the alpha-over layer hides it entirely
+    bool masked_layer_enabled = masked.layer != Layer::NONE && !(primary.priority > masked.priority);
+
+    uint16_t source_color = palette[masked.pixel];
+    uint16_t dest_color = palette[primary.pixel];
+    bool source_visible = masked_layer_enabled && previous_source_alpha != 0;
+
+    ResolvedPixel resolved;
+    resolved.color = blend(source_color, dest_color, source_visible);
+    resolved.source_alpha = source_color >> 12;
+    resolved.layer = (uint8_t)primary.layer;
+
+    if (source_visible && (source_color >> 12)) {
+        resolved.layer |= LAYER_BLENDED;
+    }
+
+    return resolved;
+}
+
+VDPModel::PrioritizedPixel VDPModel::prioritize(uint8_t layers, const uint8_t *scroll_pixels, uint16_t sprite_entry) const {
+    // Scroll0 is the topmost scroll layer (encoded as 3) and scroll3 is the bottom one (encoded as 0)
+    // Sprites of priority p are drawn over the topmost scroll layer if (p * 2 + 1) > (encoded * 2)
+
+    Layer scroll_layer = Layer::SCROLL3;
+    uint8_t encoded_priority = 0;
+
+    for (int8_t layer = 2; layer >= 0; layer--) {
+        if (layers & (1 << layer)) {
+            scroll_layer = (Layer)layer;
+            encoded_priority = 3 - layer;
+        }
+    }
+
+    uint8_t layer_score = encoded_priority * 2;
+    uint8_t sprite_score = ((sprite_entry >> 8) & 0x03) * 2 + 1;
+
+    bool sprite_opaque = layers & (1 << (uint8_t)Layer::SPRITES);
+
+    if (sprite_opaque && sprite_score > layer_score) {
+        return {(uint8_t)(sprite_entry & 0xff), Layer::SPRITES, sprite_score};
+    } else if (layers & 0x0f) {
+        return {scroll_pixels[(uint8_t)scroll_layer], scroll_layer, layer_score};
+    } else {
+        return {0, Layer::NONE, 0};
+    }
+}
+
+uint16_t VDPModel::blend(uint16_t source_color, uint16_t dest_color, bool source_visible) {
+    // Same as the alpha LUT generated in vdp_blender.v
+
+    uint8_t source_alpha = source_visible ? source_color >> 12 : 0;
+    uint8_t dest_alpha = dest_color >> 12;
+
+    uint8_t source_multiplier = source_alpha ? source_alpha + 1 : 0;
+    uint8_t dest_multiplier = dest_alpha ? dest_alpha + 1 : 0;
+    dest_multiplier = ((16 - source_multiplier) * dest_multiplier) / 16;
+
+    uint16_t output = 0;
+
+    for (uint8_t shift = 0; shift < 12; shift += 4) {
+        uint8_t source = (((source_color >> shift) & 0x0f) * source_multiplier) >> 3;
+        uint8_t dest = (((dest_color >> shift) & 0x0f) * dest_multiplier) >> 3;
+
+        // Summed with 1 fraction bit before rounding
+        output |= (((source + dest + 1) >> 1) & 0x0f) << shift;
+    }
+
+    return output;
+}
+
+uint8_t VDPModel::scroll_pixel(uint8_t layer, int32_t x, uint16_t y) const {
+    uint16_t map_x = (scroll_x[layer] + x) & 0x3ff;
+    uint16_t map_y = (scroll_y[layer] + y) & 0x3ff;
+
+    uint8_t column = map_x >> 3;
+    uint8_t row = (map_y >> 3) & 0x3f;
+
+    bool wide_map = scroll_use_wide_map & (1 << layer);
+    bool map_page_select = wide_map && (column & 0x40);
+
+    uint16_t map_base = ((scroll_map_base >> (layer * 4)) & 0x07) << 12;
+    uint16_t map_address = ((map_page_select << 12 | row << 6 | (column & 0x3f)) + map_base) & 0x7fff;
+
+    // Map entry: ppppPYX tttttttt
+    // t: tile, X: x flip, Y: y flip, p: palette
+    uint16_t map_word_address = (map_address >> 1) % vram_size;
+    uint16_t map_entry = (map_address & 1) ? vram_odd[map_word_address] : vram_even[map_word_address];
+
+    uint8_t tile_row = (map_y & 0x07) ^ (map_entry & (1 << 10) ? 0x07 : 0);
+    uint16_t tile_base = ((scroll_tile_base >> (layer * 4)) & 0x07) << 11;
+    uint16_t tile_address = (tile_base + ((map_entry & 0x1ff) << 3) + tile_row) % vram_size;
+
+    uint32_t tile_row_data = vram_odd[tile_address] << 16 | vram_even[tile_address];
+
+    uint8_t tile_x = map_x & 0x07;
+    if (map_entry & (1 << 9)) {
+        tile_x ^= 0x07;
+    }
+
+    uint8_t pixel = (tile_row_data >> (28 - tile_x * 4)) & 0x0f;
+    uint8_t palette_number = map_entry >> 12;
+
+    return palette_number << 4 | pixel;
+}
+
+uint8_t VDPModel::affine_pixel(int32_t x, uint16_t y) const {
+    int16_t pretranslate_x = scroll_x[0];
+    int16_t pretranslate_y = scroll_y[1];
+
+    int16_t a = scroll_x[1];
+    int16_t b = scroll_x[2];
+    int16_t c = scroll_x[3];
+    int16_t d = scroll_y[0];
+
+    int16_t translate_x = scroll_y[2];
+    int16_t translate_y = scroll_y[3];
+
+    int16_t pretranslated_x = (x & 0x3ff) + pretranslate_x;
+    int16_t pretranslated_y = (y & 0x1ff) + pretranslate_y;
+
+    // The RTL accumulates into 26 bits with 10 fraction bits
+    const int64_t mask_26 = (1 << 26) - 1;
+
+    int64_t xt_full = (int64_t)pretranslated_x * a + (int64_t)pretranslated_y * b + ((int64_t)translate_x << 10) + (1 << 9);
+    int64_t yt_full = (int64_t)pretranslated_x * c + (int64_t)pretranslated_y * d + ((int64_t)translate_y << 10) + (1 << 9);
+
+    uint16_t xt = ((xt_full & mask_26) >> 10) & 0xffff;
+    uint16_t yt = ((yt_full & mask_26) >> 10) & 0xffff;
+
+    // The map is 1024x1024 pixels and anything outside of it is transparent
+    if (xt >= 0x400 || yt >= 0x400) {
+        return 0;
+    }
+
+    // Maps are stored as bytes in the even half and 8bpp tiles in the odd half
+    uint16_t map_address = (yt >> 3) << 7 | (xt >> 3);
+    uint16_t map_word = vram_even[map_address >> 1];
+    uint8_t tile = (map_address & 1) ? map_word >> 8 : map_word & 0xff;
+
+    uint16_t pixel_address = tile << 6 | (yt & 0x07) << 3 | (xt & 0x07);
+    uint16_t pixel_word = vram_odd[pixel_address >> 1];
+
+    return (pixel_address & 1) ? pixel_word >> 8 : pixel_word & 0xff;
+}
+
+VDPModel::SpriteHits VDPModel::render_sprite_line(uint16_t sprite_line, std::vector<uint16_t> &line_buffer) const {
+    std::fill(line_buffer.begin(), line_buffer.end(), 0);
+
+    SpriteHits hits = {0, 0};
+
+    const uint16_t tile_base = sprite_tile_base << 10;
+
+    // Sprites are drawn in ID order so higher IDs are drawn over lower ones
+    for (size_t id = 0; id < sprite_count; id++) {
+        // y_block: ----whYy yyyyyyyy
+        uint16_t y_block = sprite_y_block[id];
+        uint16_t sprite_y = y_block & 0x1ff;
+        uint8_t height = (y_block & (1 << 10)) ? 16 : 8;
+
+        uint16_t line_offset = (sprite_line - sprite_y) & 0x1ff;
+        if (line_offset >= height) {
+            continue;
+        }
+
+        if (y_block & (1 << 9)) {
+            line_offset = height - line_offset - 1;
+        }
+
+        bool wide = y_block & (1 << 11);
+
+        hits.sprites++;
+        hits.pixels += wide ? 16 : 8;
+
+        // x_block: -----Xxx xxxxxxxx
+        uint16_t x_block = sprite_x_block[id];
+        uint16_t sprite_x = x_block & 0x3ff;
+        bool flip_x = x_block & (1 << 10);
+
+        // g_block: ppppPPgg gggggggg
+        uint16_t g_block = sprite_g_block[id];
+        uint16_t character = g_block & 0x3ff;
+        uint16_t attributes = ((g_block >> 10) & 0x03) << 8 | (g_block >> 12) << 4;
+
+        uint16_t row_address = tile_base + character * 8 + (line_offset & 0x07) + (line_offset >> 3) * 128;
+
+        for (uint8_t half = 0; half < (wide ? 2 : 1); half++) {
+            uint16_t address = (row_address + half * 8) % vram_size;
+            uint32_t row_data = vram_odd[address] << 16 | vram_even[address];
+
+            uint16_t x_start = sprite_x + ((half ^ flip_x) * 8);
+
+            for (uint8_t i = 0; i < 8; i++) {
+                uint8_t shift = flip_x ? i * 4 : 28 - i * 4;
+                uint8_t pixel = (row_data >> shift) & 0x0f;
+
+                if (pixel) {
+                    line_buffer[(x_start + i) & (sprite_line_size - 1)] = attributes | pixel;
+                }
+            }
+        }
+    }
+
+    return hits;
+}
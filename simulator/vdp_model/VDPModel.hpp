@@ -0,0 +1,213 @@
+// VDPModel.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Behavioral model of the VDP (hardware/vdp/vdp.v)
+// This renders pixels directly from VRAM, palette RAM, sprite metadata and the scroll / affine registers
+// rather than evaluating the pipelined RTL cycle by cycle.
+
+// Rendering is lazy: pixels are only drawn when the raster passes the end of a line or when a register
+// write (from the host or the copper) is about to change the state used for the rest of the line.
+// This keeps mid-line register writes intact without having to evaluate every pixel individually.
+
+// Known differences from the RTL:
+// - Sprites aren't dropped on lines where the RTL would run out of time to render all of them
+//   (line_usage() estimates how many would be dropped from the number of sprite slots in each line)
+// - Register writes apply on the cycle they're made, ignoring the fixed pipeline latency of the RTL
+
+#ifndef VDPModel_hpp
+#define VDPModel_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "VDPTiming.hpp"
+#include "VDPCopper.hpp"
+
+class VDPModel {
+
+public:
+    enum class Layer: uint8_t {
+        SCROLL0 = 0, SCROLL1 = 1, SCROLL2 = 2, SCROLL3 = 3,
+        SPRITES = 4,
+        NONE = 5
+    };
+
+    /// Set in a line_layers() entry if the pixel was alpha blended with a layer in the alpha-over set.
+    static const uint8_t LAYER_BLENDED = 0x80;
+
+    static const size_t vram_size = 0x4000;
+    static const size_t palette_size = 0x100;
+    static const size_t sprite_count = 0x100;
+
+    VDPModel(const VDPTiming &timing = VDPTiming::mode_configured());
+
+    // Host interface
+
+    /// Writes a VDP register. The register index is the same one used by the CPU ((address >> 1) & 0x1f).
+    void write(uint8_t reg, uint16_t data);
+    /// Reads the current raster position, as the RTL does.
+    uint16_t read(uint8_t reg) const;
+
+    void write_copper_ram(uint16_t address, uint16_t data);
+
+    // Timing
+
+    /// Advances the raster by the given number of VDP cycles (one cycle per pixel).
+    void run(uint64_t cycles);
+
+    uint16_t raster_x() const { return current_x; }
+    uint16_t raster_y() const { return current_y; }
+    uint64_t frame_count() const { return frames_completed; }
+
+    const VDPTiming &video_timing() const { return timing; }
+
+    /// Returns true if the copper executed an op or data word on the last cycle run, which is then copied to execution.
+    bool copper_execution(VDPCopper::Execution *execution) const;
+
+    // Sprite and VRAM bus activity over one line
+    // The VRAM bus slots are derived from the fixed slot order of vdp_vram_bus_arbiter_standard.v rather than being counted
+    struct LineUsage {
+        uint16_t raster_y;
+
+        // Sprites drawn into the line buffer during this line, which is displayed on the next one
+        uint16_t sprites_hit;
+        uint16_t sprite_pixels_hit;
+        // Limited to 8 pixels for each sprite slot in the line, as the RTL would be
+        uint16_t sprite_pixels_rendered;
+
+        uint16_t layer_slots;
+        uint16_t sprite_slots;
+        uint16_t host_slots;
+        uint16_t affine_slots;
+
+        uint16_t host_writes;
+        uint16_t host_writes_dropped;
+    };
+
+    /// Returns true if a line ended on the last cycle run, which then has its usage copied to usage.
+    bool line_usage(LineUsage *usage) const;
+
+    /// Moves the raster to the given position without drawing any of the skipped pixels.
+    /// This is used to align the model with an external reference such as the RTL.
+    void sync_raster(uint16_t x, uint16_t y);
+
+    // Output
+
+    /// RGB444 pixel (0x0rgb) at the given active display position.
+    /// Pixels on the current line are only valid up to the current raster position.
+    uint16_t pixel(uint16_t x, uint16_t y) const { return frame[(size_t)y * timing.h_active + x]; }
+    const uint16_t *line_pixels(uint16_t y) const { return &frame[(size_t)y * timing.h_active]; }
+
+    /// The layer that produced each pixel, optionally combined with LAYER_BLENDED.
+    const uint8_t *line_layers(uint16_t y) const { return &frame_layers[(size_t)y * timing.h_active]; }
+
+    /// Draws any pending pixels on the current line up to the current raster position.
+    void render_pending();
+
+    // Direct state access (used for preloading and inspection)
+
+    uint16_t vram_even[vram_size] = {0};
+    uint16_t vram_odd[vram_size] = {0};
+    uint16_t palette[palette_size] = {0};
+
+    uint16_t sprite_x_block[sprite_count] = {0};
+    uint16_t sprite_y_block[sprite_count] = {0};
+    uint16_t sprite_g_block[sprite_count] = {0};
+
+    uint16_t copper_ram[VDPCopper::ram_size] = {0};
+
+private:
+    VDPTiming timing;
+    VDPCopper copper;
+    bool copper_stepped = false;
+
+    bool line_ended = false;
+    LineUsage current_line_usage = {};
+    LineUsage previous_line_usage = {};
+
+    uint16_t current_x = 0;
+    uint16_t current_y = 0;
+    uint64_t frames_completed = 0;
+
+    // Registers
+
+    uint8_t layer_enable = 0;
+    uint8_t alpha_over_enable = 0;
+    uint16_t scroll_tile_base = 0;
+    uint16_t scroll_map_base = 0;
+    uint16_t scroll_x[4] = {0};
+    uint16_t scroll_y[4] = {0};
+    uint8_t scroll_use_wide_map = 0;
+    uint8_t sprite_tile_base = 0;
+    bool copper_enable = false;
+
+    uint8_t sprite_meta_address = 0;
+    uint8_t sprite_meta_block = 0;
+
+    uint8_t palette_address = 0;
+
+    uint16_t vram_address = 0;
+    uint8_t vram_address_increment = 0;
+
+    void write_register(uint8_t reg, uint16_t data);
+    void write_vram(uint16_t data);
+
+    // Rendering
+
+    std::vector<uint16_t> frame;
+    std::vector<uint8_t> frame_layers;
+
+    // Next pixel (active display x) to draw on the current line
+    uint16_t line_render_x = 0;
+    uint8_t previous_source_alpha = 0;
+
+    // Sprites are drawn into line buffers a line ahead of the one being displayed
+    // Entry format is the same as the RTL: {priority[1:0], palette[3:0], pixel[3:0]}
+    static const size_t sprite_line_size = 0x400;
+    std::vector<uint16_t> sprite_line_display;
+    std::vector<uint16_t> sprite_line_pending;
+
+    // Display line N shows sprites that intersect sprite line (N + 1)
+    // This matches the raster offset used by the RTL sprite core (sprites_y)
+    static const uint16_t sprite_line_offset = 1;
+
+    struct SpriteHits {
+        uint16_t sprites;
+        uint16_t pixels;
+    };
+
+    void advance_line();
+    SpriteHits render_sprite_line(uint16_t sprite_line, std::vector<uint16_t> &line_buffer) const;
+    void end_line_usage();
+    void render_span(uint16_t x_end);
+
+    uint8_t scroll_pixel(uint8_t layer, int32_t x, uint16_t y) const;
+    uint8_t affine_pixel(int32_t x, uint16_t y) const;
+
+    struct PrioritizedPixel {
+        uint8_t pixel;
+        Layer layer;
+        uint8_t priority;
+    };
+
+    PrioritizedPixel prioritize(uint8_t layers, const uint8_t *scroll_pixels, uint16_t sprite_entry) const;
+
+    struct ResolvedPixel {
+        uint16_t color;
+        uint8_t source_alpha;
+        uint8_t layer;
+    };
+
+    ResolvedPixel resolve_pixel(int32_t x, uint16_t y, uint8_t previous_source_alpha) const;
+
+    static uint16_t blend(uint16_t source_color, uint16_t dest_color, bool source_visible);
+
+    bool affine_enabled() const { return layer_enable & 0x20; }
+    bool affine_fetching() const;
+};
+
+#endif /* VDPModel_hpp */
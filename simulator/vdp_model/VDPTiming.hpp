@@ -0,0 +1,78 @@
+// VDPTiming.hpp
+//
+// Copyright (C) 2020 Dan Rodrigues <danrr.gh.oss@gmail.com>
+//
+// SPDX-License-Identifier: MIT
+
+// Video timing parameters matching those selected in vdp.v (ENABLE_WIDESCREEN)
+// Horizontally, the raster starts with the offscreen area: frontporch, sync, backporch and then active pixels
+// Vertically, the raster starts with the active lines and is followed by the offscreen lines
+
+#ifndef VDPTiming_hpp
+#define VDPTiming_hpp
+
+#include <stdint.h>
+#include <initializer_list>
+
+struct VDPTiming {
+    uint16_t h_active, h_frontporch, h_sync, h_backporch;
+    uint16_t v_active, v_frontporch, v_sync, v_backporch;
+    // clk_2x frequency in Hz, as in hardware/clocks.vh
+    uint32_t pixel_clock;
+
+    uint16_t h_offscreen() const { return h_frontporch + h_sync + h_backporch; }
+    uint16_t h_total() const { return h_active + h_offscreen(); }
+    uint16_t v_total() const { return v_active + v_frontporch + v_sync + v_backporch; }
+
+    uint32_t frame_cycles() const { return (uint32_t)h_total() * v_total(); }
+
+    /// Rate of samples output by the audio mixer, which is driven by clk_2x and rounds down to a whole number of
+    /// cycles per sample (ics32.v). This differs slightly from the nominal 44.1KHz.
+    uint32_t audio_sample_rate() const { return pixel_clock / (pixel_clock / 44100); }
+
+    bool hsync_active(uint16_t raster_x) const {
+        return raster_x >= h_frontporch && raster_x < h_frontporch + h_sync;
+    }
+
+    bool vsync_active(uint16_t raster_y) const {
+        return raster_y >= v_active + v_frontporch && raster_y < v_active + v_frontporch + v_sync;
+    }
+
+    bool active_display(uint16_t raster_x, uint16_t raster_y) const {
+        return raster_x >= h_offscreen() && raster_y < v_active;
+    }
+
+    /// 848x480@60hz
+    static VDPTiming mode_848x480() {
+        return {848, 16, 112, 112, 480, 6, 8, 23, 33750000};
+    }
+
+    /// 640x480@60hz
+    static VDPTiming mode_640x480() {
+        return {640, 16, 96, 48, 480, 11, 2, 31, 25175000};
+    }
+
+    /// Mode the sims are built for, selected with VIDEO_MODE in the simulator Makefile.
+    static VDPTiming mode_configured() {
+#if SIM_VIDEO_MODE_640x480
+        return mode_640x480();
+#else
+        return mode_848x480();
+#endif
+    }
+
+    /// Finds the supported mode with the given active display size, such as one measured from vga_de.
+    /// Returns false if there isn't one.
+    static bool mode_with_active_size(uint16_t width, uint16_t height, VDPTiming *timing) {
+        for (auto mode : {mode_848x480(), mode_640x480()}) {
+            if (mode.h_active == width && mode.v_active == height) {
+                *timing = mode;
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+#endif /* VDPTiming_hpp */